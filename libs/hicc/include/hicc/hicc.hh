@@ -34,6 +34,7 @@
 #include "hz-process.hh"
 
 #include "hz-mmap.hh"
+#include "hz-btree-mmap.hh"
 #include "hz-pipeable.hh"
 #include "hz-pool.hh"
 #include "hz-ringbuf.hh"
@@ -0,0 +1,645 @@
+//
+// hz-btree-mmap.hh: a persistent btree on the pages of a memory-mapped file.
+//
+
+#ifndef HICC_CXX_HZ_BTREE_MMAP_HH
+#define HICC_CXX_HZ_BTREE_MMAP_HH
+
+#include <array>
+#include <vector>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+#include "hz-defs.hh"
+
+#include "hz-dbg.hh"
+#include "hz-mmap.hh"
+#include "hz-path.hh"
+
+
+namespace hicc::btree {
+
+    // the index of a page in the file, 0 is the null page
+    using page_id = std::uint64_t;
+
+    namespace detail {
+        // FNV-1a, the checksum of the superblocks
+        inline std::uint64_t fnv1a(void const *data, std::size_t n) {
+            auto const *p = static_cast<unsigned char const *>(data);
+            std::uint64_t h = 14695981039346656037ull;
+            for (std::size_t i = 0; i < n; i++) h = (h ^ p[i]) * 1099511628211ull;
+            return h;
+        }
+
+        /**
+         * @brief the head of a mmap_btree file, kept twice in page 0 and 1.
+         * @details A commit writes the slot of its transaction id (txn % 2),
+         * so the superblock of the previous commit stays intact until the
+         * new one is in the file. The one with the highest txn and a valid
+         * checksum wins when the file is opened.
+         */
+        struct mmap_superblock {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t page_size;
+            std::uint32_t key_size;
+            std::uint32_t degree;
+            std::uint64_t txn;       // the committed transaction
+            page_id root;            // 0 for an empty tree
+            std::uint64_t pages;     // the pages in use, from the file start
+            std::uint64_t size;      // the key count
+            std::uint64_t height;    // the levels count
+            page_id free_list;       // the first free list page, or 0
+            std::uint64_t checksum;  // of all fields above
+
+            static constexpr char const signature[8] = {'h', 'i', 'c', 'c', 'b', 't', 'r', '1'};
+
+            std::uint64_t calc_checksum() const { return fnv1a(this, offsetof(mmap_superblock, checksum)); }
+            bool valid() const { return std::memcmp(magic, signature, sizeof(magic)) == 0 && version == 1 && checksum == calc_checksum(); }
+        };
+
+        // the largest even Degree whose page of keys and page ids fits in
+        // PageSize, after the 16 bytes page header.
+        template<class T, std::size_t PageSize>
+        constexpr int mmap_page_degree() {
+            int d = 4;
+            while (16 + (std::size_t(d + 1) * sizeof(T) + 7) / 8 * 8 + std::size_t(d + 2) * sizeof(page_id) <= PageSize)
+                d += 2;
+            return d;
+        }
+    } // namespace detail
+
+    /**
+     * @brief a B-tree of unique keys persisted in a memory-mapped file.
+     * @details Every node is a fixed-size page addressed by its page_id
+     * in the file, never by a pointer, so the file is mapped as is: opening
+     * a tree is O(1), and the kernel pages in the nodes on demand, the
+     * file may be larger than the RAM.
+     *
+     * The changes are grouped in transactions. A page written by a
+     * committed transaction is never modified: it is copied into a free
+     * page at first touch, and so are its ancestors (path copying). The
+     * replaced pages are freed when the next commit() is durable. commit()
+     * writes the free list into new pages, msync()s the file, then writes
+     * the superblock slot of the transaction and msync()s it, so a crash
+     * at any point leaves the last committed tree intact. Changes not
+     * committed are dropped by rollback() and by the destructor.
+     *
+     * The algorithms are the ones of btree: nodes are split on the way
+     * down at insert, and filled (rotated or merged) on the way down at
+     * remove. Not thread-safe.
+     *
+     * T must be trivially copyable, the bytes of the keys are the file
+     * format. A file can only be opened with the same T and PageSize.
+     * @tparam T the key
+     * @tparam PageSize the node size, the Degree is derived from it
+     * @tparam Comp
+     */
+    template<class T, std::size_t PageSize = 4096, class Comp = std::less<T>>
+    class mmap_btree {
+        static_assert(std::is_trivially_copyable<T>::value, "mmap_btree keys should be trivially copyable");
+        static_assert(alignof(T) <= alignof(std::uint64_t), "over-aligned keys are not supported");
+        static_assert(PageSize >= sizeof(detail::mmap_superblock) && PageSize % 64 == 0, "PageSize is too small");
+
+    public:
+        using elem_type = T;
+        using size_type = std::size_t;
+        static constexpr int degree = detail::mmap_page_degree<T, PageSize>();
+
+        /**
+         * @brief opens the tree in file path, or creates the file.
+         * @details Throws std::runtime_error if the file can't be mapped
+         * or holds no valid superblock for this T and PageSize.
+         */
+        explicit mmap_btree(std::filesystem::path const &path)
+            : _mm(_open(path, _created)) {
+            if (!_mm.is_open())
+                throw std::runtime_error("mmap_btree: can't map " + path.string());
+            if (_created) _format();
+            _load();
+        }
+        virtual ~mmap_btree() = default;
+        CLAZZ_NON_COPYABLE(mmap_btree);
+
+        size_type size() const { return size_type(_sb.size); }
+        bool empty() const { return _sb.size == 0; }
+        int height() const { return int(_sb.height); }
+        // the pages in use, including the superblocks and the free ones
+        std::uint64_t pages() const { return _sb.pages; }
+        // the transaction id the next commit() will write
+        std::uint64_t transaction() const { return _txn; }
+
+        bool exists(T const &key) const {
+            for (page_id id = _sb.root; id;) {
+                page const *p = _page(id);
+                const int idx = _lower(p, key);
+                if (idx < int(p->_count) && !comparer()(key, p->_keys[std::size_t(idx)])) return true;
+                id = p->_leaf ? 0 : p->_children[std::size_t(idx)];
+            }
+            return false;
+        }
+
+        /**
+         * @brief in-order traverse, fn(key) returns false to stop.
+         * @return false if fn stopped it
+         */
+        template<class Fn>
+        bool walk(Fn &&fn) const { return !_sb.root || _walk(_sb.root, fn); }
+        std::vector<T> to_vector() const {
+            std::vector<T> vec;
+            vec.reserve(size());
+            walk([&vec](T const &key) {
+                vec.push_back(key);
+                return true;
+            });
+            return vec;
+        }
+
+        /**
+         * @brief inserts key if it is not present.
+         * @return false if key exists already
+         */
+        bool insert(T const &key) {
+            if (exists(key)) return false;
+            _reserve(4 * std::size_t(_sb.height) + 4);
+            if (!_sb.root) {
+                _sb.root = _allocate(true);
+                _sb.height = 1;
+            }
+            page *r = _writable(_sb.root);
+            if (r->_count == max_keys) {
+                page_id nid = _allocate(false);
+                page *np = _page(nid);
+                np->_children[0] = _sb.root;
+                _sb.root = nid;
+                _sb.height++;
+                _split_child(np, 0);
+                r = np;
+            }
+            _insert_non_full(r, key);
+            _sb.size++;
+            return true;
+        }
+
+        /**
+         * @brief removes key.
+         * @return false if key is not present
+         */
+        bool remove(T const &key) {
+            if (!exists(key)) return false;
+            _reserve(4 * std::size_t(_sb.height) + 4);
+            page *r = _writable(_sb.root);
+            _remove(r, key);
+            if (r->_count == 0) {
+                page_id old = _sb.root;
+                _sb.root = r->_leaf ? 0 : r->_children[0];
+                _sb.height--;
+                _release(old);
+            }
+            _sb.size--;
+            return true;
+        }
+
+        // removes all keys, the pages are freed by the next commit()
+        void clear() {
+            if (_sb.root) _release_subtree(_sb.root);
+            _sb.root = 0;
+            _sb.size = 0;
+            _sb.height = 0;
+        }
+
+        /**
+         * @brief makes the changes durable.
+         * @return false if msync() failed, the transaction is not
+         * committed then and it should be rolled back.
+         */
+        bool commit() {
+            // the free list of the new superblock: the pages free now and
+            // the ones replaced in this transaction. It is written in free
+            // pages, or in pages taken from the end of the file.
+            std::size_t total = _free.size() + _pending.size();
+            _reserve((total + free_list_page::capacity - 1) / free_list_page::capacity);
+            std::vector<page_id> list_pages;
+            while (list_pages.size() * free_list_page::capacity < total) {
+                if (_free.empty()) {
+                    list_pages.push_back(_sb.pages++);
+                    continue;
+                }
+                list_pages.push_back(_free.back());
+                _free.pop_back();
+                total--;
+            }
+            std::vector<page_id> ids{_free};
+            ids.insert(ids.end(), _pending.begin(), _pending.end());
+            page_id next = 0;
+            for (std::size_t i = 0; i < list_pages.size(); i++) {
+                page_id id = list_pages[i];
+                auto *fl = reinterpret_cast<free_list_page *>(_mm.data() + id * PageSize);
+                const std::size_t from = std::min(ids.size(), i * free_list_page::capacity);
+                const std::size_t n = std::min(free_list_page::capacity, ids.size() - from);
+                fl->_txn = _txn;
+                fl->_next = next;
+                fl->_count = n;
+                std::copy(ids.begin() + std::ptrdiff_t(from), ids.begin() + std::ptrdiff_t(from + n), fl->_ids.begin());
+                next = id;
+            }
+            if (!_mm.sync()) return false;
+
+            detail::mmap_superblock sb = _sb;
+            sb.txn = _txn;
+            sb.free_list = next;
+            sb.checksum = sb.calc_checksum();
+            const std::size_t slot = std::size_t(_txn % 2);
+            detail::mmap_superblock old;
+            std::memcpy(&old, _mm.data() + slot * PageSize, sizeof(old));
+            std::memcpy(_mm.data() + slot * PageSize, &sb, sizeof(sb));
+            if (!_mm.sync(slot * PageSize, PageSize)) {
+                // put the old slot back, or rollback() would load the failed
+                // one as the latest commit
+                std::memcpy(_mm.data() + slot * PageSize, &old, sizeof(old));
+                (void) _mm.sync(slot * PageSize, PageSize);
+                return false;
+            }
+
+            _sb = sb;
+            _free.swap(ids);
+            _free.insert(_free.end(), _list_pages.begin(), _list_pages.end());
+            _list_pages.swap(list_pages);
+            _pending.clear();
+            _txn++;
+            return true;
+        }
+
+        // drops the changes since the last commit()
+        void rollback() { _load(); }
+
+        /**
+         * @brief verifies the page sizes and ids, the key order against the
+         * separators, the leaf depth and the key count.
+         */
+        void assert_it() const {
+            if (!_sb.root) {
+                assertm(_sb.size == 0 && _sb.height == 0, "an empty tree has no pages");
+                return;
+            }
+            std::uint64_t keys = 0;
+            _assert_page(_sb.root, 1, nullptr, nullptr, keys);
+            assertm(keys == _sb.size, "the keys in pages should be size()");
+            UNUSED(keys);
+        }
+
+    private:
+        static constexpr int max_keys = degree - 1;
+        static constexpr int min_keys = max_keys / 2;
+        static constexpr int _M = degree / 2;
+
+        struct page {
+            std::uint64_t _txn; // the transaction wrote this page
+            std::uint32_t _count;
+            std::uint32_t _leaf;
+            std::array<T, max_keys> _keys;
+            std::array<page_id, degree> _children;
+        };
+        static_assert(sizeof(page) <= PageSize, "math?");
+        static_assert(std::is_trivially_copyable<page>::value, "page should be trivially copyable");
+
+        struct free_list_page {
+            static constexpr std::size_t capacity = (PageSize - 3 * sizeof(std::uint64_t)) / sizeof(page_id);
+            std::uint64_t _txn;
+            page_id _next;
+            std::uint64_t _count;
+            std::array<page_id, capacity> _ids;
+        };
+
+        static Comp &comparer() {
+            static Comp _c{};
+            return _c;
+        }
+        // the first position whose key is not less than key
+        static int _lower(page const *p, T const &key) {
+            return int(std::lower_bound(p->_keys.data(), p->_keys.data() + p->_count, key, comparer()) - p->_keys.data());
+        }
+        // the first position whose key is greater than key
+        static int _upper(page const *p, T const &key) {
+            return int(std::upper_bound(p->_keys.data(), p->_keys.data() + p->_count, key, comparer()) - p->_keys.data());
+        }
+
+        page *_page(page_id id) { return reinterpret_cast<page *>(_mm.data() + id * PageSize); }
+        page const *_page(page_id id) const { return reinterpret_cast<page const *>(_mm.data() + id * PageSize); }
+
+        // creates the file with the superblocks and some room for nodes if
+        // it doesn't exist. An existing file is never truncated.
+        static hicc::mmap::FILE_HANDLE _open(std::filesystem::path const &path, bool &created) {
+            std::error_code ec;
+            created = !hicc::path::file_exists(path);
+            if (!created && std::filesystem::file_size(path, ec) < 2 * PageSize)
+                throw std::runtime_error("mmap_btree: no valid superblock in " + path.string());
+            if (created && !hicc::io::create_sparse_file(path, 16 * PageSize))
+                throw std::runtime_error("mmap_btree: can't create " + path.string());
+            return hicc::mmap::open_file(hicc::path::to_filename_h(path).c_str(), true, true);
+        }
+        void _format() {
+            std::memset(_mm.data(), 0, 2 * PageSize);
+            detail::mmap_superblock sb{};
+            std::memcpy(sb.magic, detail::mmap_superblock::signature, sizeof(sb.magic));
+            sb.version = 1;
+            sb.page_size = std::uint32_t(PageSize);
+            sb.key_size = std::uint32_t(sizeof(T));
+            sb.degree = std::uint32_t(degree);
+            sb.pages = 2;
+            sb.checksum = sb.calc_checksum();
+            std::memcpy(_mm.data(), &sb, sizeof(sb));
+            if (!_mm.sync())
+                throw std::runtime_error("mmap_btree: can't write the superblock");
+        }
+        // reads the latest valid superblock and its free list
+        void _load() {
+            detail::mmap_superblock a, b;
+            std::memcpy(&a, _mm.data(), sizeof(a));
+            std::memcpy(&b, _mm.data() + PageSize, sizeof(b));
+            detail::mmap_superblock const *sb = nullptr;
+            if (a.valid()) sb = &a;
+            if (b.valid() && (!sb || b.txn > sb->txn)) sb = &b;
+            if (!sb)
+                throw std::runtime_error("mmap_btree: no valid superblock");
+            if (sb->page_size != PageSize || sb->key_size != sizeof(T) || sb->degree != std::uint32_t(degree))
+                throw std::runtime_error("mmap_btree: the file was made for another key type or page size");
+            if (sb->pages * PageSize > _mm.size())
+                throw std::runtime_error("mmap_btree: the file is truncated");
+
+            _sb = *sb;
+            _txn = _sb.txn + 1;
+            _free.clear();
+            _pending.clear();
+            _list_pages.clear();
+            for (page_id id = _sb.free_list; id;) {
+                auto const *fl = reinterpret_cast<free_list_page const *>(_mm.data() + id * PageSize);
+                _free.insert(_free.end(), fl->_ids.begin(), fl->_ids.begin() + std::ptrdiff_t(fl->_count));
+                _list_pages.push_back(id);
+                id = fl->_next;
+            }
+        }
+
+        // makes room for n more pages, so that no remapping happens in the
+        // middle of an operation holding page pointers.
+        void _reserve(std::size_t n) {
+            const std::size_t needed = std::size_t(_sb.pages + n) * PageSize;
+            if (needed <= _mm.size()) return;
+            if (!_mm.resize(std::max(needed, _mm.size() * 2)))
+                throw std::runtime_error("mmap_btree: can't grow the file");
+        }
+        page_id _allocate(bool leaf) {
+            page_id id;
+            if (!_free.empty()) {
+                id = _free.back();
+                _free.pop_back();
+            } else {
+                id = _sb.pages++;
+                assertm(id * PageSize < _mm.size(), "the pages should be reserved before.");
+            }
+            page *p = _page(id);
+            p->_txn = _txn;
+            p->_count = 0;
+            p->_leaf = leaf;
+            p->_children.fill(0);
+            return id;
+        }
+        // frees a page: at once if it was written by this transaction,
+        // else once this transaction is committed.
+        void _release(page_id id) {
+            if (_page(id)->_txn == _txn)
+                _free.push_back(id);
+            else
+                _pending.push_back(id);
+        }
+        void _release_subtree(page_id id) {
+            page const *p = _page(id);
+            if (!p->_leaf)
+                for (std::uint32_t i = 0; i <= p->_count; i++) _release_subtree(p->_children[i]);
+            _release(id);
+        }
+
+        /**
+         * @brief the page at ref made writable in this transaction.
+         * @details A page of a committed transaction is copied, ref is
+         * pointed to the copy. So ref must live in a writable page, or be
+         * the root in the working superblock.
+         */
+        page *_writable(page_id &ref) {
+            page *p = _page(ref);
+            if (p->_txn == _txn) return p;
+            page_id id = _allocate(p->_leaf);
+            page *q = _page(id);
+            std::memcpy(static_cast<void *>(q), p, sizeof(page));
+            q->_txn = _txn;
+            _pending.push_back(ref);
+            ref = id;
+            return q;
+        }
+
+        void _insert_non_full(page *n, T const &key) {
+            for (;;) {
+                int idx = _upper(n, key);
+                if (n->_leaf) {
+                    for (int i = int(n->_count); i > idx; i--) n->_keys[std::size_t(i)] = n->_keys[std::size_t(i - 1)];
+                    n->_keys[std::size_t(idx)] = key;
+                    n->_count++;
+                    return;
+                }
+                page *c = _writable(n->_children[std::size_t(idx)]);
+                if (c->_count == max_keys) {
+                    _split_child(n, idx);
+                    if (comparer()(n->_keys[std::size_t(idx)], key)) idx++;
+                    c = _page(n->_children[std::size_t(idx)]);
+                }
+                n = c;
+            }
+        }
+
+        // splits the full, writable Children[idx] of the writable parent
+        void _split_child(page *parent, int idx) {
+            page *y = _page(parent->_children[std::size_t(idx)]);
+            page_id zid = _allocate(y->_leaf);
+            page *z = _page(zid);
+            z->_count = min_keys;
+            for (int j = 0; j < min_keys; j++) z->_keys[std::size_t(j)] = y->_keys[std::size_t(j + _M)];
+            if (!y->_leaf)
+                for (int j = 0; j < _M; j++) z->_children[std::size_t(j)] = y->_children[std::size_t(j + _M)];
+            y->_count = min_keys;
+
+            for (int j = int(parent->_count); j > idx; j--) {
+                parent->_keys[std::size_t(j)] = parent->_keys[std::size_t(j - 1)];
+                parent->_children[std::size_t(j + 1)] = parent->_children[std::size_t(j)];
+            }
+            parent->_keys[std::size_t(idx)] = y->_keys[std::size_t(_M - 1)];
+            parent->_children[std::size_t(idx + 1)] = zid;
+            parent->_count++;
+        }
+
+        // removes key, which is present, from the sub-tree of the writable n
+        void _remove(page *n, T const &key) {
+            for (;;) {
+                int idx = _lower(n, key);
+                if (idx < int(n->_count) && !comparer()(key, n->_keys[std::size_t(idx)])) {
+                    if (n->_leaf) {
+                        for (int i = idx + 1; i < int(n->_count); i++) n->_keys[std::size_t(i - 1)] = n->_keys[std::size_t(i)];
+                        n->_count--;
+                        return;
+                    }
+                    // replace it by its predecessor or successor and remove
+                    // that one, or merge around it and go on in the child.
+                    if (_page(n->_children[std::size_t(idx)])->_count >= std::uint32_t(_M)) {
+                        T pred = _last_key(n->_children[std::size_t(idx)]);
+                        n->_keys[std::size_t(idx)] = pred;
+                        _remove(_writable(n->_children[std::size_t(idx)]), pred);
+                        return;
+                    }
+                    if (_page(n->_children[std::size_t(idx + 1)])->_count >= std::uint32_t(_M)) {
+                        T succ = _first_key(n->_children[std::size_t(idx + 1)]);
+                        n->_keys[std::size_t(idx)] = succ;
+                        _remove(_writable(n->_children[std::size_t(idx + 1)]), succ);
+                        return;
+                    }
+                    _merge(n, idx);
+                    n = _page(n->_children[std::size_t(idx)]);
+                    continue;
+                }
+
+                assertm(!n->_leaf, "the key should be present.");
+                const bool rightest = idx == int(n->_count);
+                if (_page(n->_children[std::size_t(idx)])->_count < std::uint32_t(_M))
+                    _fill(n, idx);
+                if (rightest && idx > int(n->_count))
+                    idx--;
+                n = _writable(n->_children[std::size_t(idx)]);
+            }
+        }
+
+        T _last_key(page_id id) const {
+            page const *p = _page(id);
+            while (!p->_leaf) p = _page(p->_children[p->_count]);
+            return p->_keys[p->_count - 1];
+        }
+        T _first_key(page_id id) const {
+            page const *p = _page(id);
+            while (!p->_leaf) p = _page(p->_children[0]);
+            return p->_keys[0];
+        }
+
+        // makes Children[idx] of the writable n one key larger
+        void _fill(page *n, int idx) {
+            if (idx != 0 && _page(n->_children[std::size_t(idx - 1)])->_count >= std::uint32_t(_M))
+                _rotate_from_left(n, idx);
+            else if (idx != int(n->_count) && _page(n->_children[std::size_t(idx + 1)])->_count >= std::uint32_t(_M))
+                _rotate_from_right(n, idx);
+            else if (idx != int(n->_count))
+                _merge(n, idx);
+            else
+                _merge(n, idx - 1);
+        }
+
+        // merges Children[idx+1] and n[idx] into Children[idx], which is
+        // writable then.
+        void _merge(page *n, int idx) {
+            page *child = _writable(n->_children[std::size_t(idx)]);
+            const page_id sid = n->_children[std::size_t(idx + 1)];
+            page const *sibling = _page(sid);
+            child->_keys[std::size_t(_M - 1)] = n->_keys[std::size_t(idx)];
+            for (std::uint32_t i = 0; i < sibling->_count; i++) child->_keys[_M + i] = sibling->_keys[i];
+            if (!child->_leaf)
+                for (std::uint32_t i = 0; i <= sibling->_count; i++) child->_children[_M + i] = sibling->_children[i];
+            child->_count += sibling->_count + 1;
+
+            for (int i = idx + 1; i < int(n->_count); i++) n->_keys[std::size_t(i - 1)] = n->_keys[std::size_t(i)];
+            for (int i = idx + 2; i <= int(n->_count); i++) n->_children[std::size_t(i - 1)] = n->_children[std::size_t(i)];
+            n->_children[n->_count] = 0;
+            n->_count--;
+            _release(sid);
+        }
+
+        void _rotate_from_left(page *n, int idx) {
+            page *child = _writable(n->_children[std::size_t(idx)]);
+            page *sibling = _writable(n->_children[std::size_t(idx - 1)]);
+            for (int i = int(child->_count) - 1; i >= 0; --i) child->_keys[std::size_t(i + 1)] = child->_keys[std::size_t(i)];
+            if (!child->_leaf) {
+                for (int i = int(child->_count); i >= 0; --i) child->_children[std::size_t(i + 1)] = child->_children[std::size_t(i)];
+                child->_children[0] = sibling->_children[sibling->_count];
+                sibling->_children[sibling->_count] = 0;
+            }
+            child->_keys[0] = n->_keys[std::size_t(idx - 1)];
+            n->_keys[std::size_t(idx - 1)] = sibling->_keys[sibling->_count - 1];
+            child->_count++;
+            sibling->_count--;
+        }
+
+        void _rotate_from_right(page *n, int idx) {
+            page *child = _writable(n->_children[std::size_t(idx)]);
+            page *sibling = _writable(n->_children[std::size_t(idx + 1)]);
+            child->_keys[child->_count] = n->_keys[std::size_t(idx)];
+            if (!child->_leaf)
+                child->_children[child->_count + 1] = sibling->_children[0];
+            n->_keys[std::size_t(idx)] = sibling->_keys[0];
+            for (std::uint32_t i = 1; i < sibling->_count; ++i) sibling->_keys[i - 1] = sibling->_keys[i];
+            if (!sibling->_leaf) {
+                for (std::uint32_t i = 1; i <= sibling->_count; ++i) sibling->_children[i - 1] = sibling->_children[i];
+                sibling->_children[sibling->_count] = 0;
+            }
+            child->_count++;
+            sibling->_count--;
+        }
+
+        void _assert_page(page_id id, std::uint64_t depth, T const *lo, T const *hi, std::uint64_t &keys) const {
+            assertm(id >= 2 && id < _sb.pages, "a page id should be in the used pages.");
+            page const *p = _page(id);
+            assertm(p->_txn <= _txn, "a page should not be written by a future transaction.");
+            assertm(id == _sb.root || p->_count >= std::uint32_t(min_keys), "_count should be larger than min_keys.");
+            assertm(p->_count <= std::uint32_t(max_keys), "_count should be lower than max_keys.");
+            for (std::uint32_t i = 0; i < p->_count; i++) {
+                assertm(i == 0 || comparer()(p->_keys[i - 1], p->_keys[i]), "keys should be ascending.");
+                assertm(!lo || comparer()(*lo, p->_keys[i]), "a key should be greater than the separator on its left.");
+                assertm(!hi || comparer()(p->_keys[i], *hi), "a key should be lower than the separator on its right.");
+                UNUSED(lo, hi);
+            }
+            keys += p->_count;
+            if (p->_leaf) {
+                assertm(depth == _sb.height, "all leaves should be at the same depth.");
+                UNUSED(depth);
+                return;
+            }
+            for (std::uint32_t i = 0; i <= p->_count; i++)
+                _assert_page(p->_children[i], depth + 1, i == 0 ? lo : &p->_keys[i - 1], i == p->_count ? hi : &p->_keys[i], keys);
+        }
+
+        template<class Fn>
+        bool _walk(page_id id, Fn &fn) const {
+            page const *p = _page(id);
+            for (std::uint32_t i = 0; i < p->_count; i++) {
+                if (!p->_leaf && !_walk(p->_children[i], fn)) return false;
+                if (!fn(p->_keys[i])) return false;
+            }
+            return p->_leaf || _walk(p->_children[p->_count], fn);
+        }
+
+    private:
+        bool _created{}; // set by _open(), it must be declared before _mm
+        hicc::mmap::mmap_um<true, true> _mm;
+        detail::mmap_superblock _sb{}; // the working copy
+        std::uint64_t _txn{};          // the working transaction
+        std::vector<page_id> _free;    // pages free to be written now
+        std::vector<page_id> _pending; // pages replaced in this transaction
+        std::vector<page_id> _list_pages;
+
+    }; // mmap_btree<T>
+
+} // namespace hicc::btree
+
+
+#endif //HICC_CXX_HZ_BTREE_MMAP_HH
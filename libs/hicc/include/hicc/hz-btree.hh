@@ -5,6 +5,7 @@
 #ifndef HICC_CXX_HZ_BTREE_HH
 #define HICC_CXX_HZ_BTREE_HH
 
+#include <array>
 #include <list>
 #include <vector>
 
@@ -14,11 +15,21 @@
 #include <sstream>
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <functional>
+#include <iterator>
 #include <memory>
+#include <new>
+#include <stdexcept>
 
 #include <type_traits>
 #include <typeinfo>
+#include <utility>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "hz-defs.hh"
 
@@ -26,6 +37,25 @@
 #include "hz-log.hh"
 #include "hz-util.hh"
 
+// -DHICC_TEST_BTREE_DBGOUT=1 dumps and verifies the whole tree after
+// each insert/remove. It follows _DEBUG by default, benchmarks should
+// turn it off explicitly.
+#if !defined(HICC_TEST_BTREE_DBGOUT)
+#if defined(_DEBUG)
+#define HICC_TEST_BTREE_DBGOUT 1
+#else
+#define HICC_TEST_BTREE_DBGOUT 0
+#endif
+#endif
+
+#if HICC_TEST_BTREE_DBGOUT
+#define btree_debug dbg_debug
+#define btree_trace dbg_verbose_debug
+#else
+#define btree_debug(...) (void) 0
+#define btree_trace(...) (void) 0
+#endif
+
 
 namespace hicc::btree {
 
@@ -33,10 +63,441 @@ namespace hicc::btree {
     using counter_type = short;
     // using counter_type = std::size_t;
 
+    // the degree sentinel for a btree whose degree is given at runtime
+    constexpr int dynamic_degree = 0;
+
+    /**
+     * @brief the classic key storage: each key is allocated separately
+     * through the tree allocator and a node holds pointers to them.
+     */
+    struct pointer_storage {
+        template<class T>
+        struct traits {
+            using slot_type = T *;
+            static constexpr bool inline_keys = false;
+
+            static T &ref(slot_type const &s) { return *s; }
+            template<class A, class... Args>
+            static slot_type make(A &a, Args &&...args) {
+                using at = std::allocator_traits<A>;
+                T *p = at::allocate(a, 1);
+                try {
+                    at::construct(a, p, std::forward<Args>(args)...);
+                } catch (...) {
+                    at::deallocate(a, p, 1);
+                    throw;
+                }
+                return p;
+            }
+            template<class A>
+            static slot_type adopt(A &a, T *p) {
+                std::unique_ptr<T> holder{p};
+                return make(a, std::move(*p));
+            }
+            template<class A>
+            static void release(A &a, slot_type &s) {
+                using at = std::allocator_traits<A>;
+                if (s) {
+                    at::destroy(a, s);
+                    at::deallocate(a, s, 1);
+                }
+                s = nullptr;
+            }
+            static void reset(slot_type &s) { s = nullptr; }
+            static bool same(slot_type const &a, slot_type const &b) { return a == b; }
+        };
+    };
+
+    /**
+     * @brief keys are stored by value in the packed key array of the node,
+     * next to the child pointers, so a key comparison never leaves the node.
+     * @details T must be default constructible and move assignable, the
+     * unused slots of a node keep default or moved-from values.
+     */
+    struct inline_storage {
+        template<class T>
+        struct traits {
+            using slot_type = T;
+            static constexpr bool inline_keys = true;
+
+            static T &ref(slot_type &s) { return s; }
+            static T const &ref(slot_type const &s) { return s; }
+            template<class A, class... Args>
+            static slot_type make(A &a, Args &&...args) {
+                UNUSED(a);
+                return T(std::forward<Args>(args)...);
+            }
+            template<class A>
+            static slot_type adopt(A &a, T *p) {
+                UNUSED(a);
+                std::unique_ptr<T> holder{p};
+                return std::move(*p);
+            }
+            template<class A>
+            static void release(A &a, slot_type &s) { UNUSED(a, s); }
+            static void reset(slot_type &s) { UNUSED(s); }
+            static bool same(slot_type const &a, slot_type const &b) { return &a == &b; }
+        };
+    };
+
+    /**
+     * @brief every node is allocated from and freed to the tree allocator
+     * one by one.
+     */
+    struct heap_nodes {
+        template<class BlockAlloc>
+        class pool {
+        public:
+            using block_type = typename std::allocator_traits<BlockAlloc>::value_type;
+            static constexpr bool releases_all = false;
+
+            pool(BlockAlloc const &a, std::size_t blocks_per_node)
+                : _alloc(a)
+                , _blocks(blocks_per_node) {}
+
+            block_type *allocate() { return at::allocate(_alloc, _blocks); }
+            void deallocate(block_type *p) { at::deallocate(_alloc, p, _blocks); }
+            void release_all() {}
+
+        private:
+            using at = std::allocator_traits<BlockAlloc>;
+            BlockAlloc _alloc;
+            std::size_t _blocks;
+        };
+    };
+
+    /**
+     * @brief nodes are carved from slabs of the tree allocator, a freed
+     * node goes to a free list and is handed out again by the next split.
+     * @details A slab is released only by release_all(), which frees the
+     * whole tree at once. It's the default one.
+     */
+    struct slab_nodes {
+        template<class BlockAlloc>
+        class pool {
+        public:
+            using block_type = typename std::allocator_traits<BlockAlloc>::value_type;
+            static constexpr bool releases_all = true;
+            // a slab takes about 64KB, and 8 nodes at least
+            static constexpr std::size_t slab_bytes = 64 * 1024;
+
+            pool(BlockAlloc const &a, std::size_t blocks_per_node)
+                : _alloc(a)
+                , _blocks(blocks_per_node)
+                , _per_slab(std::max<std::size_t>(8, slab_bytes / (sizeof(block_type) * blocks_per_node))) {
+                static_assert(sizeof(block_type) >= sizeof(slab_header), "block_type too small");
+            }
+            ~pool() { release_all(); }
+            pool(pool const &) = delete;
+            pool &operator=(pool const &) = delete;
+
+            block_type *allocate() {
+                if (_free) {
+                    auto *p = reinterpret_cast<block_type *>(_free);
+                    _free = _free->next;
+                    return p;
+                }
+                if (_next == _end) _grow();
+                block_type *p = _next;
+                _next += _blocks;
+                return p;
+            }
+            void deallocate(block_type *p) {
+                _free = new (p) free_node{_free};
+            }
+            // frees all slabs, the nodes in them must not be used any more
+            void release_all() {
+                while (_slabs) {
+                    slab_header *next = _slabs->next;
+                    at::deallocate(_alloc, reinterpret_cast<block_type *>(_slabs), _slabs->blocks);
+                    _slabs = next;
+                }
+                _free = nullptr;
+                _next = _end = nullptr;
+            }
+
+        private:
+            using at = std::allocator_traits<BlockAlloc>;
+            struct free_node {
+                free_node *next;
+            };
+            // lives in the first block of a slab
+            struct slab_header {
+                slab_header *next;
+                std::size_t blocks;
+            };
+
+            void _grow() {
+                const std::size_t n = 1 + _blocks * _per_slab;
+                block_type *mem = at::allocate(_alloc, n);
+                _slabs = new (mem) slab_header{_slabs, n};
+                _next = mem + 1;
+                _end = mem + n;
+            }
+
+            BlockAlloc _alloc;
+            std::size_t _blocks;
+            std::size_t _per_slab;
+            slab_header *_slabs{};
+            free_node *_free{};
+            block_type *_next{};
+            block_type *_end{};
+        };
+    };
+
+    namespace detail {
+        // the key and child arrays of a btree node, embedded in the node
+        // when the degree is known at compile-time ...
+        template<class Slot, class NodePtr, int Degree>
+        struct btree_node_arrays {
+            std::array<Slot, Degree - 1> _payloads{};
+            std::array<NodePtr, Degree> _pointers{};
+            btree_node_arrays(Slot *payloads, NodePtr *pointers) { UNUSED(payloads, pointers); }
+        };
+        // ... or trailing the node header in the same block for dynamic_degree.
+        template<class Slot, class NodePtr>
+        struct btree_node_arrays<Slot, NodePtr, dynamic_degree> {
+            Slot *_payloads;
+            NodePtr *_pointers;
+            btree_node_arrays(Slot *payloads, NodePtr *pointers)
+                : _payloads(payloads)
+                , _pointers(pointers) {}
+        };
+
+        // intra-node key search
+        //
+        // Arithmetic keys ordered by std::less, stored inline, are searched
+        // over the packed key array without a branch per key. For 32-bit
+        // integers, small nodes count the keys lower than the target with
+        // SSE2/AVX2 compares. Larger nodes and other arithmetic types use a
+        // branchless binary search. Every other key type falls back to a
+        // plain binary search through the comparer.
+
+        constexpr int floor_log2(int n) { return n <= 1 ? 0 : 1 + floor_log2(n / 2); }
+
+        template<class T, class Comp>
+        struct is_packed_key : std::integral_constant<bool,
+                                                      std::is_arithmetic<T>::value &&
+                                                              (std::is_same<Comp, std::less<T>>::value ||
+                                                               std::is_same<Comp, std::less<>>::value)> {};
+
+        // the largest key count searched by the SIMD count_less(), picked
+        // from the node size sweep in tests/btree.cc. The scalar loop never
+        // beats the branchless binary search, so it is not used by nodes.
+#if !defined(HICC_BTREE_LINEAR_SEARCH_MAX)
+#define HICC_BTREE_LINEAR_SEARCH_MAX 16
+#endif
+        template<class T>
+        constexpr int linear_search_max() {
+#if defined(__AVX2__) || defined(__SSE2__)
+            if constexpr (std::is_same<T, std::int32_t>::value)
+                return HICC_BTREE_LINEAR_SEARCH_MAX;
+#endif
+            return 0;
+        }
+
+        /**
+         * @brief the count of keys[0..count) lower than key, that is the
+         * lower bound of key in the sorted keys.
+         */
+        template<class T>
+        inline int count_less(T const *keys, int count, T const &key) {
+            int n = 0;
+            for (int i = 0; i < count; i++)
+                n += keys[i] < key;
+            return n;
+        }
+
+#if defined(__AVX2__) || defined(__SSE2__)
+        // the lanes of a compare mask are -1 for true, so subtracting the
+        // masks accumulates per-lane counts; no popcount is needed.
+        template<>
+        inline int count_less<std::int32_t>(std::int32_t const *keys, int count, std::int32_t const &key) {
+            int i = 0;
+            __m128i acc = _mm_setzero_si128();
+#if defined(__AVX2__)
+            const __m256i k8 = _mm256_set1_epi32(key);
+            __m256i acc8 = _mm256_setzero_si256();
+            for (; i + 8 <= count; i += 8) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(keys + i));
+                acc8 = _mm256_sub_epi32(acc8, _mm256_cmpgt_epi32(k8, v));
+            }
+            acc = _mm_add_epi32(_mm256_castsi256_si128(acc8), _mm256_extracti128_si256(acc8, 1));
+#endif
+            const __m128i k4 = _mm_set1_epi32(key);
+            for (; i + 4 <= count; i += 4) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(keys + i));
+                acc = _mm_sub_epi32(acc, _mm_cmplt_epi32(v, k4));
+            }
+            acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+            acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+            int n = _mm_cvtsi128_si32(acc);
+            for (; i < count; i++)
+                n += keys[i] < key;
+            return n;
+        }
+#endif
+
+        /**
+         * @brief branchless lower bound over the sorted keys[0..count).
+         */
+        template<class T>
+        inline int branchless_lower_bound(T const *keys, int count, T const &key) {
+            if (count == 0) return 0;
+            T const *base = keys;
+            while (count > 1) {
+                int half = count / 2;
+                base = (base[half] < key) ? base + half : base;
+                count -= half;
+            }
+            return int(base - keys) + (*base < key);
+        }
+
+        template<class T>
+        inline int packed_lower_bound(T const *keys, int count, T const &key) {
+            if (count <= linear_search_max<T>())
+                return count_less(keys, count, key);
+            return branchless_lower_bound(keys, count, key);
+        }
+
+        // the first position whose key is greater than key
+        template<class T>
+        inline int packed_upper_bound(T const *keys, int count, T const &key) {
+            int pos = packed_lower_bound(keys, count, key);
+            while (pos < count && !(key < keys[pos])) pos++;
+            return pos;
+        }
+
+        /**
+         * @brief the key and child moves among an internal node and its
+         * children, shared by btree and the internal levels of bplus_tree.
+         * @details N is a node type with _payloads, _pointers, _count,
+         * degree(), is_leaf() and a static reset_key(); the children taken
+         * from _pointers are N too. The callers keep their own bookkeeping
+         * (subtree counts, leaf links) around these.
+         */
+        struct node_moves {
+            // splits the full Children[idx] into itself and z, the middle key
+            // goes up to parent[idx].
+            template<class N>
+            static void split_child(N *parent, int idx, N *z) {
+                N *y = static_cast<N *>(parent->_pointers[idx]);
+                const int max_payloads = y->degree() - 1;
+                const int min_payloads = max_payloads / 2;
+                const int _M = y->degree() / 2;
+
+                z->_count = min_payloads;
+                for (int j = 0; j < min_payloads; j++) z->_payloads[j] = std::move(y->_payloads[j + _M]);
+                if (!y->is_leaf())
+                    for (int j = 0; j < _M; j++) z->_pointers[j] = y->_pointers[j + _M];
+                y->_count = min_payloads;
+
+                insert_child(parent, idx, std::move(y->_payloads[_M - 1]), z);
+
+                for (int j = y->_count; j < max_payloads; j++) N::reset_key(y->_payloads[j]);
+                for (int j = y->_count + 1; j < y->degree(); j++) y->_pointers[j] = nullptr;
+            }
+
+            // inserts the key at parent[idx] and the child after it
+            template<class N, class Key, class Child>
+            static void insert_child(N *parent, int idx, Key &&key, Child *child) {
+                for (int j = parent->_count; j >= idx + 1; j--) parent->_pointers[j + 1] = parent->_pointers[j];
+                parent->_pointers[idx + 1] = child;
+                for (int j = parent->_count - 1; j >= idx; j--) parent->_payloads[j + 1] = std::move(parent->_payloads[j]);
+                parent->_payloads[idx] = std::forward<Key>(key);
+                parent->_count++;
+            }
+
+            // removes parent[idx] and the child after it
+            template<class N>
+            static void erase_child(N *parent, int idx) {
+                for (int i = idx + 1; i < parent->_count; ++i) parent->_payloads[i - 1] = std::move(parent->_payloads[i]);
+                for (int i = idx + 2; i <= parent->_count; ++i) parent->_pointers[i - 1] = parent->_pointers[i];
+                parent->_pointers[parent->_count] = nullptr;
+                N::reset_key(parent->_payloads[parent->_count - 1]);
+                parent->_count--;
+            }
+
+            // merges Children[idx+1] and parent[idx] into Children[idx], and
+            // returns the emptied sibling for the caller to free.
+            template<class N>
+            static N *merge(N *parent, int idx) {
+                N *child = static_cast<N *>(parent->_pointers[idx]);
+                N *sibling = static_cast<N *>(parent->_pointers[idx + 1]);
+                const int _M = child->degree() / 2;
+
+                assert(child->_count == _M - 1);
+                child->_payloads[_M - 1] = std::move(parent->_payloads[idx]);
+                for (int i = 0; i < sibling->_count; ++i) child->_payloads[i + _M] = std::move(sibling->_payloads[i]);
+                if (!child->is_leaf())
+                    for (int i = 0; i <= sibling->_count; ++i) child->_pointers[i + _M] = sibling->_pointers[i];
+                child->_count += sibling->_count + 1;
+
+                erase_child(parent, idx);
+                return sibling;
+            }
+
+            // pulls parent[idx-1] down to the front of Children[idx], and moves
+            // the last key (and child) of Children[idx-1] up instead.
+            template<class N>
+            static void rotate_from_left(N *parent, int idx) {
+                N *child = static_cast<N *>(parent->_pointers[idx]);
+                N *sibling = static_cast<N *>(parent->_pointers[idx - 1]);
+
+                for (int i = child->_count - 1; i >= 0; --i)
+                    child->_payloads[i + 1] = std::move(child->_payloads[i]);
+                if (!child->is_leaf()) {
+                    for (int i = child->_count; i >= 0; --i)
+                        child->_pointers[i + 1] = child->_pointers[i];
+                    child->_pointers[0] = sibling->_pointers[sibling->_count];
+                    sibling->_pointers[sibling->_count] = nullptr;
+                }
+                child->_payloads[0] = std::move(parent->_payloads[idx - 1]);
+
+                parent->_payloads[idx - 1] = std::move(sibling->_payloads[sibling->_count - 1]);
+                N::reset_key(sibling->_payloads[sibling->_count - 1]);
+
+                child->_count++;
+                sibling->_count--;
+            }
+
+            // pulls parent[idx] down to the end of Children[idx], and moves
+            // the first key (and child) of Children[idx+1] up instead.
+            template<class N>
+            static void rotate_from_right(N *parent, int idx) {
+                N *child = static_cast<N *>(parent->_pointers[idx]);
+                N *sibling = static_cast<N *>(parent->_pointers[idx + 1]);
+
+                child->_payloads[child->_count] = std::move(parent->_payloads[idx]);
+                if (!child->is_leaf())
+                    child->_pointers[child->_count + 1] = sibling->_pointers[0];
+
+                parent->_payloads[idx] = std::move(sibling->_payloads[0]);
+
+                for (int i = 1; i < sibling->_count; ++i)
+                    sibling->_payloads[i - 1] = std::move(sibling->_payloads[i]);
+                N::reset_key(sibling->_payloads[sibling->_count - 1]);
+                if (!sibling->is_leaf()) {
+                    for (int i = 1; i <= sibling->_count; ++i)
+                        sibling->_pointers[i - 1] = sibling->_pointers[i];
+                    sibling->_pointers[sibling->_count] = nullptr;
+                }
+
+                child->_count++;
+                sibling->_count--;
+            }
+        };
+    } // namespace detail
+
     /**
      * @brief provides B-tree data structure in generic style.
      * @tparam T the element/key
+     * @tparam Degree the Order, an even number not less than 4; or
+     *         dynamic_degree to take it from the constructor.
      * @tparam Comp 
+     * @tparam Alloc allocator for the keys, it is rebound for the nodes
+     * @tparam Storage key storage policy, pointer_storage or inline_storage
+     * @tparam Nodes node allocation policy, slab_nodes or heap_nodes
      * @details The degree, aka the Order of a B-tree, is the maximal children
      * count. In our B-tree model, a node has:
      * 
@@ -47,22 +508,41 @@ namespace hicc::btree {
      * it contains 3,4,5 and 6 keys. NOTE [7/2] is rounded up ceiling.
      * In coding with C/C++:
      * 
-     *     const int max_payloads = _degree - 1;
+     *     const int max_payloads = degree() - 1;
      *     const int min_payloads = max_payloads / 2;
      *     const int max_children = _degree;
      *     const int min_children = (_degree + 1) / 2;
      *     const int M = _degree / 2;
      *     const int _M = min_payloads + 1;
      *     assert(M == _M);
+     *
+     * The algorithms assume an even degree.
+     *
+     * Every node is a single block aligned to the cache line, taken from
+     * the slabs of a node pool by default. With a compile-time Degree the
+     * key and child arrays are std::array members of the node, so the
+     * intra-node loops have constant bounds.
+     * hicc::cross::btree_degree<T>() picks a Degree from sizeof(T) and the
+     * cache line size.
      */
-    template<class T, class Comp = std::less<T>>
+    template<class T, int Degree = hicc::cross::btree_degree<T>(), class Comp = std::less<T>,
+             class Alloc = std::allocator<T>, class Storage = pointer_storage, class Nodes = slab_nodes>
     class btree {
+        static_assert(Degree == dynamic_degree || (Degree >= 4 && Degree % 2 == 0),
+                      "btree Degree should be an even number not less than 4");
+
     public:
-        btree(int degree = 4)
-            : _degree(degree)
-            , _size(0)
-            , _root(nullptr) {}
+        // for dynamic_degree only. Throws std::invalid_argument if degree
+        // is odd or less than 4.
+        template<int D = Degree, std::enable_if_t<D == dynamic_degree, int> = 0>
+        btree(int degree = 4, Alloc const &alloc = Alloc())
+            : btree(_checked_degree(degree), alloc, 0) {}
+        // a compile-time Degree takes no degree argument.
+        template<int D = Degree, std::enable_if_t<D != dynamic_degree, int> = 0>
+        explicit btree(Alloc const &alloc = Alloc())
+            : btree(Degree, alloc, 0) {}
         virtual ~btree() { clear(); }
+        CLAZZ_NON_COPYABLE(btree);
 
     public:
         struct node;
@@ -83,6 +563,14 @@ namespace hicc::btree {
         using elem_ref = elem_type &;
         using const_elem_ref = elem_type const &;
 
+        using storage = typename Storage::template traits<T>;
+        using slot_type = typename storage::slot_type;
+
+        using allocator_type = Alloc;
+        using block_type = hicc::cross::cacheline_align_t;
+        using block_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<block_type>;
+        using node_pool = typename Nodes::template pool<block_allocator>;
+
         using visitor_l = std::function<bool(traversal_context const &)>;
 
         struct traversal_context {
@@ -105,8 +593,8 @@ namespace hicc::btree {
         struct position_t {
             const_node_ptr ptr;
             int pos; // pointer to the payload or pointers
-            const_elem_ptr get() const { return ptr->_payloads[pos]; }
-            elem_ptr get() { return const_cast<node_ptr>(ptr)->_payloads[pos]; }
+            const_elem_ptr get() const { return &ptr->key(pos); }
+            elem_ptr get() { return &const_cast<node_ptr>(ptr)->key(pos); }
             const_node_ptr operator->() const { return ptr; }
             position_t &operator=(const position_t &o) {
                 ptr = o.ptr;
@@ -150,137 +638,153 @@ namespace hicc::btree {
             bool operator!() const { return !valid(); }
         };
 
-        struct node {
+        struct node : detail::btree_node_arrays<slot_type, node *, Degree> {
+            using arrays = detail::btree_node_arrays<slot_type, node *, Degree>;
+            using arrays::_payloads;
+            using arrays::_pointers;
+
             int _degree;
             int _count;
-            elem_ptr *_payloads;
-            node_ptr *_pointers;
+            size_type _subtree_count; // keys in the sub-tree rooted with this node
             friend class btree;
+            friend struct detail::node_moves;
 
-            node(int degree)
-                : _degree(degree)
+            static void reset_key(slot_type &s) { storage::reset(s); }
+
+            node(int degree, slot_type *payloads = nullptr, node_ptr *pointers = nullptr)
+                : arrays(payloads, pointers)
+                , _degree(degree)
                 , _count(0)
-                , _payloads(nullptr)
-                , _pointers(nullptr) {
+                , _subtree_count(0) {
                 if (_degree > 0) {
-                    const int max_payloads = _degree - 1;
+                    const int max_payloads = this->degree() - 1;
                     // const int min_payloads = max_payloads / 2;
-                    _payloads = new elem_ptr[max_payloads];
-                    _pointers = new node_ptr[_degree];
-                    for (int i = 0; i < max_payloads; i++) _payloads[i] = nullptr;
                     for (int i = 0; i <= max_payloads; i++) _pointers[i] = nullptr;
                 }
             }
-            ~node() {
-                if (_degree > 0) {
-#if defined(_DEBUG)
-                    auto str = to_string();
-                    dbg_verbose_debug("    ~node() for %p, %d payloads: [%s]", this, _count, str.c_str());
-#endif
-                    // const int max_payloads = _degree - 1;
-                    // const int min_payloads = max_payloads / 2;
-                    for (int i = 0; i < _count; i++)
-                        if (auto *p = _payloads[i]; p) delete p;
-                    for (int i = 0; i <= _count; i++)
-                        if (auto *p = _pointers[i]; p) delete p;
-                    delete[] _pointers;
-                    delete[] _payloads;
-#if defined(_DEBUG)
-                    dbg_verbose_debug("    ~node() for %p, %d payloads: [%s] END", this, _count, str.c_str());
-#endif
-                }
-            }
+            ~node() = default;
             node_ptr reset_for_delete() {
-                const int max_payloads = _degree - 1;
+                const int max_payloads = degree() - 1;
                 // const int min_payloads = max_payloads / 2;
-                for (int i = 0; i < max_payloads; i++) _payloads[i] = nullptr;
+                for (int i = 0; i < max_payloads; i++) storage::reset(_payloads[i]);
                 for (int i = 0; i <= max_payloads; i++) _pointers[i] = nullptr;
+                _count = 0;
+                _subtree_count = 0;
                 return this;
             }
 
+            // the Order of this node, a constant for compile-time Degree
+            constexpr int degree() const {
+                if constexpr (Degree != dynamic_degree)
+                    return Degree;
+                else
+                    return _degree;
+            }
+
+            /**
+             * @brief the bytes of a node block, the layout for dynamic_degree is:
+             *
+             *     [ node | slot_type x (degree-1) | node_ptr x degree ]
+             *
+             * @param degree 
+             * @return 
+             */
+            static constexpr std::size_t bytes(int degree) {
+                if constexpr (Degree != dynamic_degree) {
+                    UNUSED(degree);
+                    return sizeof(node);
+                } else {
+                    return pointers_offset(degree) + std::size_t(degree) * sizeof(node_ptr);
+                }
+            }
+            static constexpr std::size_t keys_offset() { return _align_up(sizeof(node), alignof(slot_type)); }
+            static constexpr std::size_t pointers_offset(int degree) {
+                return _align_up(keys_offset() + std::size_t(degree - 1) * sizeof(slot_type), alignof(node_ptr));
+            }
+
+        private:
+            static constexpr std::size_t _align_up(std::size_t n, std::size_t a) { return (n + a - 1) / a * a; }
+
         public:
-            void insert_non_full(elem_ptr el) {
-                dbg_debug("    insert_non_full(%s) for node [%s]", elem_to_string(el).c_str(), to_string().c_str());
-                int idx = _count - 1;
+            void insert_non_full(btree &bt, slot_type el) {
+                btree_debug("    insert_non_full(%s) for node [%s]", elem_to_string(storage::ref(el)).c_str(), to_string().c_str());
+                int idx = upper_position(storage::ref(el));
+                _subtree_count++;
                 if (is_leaf()) {
-                    while (idx >= 0 && is_less_than(el, _payloads[idx])) {
-                        _payloads[idx + 1] = _payloads[idx];
-                        idx--;
-                    }
-                    _payloads[idx + 1] = el;
+                    for (int i = _count; i > idx; i--)
+                        _payloads[i] = std::move(_payloads[i - 1]);
+                    _payloads[idx] = std::move(el);
                     _count++;
                     return;
                 }
 
-                const int max_payloads = _degree - 1;
-                while (idx >= 0 && is_less_than(el, _payloads[idx])) idx--;
-                if (_pointers[idx + 1]->_count == max_payloads) {
-                    _split_child(idx + 1, _pointers[idx + 1]);
-                    if (*_payloads[idx + 1] < *el) idx++;
+                const int max_payloads = degree() - 1;
+                if (_pointers[idx]->_count == max_payloads) {
+                    _split_child(bt, idx, _pointers[idx]);
+                    if (is_less_than(key(idx), storage::ref(el))) idx++;
                 }
-                _pointers[idx + 1]->insert_non_full(el);
+                _pointers[idx]->insert_non_full(bt, std::move(el));
             }
 
         private:
-            void _split_child(int idx, node_ptr y) {
-                const int max_payloads = _degree - 1;
+            void _split_child(btree &bt, int idx, node_ptr y) {
+                const int max_payloads = degree() - 1;
                 const int min_payloads = max_payloads / 2;
-                const int _M = _degree / 2;
+                const int _M = degree() / 2;
                 assert(_M == min_payloads + 1);
 
-                dbg_debug("    _split_child(%d) for node [%s]", idx, y->to_string().c_str());
-
-                node_ptr z = new node(y->_degree);
-                z->_count = min_payloads;
-                for (int j = 0; j < min_payloads; j++) z->_payloads[j] = y->_payloads[j + _M];
-                if (!y->is_leaf())
-                    for (int j = 0; j < _M; j++) z->_pointers[j] = y->_pointers[j + _M];
-
-                y->_count = min_payloads;
+                btree_debug("    _split_child(%d) for node [%s]", idx, y->to_string().c_str());
 
-                for (int j = _count; j >= idx + 1; j--) _pointers[j + 1] = _pointers[j];
-                _pointers[idx + 1] = z;
-                for (int j = _count - 1; j >= idx; j--) _payloads[j + 1] = _payloads[j];
-                _payloads[idx] = y->_payloads[_M - 1];
-                _count++;
+                node_ptr z = bt._create_node();
+                detail::node_moves::split_child(this, idx, z);
 
-                for (int j = y->_count; j < max_payloads; j++) y->_payloads[j] = nullptr;
-                for (int j = y->_count + 1; j < _degree; j++) y->_pointers[j] = nullptr;
+                z->_subtree_count = size_type(min_payloads);
+                if (!z->is_leaf())
+                    for (int j = 0; j < _M; j++) z->_subtree_count += z->_pointers[j]->_subtree_count;
+                y->_subtree_count -= z->_subtree_count + 1;
             }
 
         public:
-            elem_ptr remove(const_elem_ref el) { return _remove(&el); }
-            elem_ptr remove(const_elem_ptr el) { return _remove(el); }
-
-        private:
             /**
              * @brief remove the key 'el' from the sub-tree rooted with this node.
              * @param el the removing key
-             * @return the remove key, it should be euqal to 'el' but live with non-'const'
+             * @param out receives the slot of the removed key, the caller releases it
+             * @return true if the key was found and removed
              */
-            elem_ptr _remove(const_elem_ptr el) {
-                const int max_payloads = _degree - 1;
+            bool remove(btree &bt, const_elem_ref el, slot_type &out) { return _remove(bt, el, out); }
+            bool remove(btree &bt, const_elem_ptr el, slot_type &out) { return _remove(bt, *el, out); }
+
+        private:
+            bool _remove(btree &bt, const_elem_ref el, slot_type &out) {
+                if (!_remove_from_subtree(bt, el, out))
+                    return false;
+                _subtree_count--;
+                return true;
+            }
+
+            bool _remove_from_subtree(btree &bt, const_elem_ref el, slot_type &out) {
+                const int max_payloads = degree() - 1;
                 const int min_payloads = max_payloads / 2;
-                const int _M = _degree / 2;
+                const int _M = degree() / 2;
                 assert(_M == min_payloads + 1);
                 UNUSED(min_payloads, max_payloads);
 
                 int idx = first_of_insertion_position(el);
-                dbg_debug("    _remove(%s) from node [%s] | pos found: %d | D=%d, _M=%d, [%d, %d]", elem_to_string(el).c_str(), to_string().c_str(), idx, _degree, _M, min_payloads, max_payloads);
+                btree_debug("    _remove(%s) from node [%s] | pos found: %d | D=%d, _M=%d, [%d, %d]", elem_to_string(el).c_str(), to_string().c_str(), idx, degree(), _M, min_payloads, max_payloads);
 
                 // while the key to be removed is present in this node
-                if (idx < _count && is_equal_to(el, _payloads[idx])) {
+                if (idx < _count && is_equal_to(el, key(idx))) {
                     // erase it directly
                     if (is_leaf())
-                        return _remove_at(idx);
+                        return _remove_at(idx, out);
                     // or advance the focus into the internal node and
                     // try removing it recursively.
-                    return _remove_from_internal_node(idx);
+                    return _remove_from_internal_node(bt, idx, out);
                 }
 
                 // if this node is a leaf node, then the key is not present in tree
                 if (is_leaf())
-                    return nullptr; // nothing to do
+                    return false; // nothing to do
 
                 // The key to be removed is present in the sub-tree rooted
                 // with this node, the flag 'rightest' indicates whether the
@@ -292,7 +796,7 @@ namespace hicc::btree {
                 // keys, fill it at first. So we get a half-full node at least for
                 // the removing action in the child tree later.
                 if (_pointers[idx]->_count < _M)
-                    _fill(idx);
+                    _fill(bt, idx);
 
                 // if the last child has been merged/filled, it must have merged
                 // with the previous child and so we recurse on the (idx-1)th
@@ -300,49 +804,51 @@ namespace hicc::btree {
                 // Or, we recurse on the (idx)th child which now has at least _M
                 // keys.
                 if (rightest && idx > _count)
-                    return _pointers[idx - 1]->_remove(el);
-                return _pointers[idx]->_remove(el);
+                    return _pointers[idx - 1]->_remove(bt, el, out);
+                return _pointers[idx]->_remove(bt, el, out);
             }
 
             /**
              * @brief remove the idx-th key from this node, if it is a leaf node
              * @param idx 
-             * @return the removed key
+             * @param out receives the removed key
+             * @return true
              */
-            elem_ptr _remove_at(int idx) {
-                elem_ptr removing = get_el_ptr(idx);
-                dbg_verbose_debug("    _remove_at(%d) (target=%s) for node [%s], cnt=%d", idx, elem_to_string(removing).c_str(), to_string().c_str(), _count);
-                for (int i = idx + 1; i < _count; ++i) _payloads[i - 1] = _payloads[i];
-                _payloads[_count-- - 1] = nullptr;
-                dbg_verbose_debug("    _remove_at(%d) (target=%s) END. node [%s], cnt=%d", idx, elem_to_string(removing).c_str(), to_string().c_str(), _count);
-                return removing;
+            bool _remove_at(int idx, slot_type &out) {
+                btree_trace("    _remove_at(%d) (target=%s) for node [%s], cnt=%d", idx, elem_to_string(key(idx)).c_str(), to_string().c_str(), _count);
+                out = std::move(_payloads[idx]);
+                for (int i = idx + 1; i < _count; ++i) _payloads[i - 1] = std::move(_payloads[i]);
+                storage::reset(_payloads[_count-- - 1]);
+                btree_trace("    _remove_at(%d) END. node [%s], cnt=%d", idx, to_string().c_str(), _count);
+                return true;
             }
 
             /**
              * @brief remove the idx-th key from this node - which is a non-leaf node
              * @param idx 
-             * @return the removed key
+             * @param out receives the removed key
+             * @return true
              */
-            elem_ptr _remove_from_internal_node(int idx) {
-                const int max_payloads = _degree - 1;
+            bool _remove_from_internal_node(btree &bt, int idx, slot_type &out) {
+                const int max_payloads = degree() - 1;
                 const int min_payloads = max_payloads / 2;
-                const int _M = _degree / 2;
+                const int _M = degree() / 2;
                 assert(_M == min_payloads + 1);
                 UNUSED(min_payloads, max_payloads);
 
-                elem_ptr k = _payloads[idx];
-                dbg_debug("    _remove_from_internal_node(%d) [target=%s] for node [%s]", idx, elem_to_string(k).c_str(), to_string().c_str());
+                btree_debug("    _remove_from_internal_node(%d) [target=%s] for node [%s]", idx, elem_to_string(key(idx)).c_str(), to_string().c_str());
 
                 if (node_ptr p = _pointers[idx]; p->_count >= _M) {
                     // If the child that precedes k (Children[idx]) has at least
                     // _M keys, find the predecessor 'pred' of k in the subtree
                     // rooted at Children[idx].
                     // And, replace k by pred.
-                    // And, recursively delete pred in Children[idx]
-                    elem_ptr pred = _predecessor(idx);
-                    _payloads[idx] = pred;
-                    p->_remove(pred);
-                    return k;
+                    // And, recursively delete pred in Children[idx]. The slot
+                    // dropped there is the one now living in this[idx].
+                    out = std::move(_payloads[idx]);
+                    _payloads[idx] = _predecessor(idx);
+                    slot_type dropped{};
+                    return p->_remove(bt, key(idx), dropped);
                 }
 
                 if (node_ptr p = _pointers[idx + 1]; p->_count >= _M) {
@@ -351,10 +857,10 @@ namespace hicc::btree {
                     // rooted at Children[idx+1].
                     // And, replace k by succ.
                     // And, recursively delete succ in Children[idx]
-                    elem_ptr succ = _successor(idx);
-                    _payloads[idx] = succ;
-                    p->_remove(succ);
-                    return k;
+                    out = std::move(_payloads[idx]);
+                    _payloads[idx] = _successor(idx);
+                    slot_type dropped{};
+                    return p->_remove(bt, key(idx), dropped);
                 }
 
                 // If both Children[idx] and Children[idx+1] has less than _M keys,
@@ -362,8 +868,11 @@ namespace hicc::btree {
                 // After merged, Children[idx] will contain MAX-PAYLOADS keys.
                 // the node Children[idx+1] will be free after k was deleted from
                 // Children[idx] recursively.
-                _merge(idx);
-                return _pointers[idx]->_remove(k);
+                // k moves around inside the merged child while it is being
+                // removed, so search it by a copy.
+                elem_type k{key(idx)};
+                _merge(bt, idx);
+                return _pointers[idx]->_remove(bt, k, out);
             }
 
             /**
@@ -371,8 +880,8 @@ namespace hicc::btree {
              * @param idx 
              * @return the last key of the leaf
              */
-            elem_ptr _predecessor(int idx) {
-                node_ptr cur = _pointers[idx];
+            slot_type const &_predecessor(int idx) const {
+                const_node_ptr cur = _pointers[idx];
                 while (!cur->is_leaf())
                     cur = cur->_pointers[cur->_count];
                 return cur->_payloads[cur->_count - 1];
@@ -383,8 +892,8 @@ namespace hicc::btree {
              * @param idx 
              * @return the first key of the leaf
              */
-            elem_ptr _successor(int idx) {
-                node_ptr cur = _pointers[idx + 1];
+            slot_type const &_successor(int idx) const {
+                const_node_ptr cur = _pointers[idx + 1];
                 while (!cur->is_leaf())
                     cur = cur->_pointers[0];
                 return cur->_payloads[0];
@@ -395,47 +904,34 @@ namespace hicc::btree {
              * an element from parent node (this node) too.
              * @param idx an index in this node (parent node).
              */
-            void _merge(int idx) {
-                const int max_payloads = _degree - 1;
+            void _merge(btree &bt, int idx) {
+                const int max_payloads = degree() - 1;
                 const int min_payloads = max_payloads / 2;
-                const int _M = _degree / 2;
+                const int _M = degree() / 2;
                 assert(_M == min_payloads + 1);
-                UNUSED(min_payloads, max_payloads);
+                UNUSED(_M, min_payloads, max_payloads);
 
                 node_ptr child = _pointers[idx];
                 node_ptr sibling = _pointers[idx + 1];
-                dbg_debug("    _merge(%d) for node [%s] and sibling [%s]", idx, child->to_string().c_str(), sibling->to_string().c_str());
-
-                assert(child->_count == _M - 1);
-                child->_payloads[_M - 1] = _payloads[idx];
-
-                for (int i = 0; i < sibling->_count; ++i) child->_payloads[i + _M] = sibling->_payloads[i];
-                if (!child->is_leaf())
-                    for (int i = 0; i <= sibling->_count; ++i) child->_pointers[i + _M] = sibling->_pointers[i];
+                btree_debug("    _merge(%d) for node [%s] and sibling [%s]", idx, child->to_string().c_str(), sibling->to_string().c_str());
 
-                for (int i = idx + 1; i < _count; ++i) _payloads[i - 1] = _payloads[i];
-                for (int i = idx + 2; i <= _count; ++i) _pointers[i - 1] = _pointers[i];
-                _pointers[_count] = nullptr;
-                _payloads[_count - 1] = nullptr;
-
-                child->_count += sibling->_count + 1;
-                _count--;
-
-                delete sibling->reset_for_delete();
+                child->_subtree_count += sibling->_subtree_count + 1;
+                detail::node_moves::merge(this, idx);
+                bt._destroy_node(sibling->reset_for_delete());
             }
 
             /**
              * @brief to fill Children[idx] which has less than _M-1 keys.
              * @param idx 
              */
-            void _fill(int idx) {
-                const int max_payloads = _degree - 1;
+            void _fill(btree &bt, int idx) {
+                const int max_payloads = degree() - 1;
                 const int min_payloads = max_payloads / 2;
-                const int _M = _degree / 2;
+                const int _M = degree() / 2;
                 assert(_M == min_payloads + 1);
                 UNUSED(min_payloads, max_payloads);
 
-                dbg_debug("    _fill(%d) for node [%s]", idx, to_string().c_str());
+                btree_debug("    _fill(%d) for node [%s]", idx, to_string().c_str());
 
                 if (idx != 0 && _pointers[idx - 1]->_count >= _M)
                     _rotate_from_left(idx);
@@ -443,9 +939,9 @@ namespace hicc::btree {
                     _rotate_from_right(idx);
                 else {
                     if (idx != _count)
-                        _merge(idx);
+                        _merge(bt, idx);
                     else
-                        _merge(idx - 1);
+                        _merge(bt, idx - 1);
                 }
             }
 
@@ -457,28 +953,14 @@ namespace hicc::btree {
             void _rotate_from_left(int idx) {
                 node_ptr child = _pointers[idx];
                 node_ptr sibling = _pointers[idx - 1];
-                dbg_debug("    _rotate_from_left(%d) for node [%s] and sibling [%s]", idx, child->to_string().c_str(), sibling->to_string().c_str());
-
-                for (int i = child->_count - 1; i >= 0; --i)
-                    child->_payloads[i + 1] = child->_payloads[i];
-
-                if (!child->is_leaf()) {
-                    for (int i = child->_count; i >= 0; --i)
-                        child->_pointers[i + 1] = child->_pointers[i];
-                }
-
-                child->_payloads[0] = _payloads[idx - 1];
-
-                if (!child->is_leaf()) {
-                    child->_pointers[0] = sibling->_pointers[sibling->_count];
-                    sibling->_pointers[sibling->_count] = nullptr;
-                }
+                btree_debug("    _rotate_from_left(%d) for node [%s] and sibling [%s]", idx, child->to_string().c_str(), sibling->to_string().c_str());
 
-                _payloads[idx - 1] = sibling->_payloads[sibling->_count - 1];
-                sibling->_payloads[sibling->_count - 1] = nullptr;
-
-                child->_count++;
-                sibling->_count--;
+                size_type moved = 1;
+                if (!child->is_leaf())
+                    moved += sibling->_pointers[sibling->_count]->_subtree_count;
+                detail::node_moves::rotate_from_left(this, idx);
+                child->_subtree_count += moved;
+                sibling->_subtree_count -= moved;
             }
 
             /**
@@ -489,69 +971,97 @@ namespace hicc::btree {
             void _rotate_from_right(int idx) {
                 node_ptr child = _pointers[idx];
                 node_ptr sibling = _pointers[idx + 1];
-                dbg_debug("    _rotate_from_right(%d) for node [%s] and sibling [%s]", idx, child->to_string().c_str(), sibling->to_string().c_str());
-
-                child->_payloads[(child->_count)] = _payloads[idx];
+                btree_debug("    _rotate_from_right(%d) for node [%s] and sibling [%s]", idx, child->to_string().c_str(), sibling->to_string().c_str());
 
+                size_type moved = 1;
                 if (!child->is_leaf())
-                    child->_pointers[(child->_count) + 1] = sibling->_pointers[0];
+                    moved += sibling->_pointers[0]->_subtree_count;
+                detail::node_moves::rotate_from_right(this, idx);
+                child->_subtree_count += moved;
+                sibling->_subtree_count -= moved;
+            }
 
-                _payloads[idx] = sibling->_payloads[0];
+            int first_of_insertion_position(const_elem_ref el) const { return lower_position(el); }
 
-                for (int i = 1; i < sibling->_count; ++i)
-                    sibling->_payloads[i - 1] = sibling->_payloads[i];
-                sibling->_payloads[sibling->_count - 1] = nullptr;
-                if (!sibling->is_leaf()) {
-                    for (int i = 1; i <= sibling->_count; ++i)
-                        sibling->_pointers[i - 1] = sibling->_pointers[i];
-                    sibling->_pointers[sibling->_count] = nullptr;
+        public:
+            static constexpr bool packed_search = storage::inline_keys && detail::is_packed_key<T, Comp>::value;
+
+            // the first position whose key is not less than el
+            int lower_position(const_elem_ref el) const {
+                if constexpr (packed_search) {
+                    return detail::packed_lower_bound(keys_data(), _count, el);
+                } else {
+                    int lo = 0, hi = _count;
+                    while (lo < hi) {
+                        int mid = (lo + hi) / 2;
+                        if (is_less_than(key(mid), el))
+                            lo = mid + 1;
+                        else
+                            hi = mid;
+                    }
+                    return lo;
                 }
+            }
 
-                child->_count++;
-                sibling->_count--;
+            // the first position whose key is greater than el
+            int upper_position(const_elem_ref el) const {
+                if constexpr (packed_search) {
+                    return detail::packed_upper_bound(keys_data(), _count, el);
+                } else {
+                    int lo = 0, hi = _count;
+                    while (lo < hi) {
+                        int mid = (lo + hi) / 2;
+                        if (is_less_than(el, key(mid)))
+                            hi = mid;
+                        else
+                            lo = mid + 1;
+                    }
+                    return lo;
+                }
             }
 
-            int first_of_insertion_position(const_elem_ptr el) const {
-                int idx = 0;
-                while (idx < _count && is_less_than(_payloads[idx], el))
-                    ++idx;
-                return idx;
+        private:
+            slot_type const *keys_data() const {
+                if constexpr (Degree != dynamic_degree)
+                    return _payloads.data();
+                else
+                    return _payloads;
             }
 
         public:
             bool is_leaf() const { return _pointers[0] == nullptr; }
 
+            // unchecked access to the index-th key, index must be lower than payload_count()
+            const_elem_ref key(int index) const { return storage::ref(_payloads[index]); }
+            elem_ref key(int index) { return storage::ref(_payloads[index]); }
+
             const_elem_ref get_el(int index = 0) const { return *const_cast<node_ptr>(this)->get_el_ptr(index); }
             elem_ref get_el(int index = 0) { return *get_el_ptr(index); }
             elem_ptr get_el_ptr(int index = 0) {
-                return (index < 0 || index > _degree - 1) ? &_null_elem()
-                                                          : (_payloads[index] ? (_payloads[index]) : &_null_elem());
+                return (index < 0 || index >= _count) ? &_null_elem() : &key(index);
             }
             const_elem_ptr get_el_ptr(int index = 0) const { return const_cast<node_ptr>(this)->get_el_ptr(index); }
 
-            void set_el(int index, elem_ptr a) { _payloads[index] = a; }
+            void set_el(int index, slot_type a) { _payloads[index] = std::move(a); }
 
-            const_node_ptr child(int i) const { return (i >= 0 && i <= _degree) ? _pointers[i] : nullptr; }
-            node_ptr child(int i) { return (i >= 0 && i <= _degree) ? _pointers[i] : nullptr; }
+            const_node_ptr child(int i) const { return (i >= 0 && i < degree()) ? _pointers[i] : nullptr; }
+            node_ptr child(int i) { return (i >= 0 && i < degree()) ? _pointers[i] : nullptr; }
 
-            bool can_get_el(int index) const {
-                if (index < 0 || index > _degree - 1) return false;
-                return _payloads[index] != nullptr;
-            }
+            bool can_get_el(int index) const { return index >= 0 && index < _count; }
             bool can_get_child(int index) const {
-                if (index < 0 || index > _degree) return false;
+                if (index < 0 || index >= degree()) return false;
                 return _pointers[index] != nullptr;
             }
 
             elem_type const &operator[](int index) const {
-                if (index >= 0 && index < _degree - 1)
-                    return _payloads[index] ? *_payloads[index] : _null_elem();
+                if (index >= 0 && index < _count)
+                    return key(index);
                 return _null_elem();
             }
 
             elem_type &operator[](int index) {
-                if (index >= 0 && index < _degree - 1)
-                    return _payloads[index] ? *_payloads[index] : _null_elem();
+                if (index >= 0 && index < _count)
+                    return key(index);
                 return _null_elem();
             }
 
@@ -563,15 +1073,15 @@ namespace hicc::btree {
                 if (rhs._degree == 0 && _degree == 0) return true;
                 if (rhs._degree == 0 || _degree == 0) return false;
 
-                for (int k = 0; k < _degree - 1; ++k) {
-                    if (_payloads[k] != rhs._payloads[k])
+                if (_count != rhs._count) return false;
+                for (int k = 0; k < _count; ++k) {
+                    if (!storage::same(_payloads[k], rhs._payloads[k]))
                         return false;
                 }
-                for (int k = 0; k < _degree; ++k) {
+                for (int k = 0; k <= _count; ++k) {
                     if (_pointers[k] != rhs._pointers[k])
                         return false;
                 }
-                if (_count != rhs._count) return false;
                 return true;
             }
 
@@ -647,8 +1157,8 @@ namespace hicc::btree {
              * @return whether the key is exist in this tree
              */
             bool exists(elem_type const &data) const {
-                int idx = first_of_insertion_position(&data);
-                if (idx < _count && is_equal_to(_payloads[idx], &data))
+                int idx = first_of_insertion_position(data);
+                if (idx < _count && is_equal_to(key(idx), data))
                     return true;
                 if (node_ptr p = _pointers[idx]; p)
                     return p->exists(data);
@@ -684,10 +1194,8 @@ namespace hicc::btree {
              * @return position object ( a tuple of [ok,node_ref,idx] ) of the search result.
              */
             position find(elem_type const &data) const {
-                int index{};
-                while (index < _degree - 1 && _payloads[index] && comparer()(*(_payloads[index]), data))
-                    index++;
-                if (index < _degree - 1 && _payloads[index] && !comparer()(data, *(_payloads[index])))
+                int index = lower_position(data);
+                if (index < _count && !comparer()(data, key(index)))
                     return {true, *this, index};
                 if (_pointers[index] == nullptr) // is leaf?
                     return {false, _null_node(), -1};
@@ -701,23 +1209,46 @@ namespace hicc::btree {
              * @return position object ( a tuple of [ok,node_ref,idx] ) of the search result.
              */
             position find_by_index(int index) const {
-                node const *res{};
-                int saved{index};
-                walk([&res, &index, saved](traversal_context const &ctx) -> bool {
-                    if (index == ctx.abs_index) {
-                        dbg_verbose_debug("find_by_index(%d) -> node(%s) index(%d)",
-                                           saved, ctx.curr.to_string().c_str(), ctx.index);
-                        res = &ctx.curr;
-                        index = ctx.index;
-                        return false;
+                if (index < 0 || size_type(index) >= _subtree_count)
+                    return {false, _null_node(), -1};
+                // descend by the sub-tree counts, O(degree * height)
+                const_node_ptr cur = this;
+                auto rest = size_type(index);
+                for (;;) {
+                    for (int i = 0; i <= cur->_count; i++) {
+                        if (const_node_ptr c = cur->_pointers[i]; c) {
+                            if (rest < c->_subtree_count) {
+                                cur = c;
+                                break;
+                            }
+                            rest -= c->_subtree_count;
+                        }
+                        if (i < cur->_count && rest-- == 0) {
+                            btree_trace("find_by_index(%d) -> node(%s) index(%d)", index, cur->to_string().c_str(), i);
+                            return {true, *cur, i};
+                        }
                     }
-                    // UNUSED(saved, el, node_this, level, node_changed, parent_ptr_index, parent_ptr_changed, ptr_index);
-                    // UNUSED(saved, el, level);
-                    return true; // false to terminate the walking
-                });
-                if (res)
-                    return {true, *res, index};
-                return {false, _null_node(), -1};
+                }
+            }
+
+            /**
+             * @brief the rank of a key, i.e. the count of keys lower than it.
+             * @param data 
+             * @return the absolute index of data if it exists, or the index
+             * it would be inserted at.
+             */
+            size_type rank(elem_type const &data) const {
+                size_type r{};
+                for (const_node_ptr cur = this; cur;) {
+                    int pos = cur->lower_position(data);
+                    r += size_type(pos);
+                    if (cur->is_leaf())
+                        break;
+                    for (int i = 0; i < pos; i++)
+                        r += cur->_pointers[i]->_subtree_count;
+                    cur = cur->_pointers[pos];
+                }
+                return r;
             }
 
             /**
@@ -744,19 +1275,18 @@ namespace hicc::btree {
                 bool parent_ptr_changed{loop_base == 0};
                 bool node_changed{true};
                 int count{0};
-                for (int i = 0, pi = 0; i < _degree - 1; i++, pi++) {
+                for (int i = 0; i <= _count; i++) {
                     auto *n = _pointers[i];
                     if (n) {
-                        if (auto &z = n->LNR(visitor, abs_index, level + 1, pi, count); is_null(z))
+                        if (auto &z = n->LNR(visitor, abs_index, level + 1, i, count); is_null(z))
                             return z;
                         count += n->payload_count() + 1;
                     }
 
-                    auto *t = _payloads[pi];
-                    if (t) {
+                    if (i < _count) {
                         if (!visitor(traversal_context{
                                     *this,
-                                    t,
+                                    &key(i),
                                     level,              // level(),
                                     i,                  // index
                                     loop_base,          // loop_base_tmp,
@@ -770,15 +1300,7 @@ namespace hicc::btree {
                         abs_index++;
                         node_changed = false;
                         parent_ptr_changed = false;
-                    } else
-                        break;
-                }
-
-                auto *n = _pointers[_degree - 1];
-                if (n) {
-                    if (auto &z = n->LNR(visitor, abs_index, level + 1, _degree - 1, count); is_null(z))
-                        return z;
-                    count += n->payload_count() + 1;
+                    }
                 }
                 return (*this);
             }
@@ -809,7 +1331,7 @@ namespace hicc::btree {
                     abs_index = ctx.abs_index;
                 }
 
-                for (int pi = 0; pi < _degree; pi++) {
+                for (int pi = 0; pi < degree(); pi++) {
                     auto *n = _pointers[pi];
                     if (n) {
                         assert(n->_parent == this);
@@ -834,7 +1356,7 @@ namespace hicc::btree {
                 }
 
                 int count{0};
-                for (int pi = 0; pi < _degree; pi++) {
+                for (int pi = 0; pi < degree(); pi++) {
                     auto *n = _pointers[pi];
                     if (n) {
                         if (auto &z = n->NLR(visitor, abs_index, level + 1, pi, count); is_null(z)) {
@@ -872,7 +1394,7 @@ namespace hicc::btree {
                             return (*this);
 
                         auto loop_base_tmp = pos.loop_base;
-                        for (auto i = 0; i < _degree; i++) {
+                        for (auto i = 0; i < degree(); i++) {
                             if (auto *p = pos.curr._pointers[i]; p) {
                                 queue.push_back({
                                         *p,
@@ -910,7 +1432,7 @@ namespace hicc::btree {
                             return (*this);
 
                         auto loop_base_tmp = ctx.loop_base;
-                        for (auto i = 0; i < _degree; i++) {
+                        for (auto i = 0; i < degree(); i++) {
                             if (auto p = ctx.curr->_pointers[i]; p) {
                                 queue.push_back({
                                         *p,
@@ -936,17 +1458,13 @@ namespace hicc::btree {
 
             static bool _visit_payloads(const_node_ref ref, traversal_context &ctx, visitor_l const &visitor) {
                 bool node_changed{true};
-                for (int pi = 0; pi < ref._degree - 1; pi++) {
-                    auto *t = ref._payloads[pi];
-                    if (t) {
-                        ctx.node_changed = node_changed;
-                        ctx.el = t;
-                        if (!visitor(ctx))
-                            return false;
-                        node_changed = false;
-                        ctx.abs_index++;
-                    } else
-                        break;
+                for (int pi = 0; pi < ref._count; pi++) {
+                    ctx.node_changed = node_changed;
+                    ctx.el = &ref.key(pi);
+                    if (!visitor(ctx))
+                        return false;
+                    node_changed = false;
+                    ctx.abs_index++;
                 }
                 return true;
             }
@@ -985,19 +1503,21 @@ namespace hicc::btree {
             }
 
             void assert_it(btree &bt, int level = 0) {
-                const int max_payloads = _degree - 1;
+                const int max_payloads = degree() - 1;
                 const int min_payloads = max_payloads / 2;
-                const int _M = _degree / 2;
+                const int _M = degree() / 2;
                 assert(_M == min_payloads + 1);
                 UNUSED(_M, min_payloads, max_payloads);
 
-                for (int t = 0; t < _count; t++)
-                    if (auto *p = _payloads[t]; !p)
-                        assertm(_payloads[t] != nullptr, "the payloads lower than _count must be valid pointers to the elem_type.");
-                for (int t = _count; t < max_payloads; t++)
-                    if (auto *p = _payloads[t]; p)
-                        assertm(_payloads[t] == nullptr, "the payloads larger than _count must be nullptr.");
-                for (int t = _count + 1; t < _degree; t++)
+                if constexpr (!storage::inline_keys) {
+                    for (int t = 0; t < _count; t++)
+                        if (auto *p = _payloads[t]; !p)
+                            assertm(_payloads[t] != nullptr, "the payloads lower than _count must be valid pointers to the elem_type.");
+                    for (int t = _count; t < max_payloads; t++)
+                        if (auto *p = _payloads[t]; p)
+                            assertm(_payloads[t] == nullptr, "the payloads larger than _count must be nullptr.");
+                }
+                for (int t = _count + 1; t < degree(); t++)
                     if (auto *p = _pointers[t]; p)
                         assertm(_pointers[t] == nullptr, "the payloads larger than _count must be nullptr.");
 
@@ -1024,6 +1544,14 @@ namespace hicc::btree {
                     assertm(_count <= max_payloads, "_count should be lower than max_payloads.");
                 }
 
+                size_type sub{size_type(_count)};
+                for (int t = 0; t <= _count; t++)
+                    if (auto *p = _pointers[t]; p)
+                        sub += p->_subtree_count;
+                assertm(sub == _subtree_count, "_subtree_count should be the keys in the sub-tree.");
+                assertm(this != bt._root || _subtree_count == bt._size, "the root's _subtree_count should be the tree size.");
+                UNUSED(sub);
+
                 for (int t = 0; t <= max_payloads; t++)
                     if (auto *p = _pointers[t]; p)
                         p->assert_it(bt, level + 1);
@@ -1051,11 +1579,8 @@ namespace hicc::btree {
             std::string to_string() const {
                 std::ostringstream os;
                 for (int i = 0; i < _count; i++) {
-                    if (elem_ptr p = _payloads[i]; p) {
-                        if (i > 0) os << ',';
-                        os << elem_to_string(p);
-                    } else
-                        break;
+                    if (i > 0) os << ',';
+                    os << key(i);
                 }
                 return os.str();
             }
@@ -1100,112 +1625,336 @@ namespace hicc::btree {
          * @brief the main function to insert a new key in this tree
          * @param a 
          */
-        void insert(elem_type &&a) { _insert(new elem_type(a)); }
-        void insert(const_elem_ref el) { _insert(new elem_type(el)); }
+        void insert(elem_type &&a) { _insert(storage::make(_alloc, std::move(a))); }
+        void insert(const_elem_ref el) { _insert(storage::make(_alloc, el)); }
         // void insert(elem_type el) { _insert(new elem_type(el)); }
 
         template<typename... Args>
-        void insert(Args &&...args) { (_insert(new elem_type(args)), ...); }
+        void insert(Args &&...args) { (_insert(storage::make(_alloc, std::forward<Args>(args))), ...); }
         template<typename... Args>
-        void insert(Args const &...args) { (_insert(new elem_type(args)), ...); }
-        void insert(elem_ptr a_new_data_ptr) { _insert(a_new_data_ptr); }
+        void insert(Args const &...args) { (_insert(storage::make(_alloc, args)), ...); }
+        void insert(elem_ptr a_new_data_ptr) { _insert(storage::adopt(_alloc, a_new_data_ptr)); }
 
     private:
-        void _insert(elem_ptr el) {
-            auto el_str = node::elem_to_string(el);
-            dbg_debug("insert '%s' ...", el_str.c_str());
+        void _insert(slot_type el) {
+#if HICC_TEST_BTREE_DBGOUT
+            auto el_str = node::elem_to_string(storage::ref(el));
+            btree_debug("insert '%s' ...", el_str.c_str());
+#endif
             if (_root == nullptr) {
-                _root = new node(_degree);
-                _root->set_el(0, el);
+                _root = _create_node();
+                _root->set_el(0, std::move(el));
                 _root->_count = 1;
-                DEBUG_ONLY(_dbg_after_inserted(el_str));
+                _root->_subtree_count = 1;
+                _size = 1;
+#if HICC_TEST_BTREE_DBGOUT
+                _dbg_after_inserted(el_str);
+#endif
                 return;
             }
 
             const int max_payloads = _degree - 1;
             if (_root->_count == max_payloads) {
-                node_ptr np = new node(_degree);
+                node_ptr np = _create_node();
                 np->_pointers[0] = _root;
-                np->_split_child(0, _root);
+                np->_subtree_count = _root->_subtree_count + 1;
+                np->_split_child(*this, 0, _root);
                 int i = 0;
-                if (node::is_less_than(np->_payloads[0], el)) i++;
-                np->_pointers[i]->insert_non_full(el);
+                if (node::is_less_than(np->key(0), storage::ref(el))) i++;
+                np->_pointers[i]->insert_non_full(*this, std::move(el));
                 _root = np;
-                DEBUG_ONLY(_dbg_after_inserted(el_str));
+                _size++;
+#if HICC_TEST_BTREE_DBGOUT
+                _dbg_after_inserted(el_str);
+#endif
                 return;
             }
 
-            _root->insert_non_full(el);
-            DEBUG_ONLY(_dbg_after_inserted(el_str));
+            _root->insert_non_full(*this, std::move(el));
+            _size++;
+#if HICC_TEST_BTREE_DBGOUT
+            _dbg_after_inserted(el_str);
+#endif
         }
-#if defined(_DEBUG)
+#if HICC_TEST_BTREE_DBGOUT
         void _dbg_after_inserted(std::string const &el_str) {
             std::ostringstream os;
             os << "after '" << el_str << "' inserted .";
-            DEBUG_ONLY(dbg_dump(std::cout, os.str().c_str()));
-            DEBUG_ONLY(assert_it());
+            dbg_dump(std::cout, os.str().c_str());
+            assert_it();
         }
 #endif
 
+    public:
+        /**
+         * @brief rebuilds the tree from the keys in [first, last), in O(n).
+         * @details The leaves are packed left to right, then every internal
+         * level is built over the separators of the level below, so nothing
+         * is ever split or rotated. Unsorted input is copied and sorted first.
+         * The old content is cleared.
+         * @param first forward iterator
+         * @param last 
+         * @param fill_factor the fraction of a node's keys to be used, it is
+         * clamped to [0.5, 1]. 1.0 gives the smallest and shallowest tree,
+         * lower values leave room for later inserts before any split.
+         */
+        template<class It>
+        void bulk_load(It first, It last, double fill_factor = 1.0) {
+            if (!std::is_sorted(first, last, node::comparer())) {
+                std::vector<elem_type> sorted(first, last);
+                std::sort(sorted.begin(), sorted.end(), node::comparer());
+                bulk_load(sorted.begin(), sorted.end(), fill_factor);
+                return;
+            }
+
+            clear();
+            const auto n = size_type(std::distance(first, last));
+            if (n == 0) return;
+
+            const int per = _bulk_keys_per_node(fill_factor);
+            const size_type m = _bulk_node_count(n, per);
+            std::vector<node_ptr> level;
+            std::vector<slot_type> seps;
+            level.reserve(m);
+            seps.reserve(m - 1);
+            for (size_type i = 0; i < m; i++) {
+                node_ptr p = _create_node();
+                const int k = _bulk_keys_of(n, m, i);
+                for (int j = 0; j < k; j++, ++first) p->_payloads[j] = storage::make(_alloc, *first);
+                p->_count = k;
+                p->_subtree_count = size_type(k);
+                level.push_back(p);
+                if (i + 1 < m) {
+                    seps.push_back(storage::make(_alloc, *first));
+                    ++first;
+                }
+            }
+            _bulk_build_up(level, seps, per);
+            _size = n;
+        }
+
+        /**
+         * @brief bulk_load() with the leaves filled on a thread pool.
+         * @details The nodes are allocated in the calling thread, only the
+         * copying of keys into the leaves is spread over \a pool through
+         * parallel_for(). Keys allocated by a stateful allocator are not
+         * assumed to be thread-safe, such trees are loaded serially.
+         * @param pool hicc::pool::thread_pool, hz-pool.hh should be included
+         * @param first random-access iterator
+         * @param last 
+         * @param fill_factor see bulk_load(first, last, fill_factor)
+         */
+        template<class Pool, class It>
+        void bulk_load(Pool &pool, It first, It last, double fill_factor = 1.0) {
+            static_assert(std::is_base_of<std::random_access_iterator_tag,
+                                          typename std::iterator_traits<It>::iterator_category>::value,
+                          "parallel bulk_load needs random-access iterators");
+            if constexpr (!storage::inline_keys && !std::allocator_traits<Alloc>::is_always_equal::value) {
+                UNUSED(pool);
+                bulk_load(first, last, fill_factor);
+            } else {
+                if (!std::is_sorted(first, last, node::comparer())) {
+                    std::vector<elem_type> sorted(first, last);
+                    std::sort(sorted.begin(), sorted.end(), node::comparer());
+                    bulk_load(pool, sorted.begin(), sorted.end(), fill_factor);
+                    return;
+                }
+
+                clear();
+                const auto n = size_type(last - first);
+                if (n == 0) return;
+
+                const int per = _bulk_keys_per_node(fill_factor);
+                const size_type m = _bulk_node_count(n, per);
+                std::vector<node_ptr> level(m);
+                std::vector<slot_type> seps;
+                seps.reserve(m - 1);
+                for (auto &p : level) p = _create_node();
+
+                // leaf i starts after i separators and the keys of leaves [0, i)
+                const size_type base = (n - (m - 1)) / m, extra = (n - (m - 1)) % m;
+                auto offset = [base, extra](size_type i) { return i * (base + 1) + std::min(i, extra); };
+                parallel_for(pool, size_type(0), m, 64, [&](size_type i) {
+                    node_ptr p = level[i];
+                    const int k = _bulk_keys_of(n, m, i);
+                    auto src = first + typename std::iterator_traits<It>::difference_type(offset(i));
+                    for (int j = 0; j < k; j++, ++src) p->_payloads[j] = storage::make(_alloc, *src);
+                    p->_count = k;
+                    p->_subtree_count = size_type(k);
+                });
+                for (size_type i = 0; i + 1 < m; i++)
+                    seps.push_back(storage::make(_alloc, first[typename std::iterator_traits<It>::difference_type(offset(i + 1) - 1)]));
+                _bulk_build_up(level, seps, per);
+                _size = n;
+            }
+        }
+
+    private:
+        int _bulk_keys_per_node(double fill_factor) const {
+            const int max_payloads = _degree - 1;
+            const int min_payloads = max_payloads / 2;
+            const int per = int(fill_factor * max_payloads + 0.5);
+            return std::clamp(per, min_payloads, max_payloads);
+        }
+        // how many nodes hold n keys (and the separators between them) with
+        // about per keys in each one, but never less than min_payloads.
+        size_type _bulk_node_count(size_type n, int per) const {
+            const int max_payloads = _degree - 1;
+            const int min_payloads = max_payloads / 2;
+            UNUSED(max_payloads);
+            const size_type wanted = (n + size_type(per) + 1) / size_type(per + 1);
+            const size_type most = (n + 1) / size_type(min_payloads + 1);
+            return std::max<size_type>(std::min(wanted, most), 1);
+        }
+        // the keys of the i-th of m nodes are spread evenly, the first ones
+        // get one more.
+        static int _bulk_keys_of(size_type n, size_type m, size_type i) {
+            const size_type keys = n - (m - 1);
+            return int(keys / m + (i < keys % m ? 1 : 0));
+        }
+        // builds the internal levels over the nodes of a level and the
+        // separators between them, until a single root is left.
+        void _bulk_build_up(std::vector<node_ptr> &level, std::vector<slot_type> &seps, int per) {
+            while (level.size() > 1) {
+                const size_type n = seps.size();
+                const size_type m = _bulk_node_count(n, per);
+                std::vector<node_ptr> up;
+                std::vector<slot_type> up_seps;
+                up.reserve(m);
+                up_seps.reserve(m - 1);
+                size_type ki = 0, ci = 0;
+                for (size_type i = 0; i < m; i++) {
+                    node_ptr p = _create_node();
+                    const int k = _bulk_keys_of(n, m, i);
+                    size_type count = size_type(k);
+                    for (int j = 0; j < k; j++) p->_payloads[j] = std::move(seps[ki++]);
+                    for (int j = 0; j <= k; j++) {
+                        p->_pointers[j] = level[ci++];
+                        count += p->_pointers[j]->_subtree_count;
+                    }
+                    p->_count = k;
+                    p->_subtree_count = count;
+                    up.push_back(p);
+                    if (i + 1 < m) up_seps.push_back(std::move(seps[ki++]));
+                }
+                level.swap(up);
+                seps.swap(up_seps);
+            }
+            _root = level.front();
+        }
+
     public:
         /**
          * @brief the main function to remove a given key within this tree
          * @param a 
          */
-        void remove(elem_type &&a) { _remove(&a); }
+        void remove(elem_type &&a) { _remove(a); }
         void remove(const_elem_ref el) { _remove(el); }
-        void remove(elem_ptr el) { _remove(el); }
+        void remove(elem_ptr el) { _remove(*el); }
 
         template<typename... Args>
-        void remove(Args &&...args) { (_remove(&args), ...); }
+        void remove(Args &&...args) { (_remove(args), ...); }
         template<typename... Args>
-        void remove(Args const &...args) { (_remove(&args), ...); }
+        void remove(Args const &...args) { (_remove(args), ...); }
 
     private:
         void _remove(const_elem_ref el) {
+#if HICC_TEST_BTREE_DBGOUT
             auto el_str = node::elem_to_string(el);
-            dbg_debug("remove '%s' ...", el_str.c_str());
-            if (_root == nullptr)
-                return;
-            elem_ptr removed = _root->remove(el);
-            _check_root_is_empty(el_str);
-            if (removed)
-                delete removed;
-        }
-        void _remove(const_elem_ptr el) {
-            auto el_str = node::elem_to_string(el);
-            dbg_debug("remove '%s' ...", el_str.c_str());
+            btree_debug("remove '%s' ...", el_str.c_str());
+#endif
             if (_root == nullptr)
                 return;
-            elem_ptr removed = _root->remove(el);
-            _check_root_is_empty(el_str);
-            if (removed)
-                delete removed;
+            slot_type removed{};
+            bool ok = _root->remove(*this, el, removed);
+            _check_root_is_empty();
+            if (ok) {
+                storage::release(_alloc, removed);
+                _size--;
+            }
+#if HICC_TEST_BTREE_DBGOUT
+            std::ostringstream os;
+            os << "after '" << el_str << "' removed .";
+            dbg_dump(std::cout, os.str().c_str());
+            assert_it();
+#endif
         }
-        void _check_root_is_empty(const std::string &el_str) {
+        void _check_root_is_empty() {
             if (_root->_count == 0) {
                 node_ptr tmp = _root;
                 if (_root->is_leaf())
                     _root = nullptr;
                 else
                     _root = _root->_pointers[0];
-                delete tmp->reset_for_delete();
+                _destroy_node(tmp->reset_for_delete());
             }
+        }
 
-#if defined(_DEBUG)
-            std::ostringstream os;
-            os << "after '" << el_str << "' removed .";
-            DEBUG_ONLY(dbg_dump(std::cout, os.str().c_str()));
-            DEBUG_ONLY(assert_it());
-#else
-            UNUSED(el_str);
-#endif
+        /**
+         * @brief allocates an empty node in one cache-line aligned block.
+         * @return the new node, release it by _destroy_node()
+         */
+        node_ptr _create_node() {
+            static_assert(alignof(node) <= alignof(block_type) && alignof(slot_type) <= alignof(block_type),
+                          "over-aligned keys are not supported");
+            auto *mem = reinterpret_cast<char *>(_nodes.allocate());
+            if constexpr (Degree == dynamic_degree) {
+                auto *keys = reinterpret_cast<slot_type *>(mem + node::keys_offset());
+                auto *pointers = reinterpret_cast<node_ptr *>(mem + node::pointers_offset(_degree));
+                for (int i = 0; i < _degree - 1; i++) new (keys + i) slot_type{};
+                return new (mem) node(_degree, keys, pointers);
+            } else {
+                return new (mem) node(_degree);
+            }
+        }
+        // releases the node itself, its keys and children must have been moved out
+        void _destroy_node(node_ptr p) {
+            _destruct_node(p);
+            _nodes.deallocate(reinterpret_cast<block_type *>(p));
+        }
+        void _destruct_node(node_ptr p) {
+            if constexpr (Degree == dynamic_degree) {
+                slot_type *keys = p->_payloads;
+                p->~node();
+                for (int i = 0; i < _degree - 1; i++) keys[i].~slot_type();
+            } else {
+                p->~node();
+            }
+        }
+        void _destroy_subtree(node_ptr p) {
+            for (int i = 0; i <= p->_count; i++)
+                if (auto *c = p->_pointers[i]; c) _destroy_subtree(c);
+            for (int i = 0; i < p->_count; i++)
+                storage::release(_alloc, p->_payloads[i]);
+            _destroy_node(p);
         }
+        // releases the keys and runs ~node() without freeing the nodes
+        void _release_subtree_keys(node_ptr p) {
+            for (int i = 0; i <= p->_count; i++)
+                if (auto *c = p->_pointers[i]; c) _release_subtree_keys(c);
+            for (int i = 0; i < p->_count; i++)
+                storage::release(_alloc, p->_payloads[i]);
+            _destruct_node(p);
+        }
+        std::size_t _node_blocks() const { return (node::bytes(_degree) + sizeof(block_type) - 1) / sizeof(block_type); }
 
     public:
+        /**
+         * @brief removes all keys. With slab_nodes the node slabs are freed
+         * at once, the tree is walked only if the keys need releasing.
+         */
         void clear() {
-            if (_root)
-                delete _root;
+            if (_root) {
+                if constexpr (node_pool::releases_all) {
+                    if constexpr (!storage::inline_keys || !std::is_trivially_destructible<T>::value)
+                        _release_subtree_keys(_root);
+                    _nodes.release_all();
+                } else {
+                    _destroy_subtree(_root);
+                }
+                _root = nullptr;
+                _size = 0;
+            }
         }
 
         void dbg_dump(std::ostream &os = std::cout, const char *headline = nullptr) const {
@@ -1223,7 +1972,8 @@ namespace hicc::btree {
                 return _root->total_from_calculating();
             return 0;
         }
-        size_type size() const { return total_count(); }
+        size_type size() const { return _size; }
+        bool empty() const { return _size == 0; }
 
         bool exists(const_elem_ref data) const {
             if (_root)
@@ -1237,11 +1987,26 @@ namespace hicc::btree {
                 return _root->find(data);
             return {false, node::_null_node(), -1};
         }
+        /**
+         * @brief select the index-th key in order, in O(log n).
+         * @param index 
+         * @return position object ( a tuple of [ok,node_ref,idx] ) of the search result.
+         */
         position find_by_index(int index) const {
             if (_root)
                 return _root->find_by_index(index);
             return {false, node::_null_node(), -1};
         }
+        /**
+         * @brief the count of keys lower than data, in O(log n).
+         * @param data 
+         * @return 
+         */
+        size_type rank(elem_type const &data) const {
+            if (_root)
+                return _root->rank(data);
+            return 0;
+        }
         const_node_ref find(std::function<bool(const_elem_ptr, const_node_ptr, int /*level*/, bool /*node_changed*/,
                                                int /*index*/, int /*abs_index*/)> const &matcher) const {
             if (_root)
@@ -1293,14 +2058,184 @@ namespace hicc::btree {
             return node::_null_node();
         }
 
+    public:
+        // the height bound of a tree holding less than 2^64 keys, every
+        // non-root node has Degree/2 children at least.
+        static constexpr int max_height = Degree == dynamic_degree ? 65 : 2 + 64 / detail::floor_log2(Degree / 2);
+
+        /**
+         * @brief bidirectional iterator over the keys in order.
+         * @details The path from the root is kept in a fixed array inside
+         * the iterator, so iterating never allocates. Keys can't be
+         * modified through it, iterator and const_iterator are the same.
+         * Any insert or remove invalidates all iterators.
+         */
+        class const_iterator {
+        public:
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = elem_type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const_elem_ptr;
+            using reference = const_elem_ref;
+
+            const_iterator() = default;
+
+            reference operator*() const { return _top().ptr->key(_top().idx); }
+            pointer operator->() const { return &_top().ptr->key(_top().idx); }
+
+            const_iterator &operator++() {
+                auto &f = _top();
+                if (!f.ptr->is_leaf()) {
+                    // the next one is the leftmost key of the right child
+                    f.idx++;
+                    _push_leftmost(f.ptr->_pointers[f.idx]);
+                    return *this;
+                }
+                if (++f.idx < f.ptr->_count)
+                    return *this;
+                _pop_to_next();
+                return *this;
+            }
+            const_iterator operator++(int) {
+                const_iterator tmp = *this;
+                ++(*this);
+                return tmp;
+            }
+            const_iterator &operator--() {
+                if (_depth == 0) {
+                    // --end() is the last key
+                    if (_tree && _tree->_root)
+                        _push_rightmost(_tree->_root);
+                    return *this;
+                }
+                auto &f = _top();
+                if (!f.ptr->is_leaf()) {
+                    // the previous one is the rightmost key of the left child
+                    _push_rightmost(f.ptr->_pointers[f.idx]);
+                    return *this;
+                }
+                if (f.idx > 0) {
+                    f.idx--;
+                    return *this;
+                }
+                while (--_depth > 0) {
+                    if (auto &a = _top(); a.idx > 0) {
+                        a.idx--;
+                        return *this;
+                    }
+                }
+                return *this; // out of the range, it's end() now
+            }
+            const_iterator operator--(int) {
+                const_iterator tmp = *this;
+                --(*this);
+                return tmp;
+            }
+
+            bool operator==(const_iterator const &o) const {
+                if (_depth == 0 || o._depth == 0) return _depth == o._depth;
+                return _top().ptr == o._top().ptr && _top().idx == o._top().idx;
+            }
+            bool operator!=(const_iterator const &o) const { return !(*this == o); }
+
+        private:
+            friend class btree;
+            // the top frame holds the current key index, the frames below
+            // it hold the child index taken from each ancestor.
+            struct frame {
+                const_node_ptr ptr;
+                int idx;
+            };
+
+            explicit const_iterator(btree const *tree)
+                : _tree(tree) {}
+
+            frame &_top() { return _path[std::size_t(_depth - 1)]; }
+            frame const &_top() const { return _path[std::size_t(_depth - 1)]; }
+            void _push(const_node_ptr p, int idx) {
+                assert(_depth < max_height);
+                _path[std::size_t(_depth++)] = frame{p, idx};
+            }
+            void _push_leftmost(const_node_ptr p) {
+                for (; !p->is_leaf(); p = p->_pointers[0])
+                    _push(p, 0);
+                _push(p, 0);
+            }
+            void _push_rightmost(const_node_ptr p) {
+                for (; !p->is_leaf(); p = p->_pointers[p->_count])
+                    _push(p, p->_count);
+                _push(p, p->_count - 1);
+            }
+            // climbs up to the first ancestor which has a key after the
+            // child we came from; becomes end() if there is none.
+            void _pop_to_next() {
+                while (--_depth > 0) {
+                    if (_top().idx < _top().ptr->_count)
+                        return;
+                }
+            }
+
+            std::array<frame, max_height> _path;
+            int _depth{0};
+            btree const *_tree{nullptr};
+        };
+        using iterator = const_iterator;
+        using reverse_iterator = std::reverse_iterator<const_iterator>;
+        using const_reverse_iterator = reverse_iterator;
+
+        const_iterator begin() const {
+            const_iterator it{this};
+            if (_root && _root->_count > 0)
+                it._push_leftmost(_root);
+            return it;
+        }
+        const_iterator end() const { return const_iterator{this}; }
+        const_iterator cbegin() const { return begin(); }
+        const_iterator cend() const { return end(); }
+        reverse_iterator rbegin() const { return reverse_iterator{end()}; }
+        reverse_iterator rend() const { return reverse_iterator{begin()}; }
+
+        /**
+         * @brief the first key which is not less than data.
+         * @param data 
+         * @return the iterator to it, or end()
+         */
+        const_iterator lower_bound(elem_type const &data) const {
+            return _bound(data, [](const_node_ptr p, elem_type const &d) { return p->lower_position(d); });
+        }
+        /**
+         * @brief the first key which is greater than data.
+         * @param data 
+         * @return the iterator to it, or end()
+         */
+        const_iterator upper_bound(elem_type const &data) const {
+            return _bound(data, [](const_node_ptr p, elem_type const &d) { return p->upper_position(d); });
+        }
+        std::pair<const_iterator, const_iterator> equal_range(elem_type const &data) const {
+            return {lower_bound(data), upper_bound(data)};
+        }
+
+    private:
+        template<class Position>
+        const_iterator _bound(elem_type const &data, Position const &position_of) const {
+            const_iterator it{this};
+            if (_root == nullptr)
+                return it;
+            for (const_node_ptr p = _root;; p = p->_pointers[it._top().idx]) {
+                it._push(p, position_of(p, data));
+                if (p->is_leaf())
+                    break;
+            }
+            if (it._top().idx == it._top().ptr->_count)
+                it._pop_to_next();
+            return it;
+        }
+
+    public:
         std::vector<elem_type> to_vector() const {
             std::vector<elem_type> vec;
             vec.reserve(size());
-            typename decltype(vec)::iterator it{vec.begin()};
-            walk([&vec, &it](traversal_context const &ctx) -> bool {
-                vec.insert(it++, *ctx.el);
-                return true;
-            });
+            vec.assign(begin(), end());
             return vec;
         }
 
@@ -1314,14 +2249,1338 @@ namespace hicc::btree {
             return os;
         }
 
+    private:
+        btree(int degree, Alloc const &alloc, int)
+            : _degree(degree)
+            , _size(0)
+            , _root(nullptr)
+            , _alloc(alloc)
+            , _nodes(block_allocator(alloc), _node_blocks()) {}
+        static int _checked_degree(int degree) {
+            if (degree < 4 || degree % 2 != 0)
+                throw std::invalid_argument("btree: the degree should be an even number not less than 4");
+            return degree;
+        }
+
     private:
         int _degree;
-        int _size;
+        size_type _size;
         node_ptr _root;
+        Alloc _alloc;
+        node_pool _nodes;
 
     }; // btree<T>
 
 
+    namespace detail {
+        // hints the cpu to fetch the cache line at p in advance
+        inline void prefetch(void const *p) {
+#if defined(__GNUC__) || defined(__clang__)
+            __builtin_prefetch(p);
+#else
+            UNUSED(p);
+#endif
+        }
+    } // namespace detail
+
+    /**
+     * @brief a B+ tree mapping K to V: all records live in the leaves,
+     * which are chained in key order, and the internal nodes hold the
+     * separator keys only.
+     * @details A range scan finds its first leaf in O(log n), then reads
+     * the leaves along the chain, prefetching the next one, instead of
+     * moving up and down the tree. The internal levels are split, merged
+     * and rotated by detail::node_moves as in btree; the leaves have
+     * their own moves, since no separator is pulled down into a leaf.
+     *
+     * The separator i of an internal node is a copy of the lowest key of
+     * Children[i+1] at the time it was made, so the keys of Children[i]
+     * are in [separator i-1, separator i). Removing a key never touches
+     * the separators above it.
+     *
+     * K and V must be default constructible and move assignable, like
+     * the keys of inline_storage. Keys are unique.
+     * @tparam K the key
+     * @tparam V the mapped value
+     * @tparam Degree the maximal children count of an internal node, a
+     *         leaf holds Degree-1 records at most
+     * @tparam Comp 
+     * @tparam Alloc allocator, it is rebound for the nodes
+     * @tparam Nodes node allocation policy, slab_nodes or heap_nodes
+     */
+    template<class K, class V, int Degree = hicc::cross::btree_degree<K>(), class Comp = std::less<K>,
+             class Alloc = std::allocator<std::pair<const K, V>>, class Nodes = slab_nodes>
+    class bplus_tree {
+        static_assert(Degree >= 4 && Degree % 2 == 0,
+                      "bplus_tree Degree should be an even number not less than 4");
+
+    public:
+        using key_type = K;
+        using mapped_type = V;
+        using size_type = std::size_t;
+        using allocator_type = Alloc;
+        using block_type = hicc::cross::cacheline_align_t;
+        using block_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<block_type>;
+        using node_pool = typename Nodes::template pool<block_allocator>;
+
+        explicit bplus_tree(Alloc const &alloc = Alloc())
+            : _leaves(block_allocator(alloc), _blocks_of(sizeof(leaf)))
+            , _inners(block_allocator(alloc), _blocks_of(sizeof(inner))) {}
+        virtual ~bplus_tree() { clear(); }
+        CLAZZ_NON_COPYABLE(bplus_tree);
+
+    private:
+        static constexpr int max_keys = Degree - 1;
+        static constexpr int min_keys = max_keys / 2;
+        static constexpr int _M = Degree / 2;
+
+        struct node_base {
+            int _count{};
+            bool _leaf;
+            explicit node_base(bool is_leaf)
+                : _leaf(is_leaf) {}
+        };
+        struct leaf : node_base {
+            std::array<K, max_keys> _payloads{};
+            std::array<V, max_keys> _values{};
+            leaf *_prev{};
+            leaf *_next{};
+            leaf()
+                : node_base(true) {}
+        };
+        struct inner : node_base {
+            std::array<K, max_keys> _payloads{};
+            std::array<node_base *, Degree> _pointers{};
+            inner()
+                : node_base(false) {}
+
+            // for detail::node_moves
+            static constexpr int degree() { return Degree; }
+            static constexpr bool is_leaf() { return false; }
+            static void reset_key(K &k) { UNUSED(k); }
+        };
+
+    public:
+        /**
+         * @brief bidirectional iterator over the records in key order.
+         * @details It dereferences to a pair of references, the key can't
+         * be modified. Any insert or erase invalidates all iterators.
+         */
+        template<bool Const>
+        class basic_iterator {
+            using leaf_ptr = std::conditional_t<Const, leaf const *, leaf *>;
+
+        public:
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = std::pair<K, V>;
+            using difference_type = std::ptrdiff_t;
+            using mapped_ref = std::conditional_t<Const, V const &, V &>;
+            using reference = std::pair<K const &, mapped_ref>;
+            using pointer = void;
+
+            basic_iterator() = default;
+            template<bool C = Const, std::enable_if_t<C, int> = 0>
+            basic_iterator(basic_iterator<false> const &o)
+                : _leaf(o._leaf)
+                , _idx(o._idx)
+                , _tree(o._tree) {}
+
+            K const &key() const { return _leaf->_payloads[_idx]; }
+            mapped_ref value() const { return _leaf->_values[_idx]; }
+            reference operator*() const { return {key(), value()}; }
+
+            basic_iterator &operator++() {
+                if (++_idx == _leaf->_count) {
+                    _leaf = _leaf->_next;
+                    _idx = 0;
+                    if (_leaf && _leaf->_next) detail::prefetch(_leaf->_next);
+                }
+                return *this;
+            }
+            basic_iterator operator++(int) {
+                basic_iterator tmp{*this};
+                ++*this;
+                return tmp;
+            }
+            basic_iterator &operator--() {
+                if (!_leaf) {
+                    _leaf = _tree->_tail;
+                    _idx = _leaf->_count - 1;
+                } else if (_idx == 0) {
+                    _leaf = _leaf->_prev;
+                    _idx = _leaf->_count - 1;
+                } else {
+                    --_idx;
+                }
+                return *this;
+            }
+            basic_iterator operator--(int) {
+                basic_iterator tmp{*this};
+                --*this;
+                return tmp;
+            }
+
+            bool operator==(basic_iterator const &o) const { return _leaf == o._leaf && _idx == o._idx; }
+            bool operator!=(basic_iterator const &o) const { return !(*this == o); }
+
+        private:
+            friend class bplus_tree;
+            template<bool>
+            friend class basic_iterator;
+            basic_iterator(leaf_ptr l, int idx, bplus_tree const *tree)
+                : _leaf(l)
+                , _idx(idx)
+                , _tree(tree) {}
+
+            leaf_ptr _leaf{};
+            int _idx{};
+            bplus_tree const *_tree{};
+        };
+        using iterator = basic_iterator<false>;
+        using const_iterator = basic_iterator<true>;
+
+        iterator begin() { return {_head, 0, this}; }
+        iterator end() { return {nullptr, 0, this}; }
+        const_iterator begin() const { return {_head, 0, this}; }
+        const_iterator end() const { return {nullptr, 0, this}; }
+        const_iterator cbegin() const { return begin(); }
+        const_iterator cend() const { return end(); }
+
+        // the first record whose key is not less than key
+        iterator lower_bound(K const &key) { return _mutable(_bound(key, false)); }
+        const_iterator lower_bound(K const &key) const { return _bound(key, false); }
+        // the first record whose key is greater than key
+        iterator upper_bound(K const &key) { return _mutable(_bound(key, true)); }
+        const_iterator upper_bound(K const &key) const { return _bound(key, true); }
+
+        iterator find(K const &key) { return _mutable(static_cast<bplus_tree const *>(this)->find(key)); }
+        const_iterator find(K const &key) const {
+            auto it = _bound(key, false);
+            if (it != end() && !comparer()(key, it.key())) return it;
+            return end();
+        }
+        bool contains(K const &key) const { return find(key) != end(); }
+
+        size_type size() const { return _size; }
+        bool empty() const { return _size == 0; }
+        // the levels count, a tree with a single leaf has height 1
+        int height() const { return _height; }
+
+        /**
+         * @brief calls fn(key, value) for each record whose key is in
+         * [lo, hi), in key order.
+         * @details The leaves are read along the chain with the next one
+         * prefetched, and the keys of a leaf lying in the range entirely
+         * are not compared with hi.
+         * @return the count of records visited
+         */
+        template<class Fn>
+        size_type scan(K const &lo, K const &hi, Fn &&fn) const {
+            auto it = _bound(lo, false);
+            size_type n = 0;
+            int i = it._idx;
+            for (leaf const *l = it._leaf; l; l = l->_next, i = 0) {
+                if (l->_next) {
+                    detail::prefetch(l->_next);
+                    detail::prefetch(&l->_next->_values);
+                }
+                const int count = l->_count;
+                if (!comparer()(l->_payloads[count - 1], hi)) {
+                    for (; i < count && comparer()(l->_payloads[i], hi); i++, n++) fn(l->_payloads[i], l->_values[i]);
+                    break;
+                }
+                n += size_type(count - i);
+                for (; i < count; i++) fn(l->_payloads[i], l->_values[i]);
+            }
+            return n;
+        }
+
+    public:
+        /**
+         * @brief inserts the record if key is not present yet.
+         * @return false if key exists, its value is kept
+         */
+        bool insert(K const &key, V value) { return _insert(key, std::move(value), false); }
+        /**
+         * @brief inserts the record, or overwrites the value of an existing key.
+         * @return true if key was inserted
+         */
+        bool insert_or_assign(K const &key, V value) { return _insert(key, std::move(value), true); }
+
+        /**
+         * @brief removes the record of key.
+         * @details As btree, a child is filled before going down to it, so
+         * the removal never walks back up.
+         * @return false if key is not present
+         */
+        bool erase(K const &key) {
+            if (!_root) return false;
+            node_base *p = _root;
+            while (!p->_leaf) {
+                auto *in = static_cast<inner *>(p);
+                int idx = _upper(in, key);
+                if (in->_pointers[idx]->_count <= min_keys) {
+                    _fill(in, idx);
+                    if (in == _root && in->_count == 0) {
+                        _root = in->_pointers[0];
+                        _destroy(in);
+                        _height--;
+                        p = _root;
+                        continue;
+                    }
+                    idx = _upper(in, key);
+                }
+                p = in->_pointers[idx];
+            }
+
+            auto *l = static_cast<leaf *>(p);
+            const int pos = _lower(l, key);
+            if (pos == l->_count || comparer()(key, l->_payloads[pos]))
+                return false;
+            for (int i = pos + 1; i < l->_count; i++) {
+                l->_payloads[i - 1] = std::move(l->_payloads[i]);
+                l->_values[i - 1] = std::move(l->_values[i]);
+            }
+            l->_count--;
+            _size--;
+            if (l->_count == 0) {
+                // only a root leaf can be emptied
+                assert(l == _root);
+                _destroy(l);
+                _root = nullptr;
+                _head = _tail = nullptr;
+                _height = 0;
+            }
+            return true;
+        }
+
+        void clear() {
+            if (!_root) return;
+            if constexpr (!node_pool::releases_all || !std::is_trivially_destructible<K>::value ||
+                          !std::is_trivially_destructible<V>::value)
+                _destroy_subtree(_root);
+            _leaves.release_all();
+            _inners.release_all();
+            _root = nullptr;
+            _head = _tail = nullptr;
+            _size = 0;
+            _height = 0;
+        }
+
+        /**
+         * @brief verifies the node sizes, the key order against the
+         * separators, the leaf depth and the leaf chain.
+         */
+        void assert_it() const {
+            if (!_root) {
+                assertm(_size == 0 && !_head && !_tail && _height == 0, "an empty tree has no leaves");
+                return;
+            }
+            size_type records = 0;
+            leaf const *prev = nullptr;
+            _assert_node(_root, 1, nullptr, nullptr, prev, records);
+            assertm(prev == _tail, "the last leaf of the chain should be _tail");
+            assertm(records == _size, "the records in leaves should be size()");
+            UNUSED(prev, records);
+        }
+
+    private:
+        void _assert_node(node_base const *p, int depth, K const *lo, K const *hi, leaf const *&prev, size_type &records) const {
+            assertm(p == _root || p->_count >= min_keys, "_count should be larger than min_keys.");
+            assertm(p->_count <= max_keys, "_count should be lower than max_keys.");
+            K const *keys = p->_leaf ? static_cast<leaf const *>(p)->_payloads.data() : static_cast<inner const *>(p)->_payloads.data();
+            for (int i = 0; i < p->_count; i++) {
+                assertm(i == 0 || comparer()(keys[i - 1], keys[i]), "keys should be ascending.");
+                assertm(!lo || !comparer()(keys[i], *lo), "a key should not be lower than the separator on its left.");
+                assertm(!hi || comparer()(keys[i], *hi), "a key should be lower than the separator on its right.");
+                UNUSED(keys, lo, hi);
+            }
+            if (p->_leaf) {
+                auto const *l = static_cast<leaf const *>(p);
+                assertm(depth == _height, "all leaves should be at the same depth.");
+                assertm(l->_prev == prev && (prev ? prev->_next : _head) == l, "leaves should be chained in order.");
+                prev = l;
+                records += size_type(l->_count);
+                UNUSED(depth);
+                return;
+            }
+            auto const *in = static_cast<inner const *>(p);
+            for (int i = 0; i <= in->_count; i++)
+                _assert_node(in->_pointers[i], depth + 1, i == 0 ? lo : &keys[i - 1], i == in->_count ? hi : &keys[i], prev, records);
+        }
+
+        static Comp &comparer() {
+            static Comp _c{};
+            return _c;
+        }
+        static constexpr bool packed_search = detail::is_packed_key<K, Comp>::value;
+        // the first position whose key is not less than key
+        template<class N>
+        static int _lower(N const *p, K const &key) {
+            if constexpr (packed_search)
+                return detail::packed_lower_bound(p->_payloads.data(), p->_count, key);
+            else
+                return int(std::lower_bound(p->_payloads.data(), p->_payloads.data() + p->_count, key, comparer()) - p->_payloads.data());
+        }
+        // the first position whose key is greater than key, which is the
+        // child to go down for key in an internal node
+        template<class N>
+        static int _upper(N const *p, K const &key) {
+            if constexpr (packed_search)
+                return detail::packed_upper_bound(p->_payloads.data(), p->_count, key);
+            else
+                return int(std::upper_bound(p->_payloads.data(), p->_payloads.data() + p->_count, key, comparer()) - p->_payloads.data());
+        }
+
+        const_iterator _bound(K const &key, bool upper) const {
+            if (!_root) return end();
+            node_base const *p = _root;
+            while (!p->_leaf) {
+                auto const *in = static_cast<inner const *>(p);
+                p = in->_pointers[_upper(in, key)];
+            }
+            auto const *l = static_cast<leaf const *>(p);
+            const int pos = upper ? _upper(l, key) : _lower(l, key);
+            if (pos == l->_count) return {l->_next, 0, this};
+            return {l, pos, this};
+        }
+        iterator _mutable(const_iterator it) { return {const_cast<leaf *>(it._leaf), it._idx, this}; }
+
+        bool _insert(K const &key, V &&value, bool assign) {
+            if (!_root) {
+                _root = _head = _tail = _create_leaf();
+                _height = 1;
+            }
+            if (_root->_count == max_keys) {
+                inner *r = _create_inner();
+                r->_pointers[0] = _root;
+                _split_child(r, 0);
+                _root = r;
+                _height++;
+            }
+
+            node_base *p = _root;
+            while (!p->_leaf) {
+                auto *in = static_cast<inner *>(p);
+                int idx = _upper(in, key);
+                if (in->_pointers[idx]->_count == max_keys) {
+                    _split_child(in, idx);
+                    if (!comparer()(key, in->_payloads[idx])) idx++;
+                }
+                p = in->_pointers[idx];
+            }
+
+            auto *l = static_cast<leaf *>(p);
+            const int pos = _lower(l, key);
+            if (pos < l->_count && !comparer()(key, l->_payloads[pos])) {
+                if (assign) l->_values[pos] = std::move(value);
+                return false;
+            }
+            for (int i = l->_count; i > pos; i--) {
+                l->_payloads[i] = std::move(l->_payloads[i - 1]);
+                l->_values[i] = std::move(l->_values[i - 1]);
+            }
+            l->_payloads[pos] = key;
+            l->_values[pos] = std::move(value);
+            l->_count++;
+            _size++;
+            return true;
+        }
+
+        // splits the full Children[idx]. A leaf keeps _M records and the
+        // separator is a copy of the first key of the new right leaf.
+        void _split_child(inner *parent, int idx) {
+            node_base *y = parent->_pointers[idx];
+            if (!y->_leaf) {
+                detail::node_moves::split_child(parent, idx, _create_inner());
+                return;
+            }
+            auto *l = static_cast<leaf *>(y);
+            leaf *z = _create_leaf();
+            for (int j = 0; j < min_keys; j++) {
+                z->_payloads[j] = std::move(l->_payloads[j + _M]);
+                z->_values[j] = std::move(l->_values[j + _M]);
+            }
+            z->_count = min_keys;
+            l->_count = _M;
+            _link_after(l, z);
+            detail::node_moves::insert_child(parent, idx, K(z->_payloads[0]), z);
+        }
+
+        // makes Children[idx], which has min_keys keys, one key larger.
+        void _fill(inner *parent, int idx) {
+            const bool to_leaf = parent->_pointers[idx]->_leaf;
+            if (idx != 0 && parent->_pointers[idx - 1]->_count > min_keys) {
+                if (to_leaf)
+                    _borrow_from_left(parent, idx);
+                else
+                    detail::node_moves::rotate_from_left(parent, idx);
+            } else if (idx != parent->_count && parent->_pointers[idx + 1]->_count > min_keys) {
+                if (to_leaf)
+                    _borrow_from_right(parent, idx);
+                else
+                    detail::node_moves::rotate_from_right(parent, idx);
+            } else {
+                if (idx == parent->_count) idx--;
+                if (to_leaf)
+                    _merge_leaves(parent, idx);
+                else
+                    _destroy(detail::node_moves::merge(parent, idx));
+            }
+        }
+
+        // moves the last record of the left leaf to Children[idx]
+        void _borrow_from_left(inner *parent, int idx) {
+            auto *child = static_cast<leaf *>(parent->_pointers[idx]);
+            auto *sibling = static_cast<leaf *>(parent->_pointers[idx - 1]);
+            for (int i = child->_count; i > 0; i--) {
+                child->_payloads[i] = std::move(child->_payloads[i - 1]);
+                child->_values[i] = std::move(child->_values[i - 1]);
+            }
+            child->_payloads[0] = std::move(sibling->_payloads[sibling->_count - 1]);
+            child->_values[0] = std::move(sibling->_values[sibling->_count - 1]);
+            child->_count++;
+            sibling->_count--;
+            parent->_payloads[idx - 1] = child->_payloads[0];
+        }
+
+        // moves the first record of the right leaf to Children[idx]
+        void _borrow_from_right(inner *parent, int idx) {
+            auto *child = static_cast<leaf *>(parent->_pointers[idx]);
+            auto *sibling = static_cast<leaf *>(parent->_pointers[idx + 1]);
+            child->_payloads[child->_count] = std::move(sibling->_payloads[0]);
+            child->_values[child->_count] = std::move(sibling->_values[0]);
+            child->_count++;
+            for (int i = 1; i < sibling->_count; i++) {
+                sibling->_payloads[i - 1] = std::move(sibling->_payloads[i]);
+                sibling->_values[i - 1] = std::move(sibling->_values[i]);
+            }
+            sibling->_count--;
+            parent->_payloads[idx] = sibling->_payloads[0];
+        }
+
+        // appends the leaf Children[idx+1] to Children[idx] and drops the
+        // separator between them.
+        void _merge_leaves(inner *parent, int idx) {
+            auto *child = static_cast<leaf *>(parent->_pointers[idx]);
+            auto *sibling = static_cast<leaf *>(parent->_pointers[idx + 1]);
+            for (int i = 0; i < sibling->_count; i++) {
+                child->_payloads[child->_count + i] = std::move(sibling->_payloads[i]);
+                child->_values[child->_count + i] = std::move(sibling->_values[i]);
+            }
+            child->_count += sibling->_count;
+            _unlink(sibling);
+            detail::node_moves::erase_child(parent, idx);
+            _destroy(sibling);
+        }
+
+        void _link_after(leaf *l, leaf *z) {
+            z->_prev = l;
+            z->_next = l->_next;
+            (l->_next ? l->_next->_prev : _tail) = z;
+            l->_next = z;
+        }
+        void _unlink(leaf *l) {
+            (l->_prev ? l->_prev->_next : _head) = l->_next;
+            (l->_next ? l->_next->_prev : _tail) = l->_prev;
+        }
+
+        static std::size_t _blocks_of(std::size_t bytes) { return (bytes + sizeof(block_type) - 1) / sizeof(block_type); }
+        leaf *_create_leaf() {
+            static_assert(alignof(leaf) <= alignof(block_type) && alignof(inner) <= alignof(block_type),
+                          "over-aligned keys or values are not supported");
+            return new (_leaves.allocate()) leaf();
+        }
+        inner *_create_inner() { return new (_inners.allocate()) inner(); }
+        void _destroy(node_base *p) {
+            if (p->_leaf) {
+                auto *l = static_cast<leaf *>(p);
+                l->~leaf();
+                _leaves.deallocate(reinterpret_cast<block_type *>(l));
+            } else {
+                auto *in = static_cast<inner *>(p);
+                in->~inner();
+                _inners.deallocate(reinterpret_cast<block_type *>(in));
+            }
+        }
+        void _destroy_subtree(node_base *p) {
+            if (!p->_leaf) {
+                auto *in = static_cast<inner *>(p);
+                for (int i = 0; i <= in->_count; i++) _destroy_subtree(in->_pointers[i]);
+            }
+            _destroy(p);
+        }
+
+    private:
+        node_base *_root{};
+        leaf *_head{};
+        leaf *_tail{};
+        size_type _size{};
+        int _height{};
+        node_pool _leaves;
+        node_pool _inners;
+
+    }; // bplus_tree<K, V>
+
+
+    namespace detail {
+        /**
+         * @brief the per-node version latch of optimistic lock coupling.
+         * @details A reader takes the version by read_begin(), reads the
+         * node without writing anything, then validate()s the version; a
+         * mismatch means a writer got in between and the reader restarts.
+         * A writer upgrades the version it read into the exclusive latch,
+         * and unlock() bumps the version. Bit 1 is the lock bit, so an
+         * unlocked version is a multiple of 4.
+         */
+        class version_latch {
+        public:
+            // waits out the current writer, returns the version to validate later
+            std::uint64_t read_begin() const {
+                std::uint64_t v = _v.load(std::memory_order_acquire);
+                while (v & locked) {
+                    hicc::cross::cpu_relax();
+                    v = _v.load(std::memory_order_acquire);
+                }
+                return v;
+            }
+            // true if nothing was written since read_begin() returned v
+            bool validate(std::uint64_t v) const {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return _v.load(std::memory_order_relaxed) == v;
+            }
+            // takes the write latch if the version is still v
+            bool try_upgrade(std::uint64_t v) {
+                if (!_v.compare_exchange_strong(v, v + locked, std::memory_order_acquire, std::memory_order_relaxed))
+                    return false;
+                std::atomic_thread_fence(std::memory_order_release);
+                return true;
+            }
+            void unlock() { _v.fetch_add(locked, std::memory_order_release); }
+
+        private:
+            static constexpr std::uint64_t locked = 2;
+            std::atomic<std::uint64_t> _v{0};
+        };
+    } // namespace detail
+
+    /**
+     * @brief a B-tree of unique keys for many threads, synchronized by
+     * optimistic lock coupling.
+     * @details Every node has a version_latch. Lookups go down the tree
+     * without writing shared memory: each child's version is taken before
+     * its parent's is validated again, and any mismatch restarts from the
+     * root. A writer latches only the leaf it changes, or the node it
+     * splits together with the parent of it. Full nodes are split on the
+     * way down, so a split never goes back up.
+     *
+     * As in bplus_tree, the keys live in the leaves and the internal
+     * nodes hold separators. Removing keys never merges nodes: a node an
+     * optimistic reader may still be reading can't be freed without an
+     * epoch scheme, so the nodes are freed only by clear() and the
+     * destructor, which must not run concurrently with anything else.
+     * Neither may to_vector() and assert_it().
+     *
+     * Readers may see a key being written, so T must be trivially
+     * copyable and comparing a torn value must be harmless; the result of
+     * such a read is dropped by the validation.
+     * @tparam T the key
+     * @tparam Degree the maximal children count of a node
+     * @tparam Comp 
+     */
+    template<class T, int Degree = hicc::cross::btree_degree<T>(), class Comp = std::less<T>>
+    class concurrent_btree {
+        static_assert(Degree >= 4 && Degree % 2 == 0,
+                      "concurrent_btree Degree should be an even number not less than 4");
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "concurrent_btree keys are read optimistically, they should be trivially copyable");
+
+    public:
+        using elem_type = T;
+        using size_type = std::size_t;
+
+        concurrent_btree()
+            : _root(new leaf) {}
+        virtual ~concurrent_btree() { _destroy_subtree(_root.load(std::memory_order_relaxed)); }
+        CLAZZ_NON_COPYABLE(concurrent_btree);
+
+        /**
+         * @brief inserts key if it is not present.
+         * @return false if key exists already
+         */
+        bool insert(T const &key) {
+            bool inserted{};
+            while (!_try_insert(key, inserted)) {}
+            return inserted;
+        }
+        /**
+         * @brief removes key.
+         * @return false if key is not present
+         */
+        bool remove(T const &key) {
+            bool removed{};
+            while (!_try_remove(key, removed)) {}
+            return removed;
+        }
+        bool exists(T const &key) const {
+            bool found{};
+            while (!_try_find(key, found)) {}
+            return found;
+        }
+
+        // the count of keys, it is a snapshot while writers are running
+        size_type size() const { return _size.load(std::memory_order_relaxed); }
+        bool empty() const { return size() == 0; }
+
+        // not thread-safe
+        void clear() {
+            _destroy_subtree(_root.load(std::memory_order_relaxed));
+            _root.store(new leaf, std::memory_order_release);
+            _size.store(0, std::memory_order_relaxed);
+        }
+        // all keys in order, not thread-safe
+        std::vector<T> to_vector() const {
+            std::vector<T> vec;
+            vec.reserve(size());
+            _collect(_root.load(std::memory_order_acquire), vec);
+            return vec;
+        }
+        // verifies the key order against the separators and the leaf
+        // depth, not thread-safe
+        void assert_it() const {
+            int leaf_depth = -1;
+            _assert_node(_root.load(std::memory_order_acquire), 0, nullptr, nullptr, leaf_depth);
+        }
+
+    private:
+        static constexpr int max_keys = Degree - 1;
+        static constexpr int _M = Degree / 2;
+
+        struct alignas(hicc::cross::cacheline_align_v) node {
+            detail::version_latch _latch;
+            std::atomic<int> _count{0};
+            bool const _leaf;
+            explicit node(bool is_leaf)
+                : _leaf(is_leaf) {}
+
+            // the key count clamped into the array, a racing reader may
+            // see anything before it validates
+            int count() const { return std::min(_count.load(std::memory_order_relaxed), max_keys); }
+        };
+        struct leaf : node {
+            std::array<T, max_keys> _keys{};
+            leaf()
+                : node(true) {}
+        };
+        struct inner : node {
+            std::array<T, max_keys> _keys{};
+            std::array<std::atomic<node *>, Degree> _children{};
+            inner()
+                : node(false) {}
+        };
+
+        static Comp &comparer() {
+            static Comp _c{};
+            return _c;
+        }
+        static constexpr bool packed_search = detail::is_packed_key<T, Comp>::value;
+        // the first position whose key is not less than key
+        template<class N>
+        static int _lower(N const *p, int count, T const &key) {
+            if constexpr (packed_search)
+                return detail::packed_lower_bound(p->_keys.data(), count, key);
+            else
+                return int(std::lower_bound(p->_keys.data(), p->_keys.data() + count, key, comparer()) - p->_keys.data());
+        }
+        // the child to go down for key
+        static int _child_of(inner const *p, int count, T const &key) {
+            if constexpr (packed_search)
+                return detail::packed_upper_bound(p->_keys.data(), count, key);
+            else
+                return int(std::upper_bound(p->_keys.data(), p->_keys.data() + count, key, comparer()) - p->_keys.data());
+        }
+
+        // goes down to the leaf of key, false to restart. The version of
+        // the leaf is taken before its parent is validated the last time.
+        bool _descend(T const &key, node *&n, std::uint64_t &v) const {
+            n = _root.load(std::memory_order_acquire);
+            v = n->_latch.read_begin();
+            if (n != _root.load(std::memory_order_acquire)) return false;
+            while (!n->_leaf) {
+                auto *in = static_cast<inner *>(n);
+                node *c = in->_children[std::size_t(_child_of(in, in->count(), key))].load(std::memory_order_relaxed);
+                if (!c || !in->_latch.validate(v)) return false;
+                const std::uint64_t cv = c->_latch.read_begin();
+                if (!in->_latch.validate(v)) return false;
+                n = c;
+                v = cv;
+            }
+            return true;
+        }
+
+        bool _try_find(T const &key, bool &found) const {
+            node *n;
+            std::uint64_t v;
+            if (!_descend(key, n, v)) return false;
+            auto const *l = static_cast<leaf const *>(n);
+            const int count = l->count();
+            const int pos = _lower(l, count, key);
+            const bool hit = pos < count && !comparer()(key, l->_keys[std::size_t(pos)]);
+            if (!l->_latch.validate(v)) return false;
+            found = hit;
+            return true;
+        }
+
+        bool _try_remove(T const &key, bool &removed) {
+            node *n;
+            std::uint64_t v;
+            if (!_descend(key, n, v)) return false;
+            if (!n->_latch.try_upgrade(v)) return false;
+            auto *l = static_cast<leaf *>(n);
+            const int count = l->count();
+            const int pos = _lower(l, count, key);
+            removed = pos < count && !comparer()(key, l->_keys[std::size_t(pos)]);
+            if (removed) {
+                for (int i = pos + 1; i < count; i++) l->_keys[std::size_t(i - 1)] = l->_keys[std::size_t(i)];
+                l->_count.store(count - 1, std::memory_order_relaxed);
+                _size.fetch_sub(1, std::memory_order_relaxed);
+            }
+            l->_latch.unlock();
+            return true;
+        }
+
+        bool _try_insert(T const &key, bool &inserted) {
+            node *n = _root.load(std::memory_order_acquire);
+            std::uint64_t v = n->_latch.read_begin();
+            if (n != _root.load(std::memory_order_acquire)) return false;
+            inner *parent = nullptr;
+            std::uint64_t pv = 0;
+            int idx = 0; // n is parent->_children[idx]
+            while (!n->_leaf) {
+                auto *in = static_cast<inner *>(n);
+                if (in->_count.load(std::memory_order_relaxed) == max_keys) {
+                    _split(parent, pv, idx, n, v);
+                    return false;
+                }
+                const int i = _child_of(in, in->count(), key);
+                node *c = in->_children[std::size_t(i)].load(std::memory_order_relaxed);
+                if (!c || !in->_latch.validate(v)) return false;
+                const std::uint64_t cv = c->_latch.read_begin();
+                if (!in->_latch.validate(v)) return false;
+                parent = in;
+                pv = v;
+                idx = i;
+                n = c;
+                v = cv;
+            }
+
+            auto *l = static_cast<leaf *>(n);
+            if (l->_count.load(std::memory_order_relaxed) == max_keys) {
+                _split(parent, pv, idx, n, v);
+                return false;
+            }
+            if (!l->_latch.try_upgrade(v)) return false;
+            const int count = l->count();
+            const int pos = _lower(l, count, key);
+            inserted = !(pos < count && !comparer()(key, l->_keys[std::size_t(pos)]));
+            if (inserted) {
+                for (int i = count; i > pos; i--) l->_keys[std::size_t(i)] = l->_keys[std::size_t(i - 1)];
+                l->_keys[std::size_t(pos)] = key;
+                l->_count.store(count + 1, std::memory_order_relaxed);
+                _size.fetch_add(1, std::memory_order_relaxed);
+            }
+            l->_latch.unlock();
+            return true;
+        }
+
+        // splits the full node n, the idx-th child of parent (or the root),
+        // if both are still at the versions read. The caller restarts.
+        void _split(inner *parent, std::uint64_t pv, int idx, node *n, std::uint64_t v) {
+            if (parent && !parent->_latch.try_upgrade(pv)) return;
+            if (!n->_latch.try_upgrade(v)) {
+                if (parent) parent->_latch.unlock();
+                return;
+            }
+            if (!parent && n != _root.load(std::memory_order_relaxed)) {
+                n->_latch.unlock();
+                return;
+            }
+
+            T sep;
+            node *right;
+            if (n->_leaf) {
+                // the left one keeps _M keys, the separator is the first key on the right
+                auto *l = static_cast<leaf *>(n);
+                auto *z = new leaf;
+                for (int j = _M; j < max_keys; j++) z->_keys[std::size_t(j - _M)] = l->_keys[std::size_t(j)];
+                z->_count.store(max_keys - _M, std::memory_order_relaxed);
+                l->_count.store(_M, std::memory_order_relaxed);
+                sep = z->_keys[0];
+                right = z;
+            } else {
+                // the middle key goes up, as in btree
+                auto *in = static_cast<inner *>(n);
+                auto *z = new inner;
+                for (int j = _M; j < max_keys; j++) z->_keys[std::size_t(j - _M)] = in->_keys[std::size_t(j)];
+                for (int j = _M; j < Degree; j++) {
+                    z->_children[std::size_t(j - _M)].store(in->_children[std::size_t(j)].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                    in->_children[std::size_t(j)].store(nullptr, std::memory_order_relaxed);
+                }
+                z->_count.store(max_keys - _M, std::memory_order_relaxed);
+                in->_count.store(_M - 1, std::memory_order_relaxed);
+                sep = in->_keys[std::size_t(_M - 1)];
+                right = z;
+            }
+
+            if (parent) {
+                const int count = parent->count();
+                for (int j = count; j > idx; j--) {
+                    parent->_keys[std::size_t(j)] = parent->_keys[std::size_t(j - 1)];
+                    parent->_children[std::size_t(j + 1)].store(parent->_children[std::size_t(j)].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                }
+                parent->_keys[std::size_t(idx)] = sep;
+                parent->_children[std::size_t(idx + 1)].store(right, std::memory_order_relaxed);
+                parent->_count.store(count + 1, std::memory_order_relaxed);
+                parent->_latch.unlock();
+            } else {
+                auto *r = new inner;
+                r->_keys[0] = sep;
+                r->_children[0].store(n, std::memory_order_relaxed);
+                r->_children[1].store(right, std::memory_order_relaxed);
+                r->_count.store(1, std::memory_order_relaxed);
+                _root.store(r, std::memory_order_release);
+            }
+            n->_latch.unlock();
+        }
+
+        void _destroy_subtree(node *p) {
+            if (p->_leaf) {
+                delete static_cast<leaf *>(p);
+                return;
+            }
+            auto *in = static_cast<inner *>(p);
+            for (int i = 0; i <= in->count(); i++) _destroy_subtree(in->_children[std::size_t(i)].load(std::memory_order_relaxed));
+            delete in;
+        }
+        void _collect(node const *p, std::vector<T> &vec) const {
+            if (p->_leaf) {
+                auto const *l = static_cast<leaf const *>(p);
+                vec.insert(vec.end(), l->_keys.begin(), l->_keys.begin() + l->count());
+                return;
+            }
+            auto const *in = static_cast<inner const *>(p);
+            for (int i = 0; i <= in->count(); i++) _collect(in->_children[std::size_t(i)].load(std::memory_order_relaxed), vec);
+        }
+        void _assert_node(node const *p, int depth, T const *lo, T const *hi, int &leaf_depth) const {
+            T const *keys = p->_leaf ? static_cast<leaf const *>(p)->_keys.data() : static_cast<inner const *>(p)->_keys.data();
+            const int count = p->count();
+            assertm(p->_leaf || count > 0, "an internal node holds one key at least.");
+            for (int i = 0; i < count; i++) {
+                assertm(i == 0 || comparer()(keys[i - 1], keys[i]), "keys should be ascending.");
+                assertm(!lo || !comparer()(keys[i], *lo), "a key should not be lower than the separator on its left.");
+                assertm(!hi || comparer()(keys[i], *hi), "a key should be lower than the separator on its right.");
+                UNUSED(keys, lo, hi);
+            }
+            if (p->_leaf) {
+                if (leaf_depth < 0) leaf_depth = depth;
+                assertm(depth == leaf_depth, "all leaves should be at the same depth.");
+                return;
+            }
+            auto const *in = static_cast<inner const *>(p);
+            for (int i = 0; i <= count; i++)
+                _assert_node(in->_children[std::size_t(i)].load(std::memory_order_relaxed), depth + 1,
+                             i == 0 ? lo : &keys[i - 1], i == count ? hi : &keys[i], leaf_depth);
+        }
+
+    private:
+        std::atomic<node *> _root;
+        std::atomic<size_type> _size{0};
+
+    }; // concurrent_btree<T>
+
+
+    /**
+     * @brief a B-tree of unique keys with O(1) snapshots, by path copying.
+     * @details The nodes are reference counted by the nodes and the roots
+     * pointing at them, and a node shared by more than one of them is
+     * immutable. A writer going down the tree clones the shared nodes on
+     * its way (the clone takes a reference to every child), so an insert
+     * or a remove copies a root-to-leaf path at most, and only the first
+     * time after a snapshot; the nodes owned by the tree alone are
+     * modified in place.
+     *
+     * snapshot() takes a reference to the root and returns a read-only
+     * snapshot_t in O(1). Snapshots may be read, copied and dropped in any
+     * thread without any lock, they never see a later change and never
+     * block the writer. A node is freed by whoever drops its last
+     * reference, so an old version goes away with its last snapshot.
+     *
+     * The tree itself has a single writer: insert(), remove(), clear()
+     * and snapshot() must not run concurrently with each other.
+     * @tparam T the key, it is copied into the clones
+     * @tparam Degree the maximal children count of a node
+     * @tparam Comp 
+     */
+    template<class T, int Degree = hicc::cross::btree_degree<T>(), class Comp = std::less<T>>
+    class cow_btree {
+        static_assert(Degree >= 4 && Degree % 2 == 0,
+                      "cow_btree Degree should be an even number not less than 4");
+        static_assert(std::is_default_constructible<T>::value && std::is_copy_constructible<T>::value,
+                      "cow_btree keys should be default and copy constructible");
+
+        struct node;
+
+    public:
+        using elem_type = T;
+        using size_type = std::size_t;
+
+        /**
+         * @brief a read-only, point-in-time version of a cow_btree.
+         */
+        class snapshot_t {
+        public:
+            snapshot_t() = default;
+            snapshot_t(snapshot_t const &o)
+                : _root(o._root)
+                , _size(o._size)
+                , _height(o._height) { _acquire(_root); }
+            snapshot_t(snapshot_t &&o) noexcept
+                : _root(std::exchange(o._root, nullptr))
+                , _size(std::exchange(o._size, 0))
+                , _height(std::exchange(o._height, 0)) {}
+            snapshot_t &operator=(snapshot_t o) noexcept {
+                std::swap(_root, o._root);
+                std::swap(_size, o._size);
+                std::swap(_height, o._height);
+                return *this;
+            }
+            ~snapshot_t() { _release(_root); }
+
+            size_type size() const { return _size; }
+            bool empty() const { return _size == 0; }
+            int height() const { return _height; }
+            bool exists(T const &key) const { return _exists(_root, key); }
+            /**
+             * @brief in-order traverse, fn(key) returns false to stop.
+             * @return false if fn stopped it
+             */
+            template<class Fn>
+            bool walk(Fn &&fn) const { return !_root || _walk(_root, fn); }
+            std::vector<T> to_vector() const {
+                std::vector<T> vec;
+                vec.reserve(_size);
+                walk([&vec](T const &key) {
+                    vec.push_back(key);
+                    return true;
+                });
+                return vec;
+            }
+
+        private:
+            friend class cow_btree;
+            snapshot_t(node *root, size_type size, int height)
+                : _root(root)
+                , _size(size)
+                , _height(height) { _acquire(_root); }
+
+            node *_root{};
+            size_type _size{};
+            int _height{};
+        };
+
+        cow_btree() = default;
+        virtual ~cow_btree() { _release(_root); }
+        CLAZZ_NON_COPYABLE(cow_btree);
+
+        size_type size() const { return _size; }
+        bool empty() const { return _size == 0; }
+        int height() const { return _height; }
+        bool exists(T const &key) const { return _exists(_root, key); }
+        template<class Fn>
+        bool walk(Fn &&fn) const { return !_root || _walk(_root, fn); }
+        std::vector<T> to_vector() const { return snapshot().to_vector(); }
+
+        // the current version, in O(1)
+        snapshot_t snapshot() const { return snapshot_t(_root, _size, _height); }
+
+        /**
+         * @brief inserts key if it is not present.
+         * @return false if key exists already
+         */
+        bool insert(T const &key) {
+            if (exists(key)) return false;
+            if (!_root) {
+                _root = new node(true);
+                _root->_payloads[0] = key;
+                _root->_count = 1;
+                _height = 1;
+                _size = 1;
+                return true;
+            }
+            node *r = _unique(_root);
+            if (r->_count == max_keys) {
+                node *np = new node(false);
+                np->_pointers[0] = r;
+                _root = np;
+                _height++;
+                detail::node_moves::split_child(np, 0, new node(r->_leaf));
+                r = np;
+            }
+            _insert_non_full(r, key);
+            _size++;
+            return true;
+        }
+
+        /**
+         * @brief removes key.
+         * @return false if key is not present
+         */
+        bool remove(T const &key) {
+            if (!exists(key)) return false;
+            node *r = _unique(_root);
+            _remove(r, key);
+            if (r->_count == 0) {
+                // the child, if any, is handed over from r to the tree
+                _root = r->_leaf ? nullptr : r->_pointers[0];
+                _height--;
+                delete r;
+            }
+            _size--;
+            return true;
+        }
+
+        // drops the current version, the snapshots keep theirs
+        void clear() {
+            _release(_root);
+            _root = nullptr;
+            _size = 0;
+            _height = 0;
+        }
+
+        /**
+         * @brief verifies the node sizes, the key order against the
+         * separators, the leaf depth and the key count.
+         */
+        void assert_it() const {
+            if (!_root) {
+                assertm(_size == 0 && _height == 0, "an empty tree has no nodes");
+                return;
+            }
+            size_type keys = 0;
+            _assert_node(_root, 1, nullptr, nullptr, keys);
+            assertm(keys == _size, "the keys in nodes should be size()");
+            UNUSED(keys);
+        }
+
+    private:
+        static constexpr int max_keys = Degree - 1;
+        static constexpr int min_keys = max_keys / 2;
+        static constexpr int _M = Degree / 2;
+
+        struct alignas(hicc::cross::cacheline_align_v) node {
+            std::atomic<int> _refs{1};
+            int _count{0};
+            bool _leaf;
+            std::array<T, max_keys> _payloads{};
+            std::array<node *, Degree> _pointers{};
+            friend struct detail::node_moves;
+
+            explicit node(bool is_leaf)
+                : _leaf(is_leaf) {}
+            // a private copy of o, sharing the children of it
+            node(node const &o)
+                : _count(o._count)
+                , _leaf(o._leaf)
+                , _payloads(o._payloads)
+                , _pointers(o._pointers) {
+                if (!_leaf)
+                    for (int i = 0; i <= _count; i++) _acquire(_pointers[std::size_t(i)]);
+            }
+            node &operator=(node const &) = delete;
+
+            constexpr int degree() const { return Degree; }
+            bool is_leaf() const { return _leaf; }
+            static void reset_key(T &key) { key = T{}; }
+        };
+
+        static void _acquire(node *p) {
+            if (p) p->_refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        // drops a reference, the last one frees the node and drops the
+        // references it holds.
+        static void _release(node *p) {
+            if (!p || p->_refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+            if (!p->_leaf)
+                for (int i = 0; i <= p->_count; i++) _release(p->_pointers[std::size_t(i)]);
+            delete p;
+        }
+        /**
+         * @brief the node at ref made private to this version.
+         * @details A shared node is cloned and ref is pointed to the clone,
+         * so ref must live in a private node, or be the root.
+         */
+        static node *_unique(node *&ref) {
+            if (ref->_refs.load(std::memory_order_acquire) == 1) return ref;
+            node *c = new node(*ref);
+            _release(ref);
+            ref = c;
+            return c;
+        }
+
+        static Comp &comparer() {
+            static Comp _c{};
+            return _c;
+        }
+        static constexpr bool packed_search = detail::is_packed_key<T, Comp>::value;
+        // the first position whose key is not less than key
+        static int _lower(node const *p, T const &key) {
+            if constexpr (packed_search)
+                return detail::packed_lower_bound(p->_payloads.data(), p->_count, key);
+            else
+                return int(std::lower_bound(p->_payloads.data(), p->_payloads.data() + p->_count, key, comparer()) - p->_payloads.data());
+        }
+        // the first position whose key is greater than key
+        static int _upper(node const *p, T const &key) {
+            if constexpr (packed_search)
+                return detail::packed_upper_bound(p->_payloads.data(), p->_count, key);
+            else
+                return int(std::upper_bound(p->_payloads.data(), p->_payloads.data() + p->_count, key, comparer()) - p->_payloads.data());
+        }
+
+        static bool _exists(node const *p, T const &key) {
+            while (p) {
+                const int idx = _lower(p, key);
+                if (idx < p->_count && !comparer()(key, p->_payloads[std::size_t(idx)])) return true;
+                p = p->_leaf ? nullptr : p->_pointers[std::size_t(idx)];
+            }
+            return false;
+        }
+        template<class Fn>
+        static bool _walk(node const *p, Fn &fn) {
+            for (int i = 0; i < p->_count; i++) {
+                if (!p->_leaf && !_walk(p->_pointers[std::size_t(i)], fn)) return false;
+                if (!fn(p->_payloads[std::size_t(i)])) return false;
+            }
+            return p->_leaf || _walk(p->_pointers[std::size_t(p->_count)], fn);
+        }
+
+        // n is private and not full
+        void _insert_non_full(node *n, T const &key) {
+            for (;;) {
+                int idx = _upper(n, key);
+                if (n->_leaf) {
+                    for (int i = n->_count; i > idx; i--) n->_payloads[std::size_t(i)] = std::move(n->_payloads[std::size_t(i - 1)]);
+                    n->_payloads[std::size_t(idx)] = key;
+                    n->_count++;
+                    return;
+                }
+                node *c = _unique(n->_pointers[std::size_t(idx)]);
+                if (c->_count == max_keys) {
+                    detail::node_moves::split_child(n, idx, new node(c->_leaf));
+                    if (comparer()(n->_payloads[std::size_t(idx)], key)) idx++;
+                    c = n->_pointers[std::size_t(idx)];
+                }
+                n = c;
+            }
+        }
+
+        // removes key, which is present, from the sub-tree of the private n
+        void _remove(node *n, T const &key) {
+            for (;;) {
+                int idx = _lower(n, key);
+                if (idx < n->_count && !comparer()(key, n->_payloads[std::size_t(idx)])) {
+                    if (n->_leaf) {
+                        for (int i = idx + 1; i < n->_count; i++) n->_payloads[std::size_t(i - 1)] = std::move(n->_payloads[std::size_t(i)]);
+                        node::reset_key(n->_payloads[std::size_t(--n->_count)]);
+                        return;
+                    }
+                    // replace it by its predecessor or successor and remove
+                    // that one, or merge around it and go on in the child.
+                    if (n->_pointers[std::size_t(idx)]->_count >= _M) {
+                        n->_payloads[std::size_t(idx)] = _last_key(n->_pointers[std::size_t(idx)]);
+                        _remove(_unique(n->_pointers[std::size_t(idx)]), n->_payloads[std::size_t(idx)]);
+                        return;
+                    }
+                    if (n->_pointers[std::size_t(idx + 1)]->_count >= _M) {
+                        n->_payloads[std::size_t(idx)] = _first_key(n->_pointers[std::size_t(idx + 1)]);
+                        _remove(_unique(n->_pointers[std::size_t(idx + 1)]), n->_payloads[std::size_t(idx)]);
+                        return;
+                    }
+                    _merge(n, idx);
+                    n = n->_pointers[std::size_t(idx)];
+                    continue;
+                }
+
+                assertm(!n->_leaf, "the key should be present.");
+                const bool rightest = idx == n->_count;
+                if (n->_pointers[std::size_t(idx)]->_count < _M)
+                    _fill(n, idx);
+                if (rightest && idx > n->_count)
+                    idx--;
+                n = _unique(n->_pointers[std::size_t(idx)]);
+            }
+        }
+
+        static T const &_last_key(node const *p) {
+            while (!p->_leaf) p = p->_pointers[std::size_t(p->_count)];
+            return p->_payloads[std::size_t(p->_count - 1)];
+        }
+        static T const &_first_key(node const *p) {
+            while (!p->_leaf) p = p->_pointers[0];
+            return p->_payloads[0];
+        }
+
+        // makes Children[idx] of the private n one key larger
+        void _fill(node *n, int idx) {
+            if (idx != 0 && n->_pointers[std::size_t(idx - 1)]->_count >= _M) {
+                _unique(n->_pointers[std::size_t(idx)]);
+                _unique(n->_pointers[std::size_t(idx - 1)]);
+                detail::node_moves::rotate_from_left(n, idx);
+            } else if (idx != n->_count && n->_pointers[std::size_t(idx + 1)]->_count >= _M) {
+                _unique(n->_pointers[std::size_t(idx)]);
+                _unique(n->_pointers[std::size_t(idx + 1)]);
+                detail::node_moves::rotate_from_right(n, idx);
+            } else {
+                _merge(n, idx != n->_count ? idx : idx - 1);
+            }
+        }
+        // merges Children[idx+1] and n[idx] into Children[idx], the
+        // children of the sibling are handed over with their references.
+        void _merge(node *n, int idx) {
+            _unique(n->_pointers[std::size_t(idx)]);
+            _unique(n->_pointers[std::size_t(idx + 1)]);
+            delete detail::node_moves::merge(n, idx);
+        }
+
+        void _assert_node(node const *p, int depth, T const *lo, T const *hi, size_type &keys) const {
+            assertm(p->_refs.load() >= 1, "a reachable node should be referenced.");
+            assertm(p == _root || p->_count >= min_keys, "_count should be larger than min_keys.");
+            assertm(p->_count <= max_keys, "_count should be lower than max_keys.");
+            for (int i = 0; i < p->_count; i++) {
+                assertm(i == 0 || comparer()(p->_payloads[std::size_t(i - 1)], p->_payloads[std::size_t(i)]), "keys should be ascending.");
+                assertm(!lo || comparer()(*lo, p->_payloads[std::size_t(i)]), "a key should be greater than the separator on its left.");
+                assertm(!hi || comparer()(p->_payloads[std::size_t(i)], *hi), "a key should be lower than the separator on its right.");
+                UNUSED(lo, hi);
+            }
+            keys += size_type(p->_count);
+            if (p->_leaf) {
+                assertm(depth == _height, "all leaves should be at the same depth.");
+                UNUSED(depth);
+                return;
+            }
+            for (int i = 0; i <= p->_count; i++)
+                _assert_node(p->_pointers[std::size_t(i)], depth + 1, i == 0 ? lo : &p->_payloads[std::size_t(i - 1)],
+                             i == p->_count ? hi : &p->_payloads[std::size_t(i)], keys);
+        }
+
+    private:
+        node *_root{};
+        size_type _size{};
+        int _height{};
+
+    }; // cow_btree<T>
+
+
 } // namespace hicc::btree
 
 
@@ -1189,6 +1189,31 @@ namespace hicc { namespace cross {
 #endif
     }
 
+    //  btree_degree picks the Order of a B-tree node holding keys of type T,
+    //  so that the keys and the child pointers of one node fill about
+    //  `lines` constructive cache lines. The result is even and clamped
+    //  into [4, 256].
+    template<class T>
+    inline constexpr int btree_degree(std::size_t lines = 4) {
+        std::size_t d = lines * hardware_constructive_interference_size / (sizeof(T) + sizeof(void *));
+        d = d < 4 ? 4 : d > 256 ? 256
+                                : d;
+        return int(d & ~std::size_t(1));
+    }
+
+    // cpu_relax hints the processor that we're inside a busy-wait
+    // loop, so it can save power and leave the pipeline to the
+    // sibling hyper-thread.
+    inline void cpu_relax() noexcept {
+#if OS_WIN
+        YieldProcessor();
+#elif ARCH_X64 || defined(__i386__)
+        __builtin_ia32_pause();
+#elif ARCH_AARCH64 || ARCH_ARM
+        __asm__ __volatile__("yield" ::: "memory");
+#endif
+    }
+
     // struct alignas(hardware_constructive_interference_size)
     //         OneCacheLiner { // 占据一条缓存线
     //     std::atomic_uint64_t x{};
@@ -70,6 +70,8 @@ namespace hicc::mmap {
 #endif
                 size_ = mm.size_;
                 addr_ = mm.addr_;
+                writeable_ = mm.writeable_;
+                shareable_ = mm.shareable_;
             }
             void __copy(mmaplib &&mm) {
 #if defined(_WIN32)
@@ -83,6 +85,8 @@ namespace hicc::mmap {
 #endif
                 size_ = mm.size_;
                 addr_ = mm.addr_;
+                writeable_ = mm.writeable_;
+                shareable_ = mm.shareable_;
                 mm.addr_ = nullptr;
             }
 
@@ -91,6 +95,22 @@ namespace hicc::mmap {
             void connect(bool writeable, bool shareable, FILE_HANDLE fd);
             void close();
 
+            /**
+             * @brief flushes the modified pages in [offset, offset+length)
+             * of a shared writeable mapping to the file, and waits for it.
+             * @details offset is rounded down to the page boundary.
+             * length 0 means up to the end of the mapping.
+             * @return false if it failed
+             */
+            bool sync(std::size_t offset = 0, std::size_t length = 0);
+            /**
+             * @brief resizes the file and maps it again.
+             * @details The address of the mapping may change, so any
+             * pointer into data() is invalidated.
+             * @return false if it failed, the mapping is closed then.
+             */
+            bool resize(std::size_t size);
+
             bool is_open() const;
             std::size_t size() const;
             const char *data() const;
@@ -107,6 +127,8 @@ namespace hicc::mmap {
 #endif
             std::size_t size_;
             void *addr_;
+            bool writeable_{};
+            bool shareable_{};
         };
 
 #if defined(_WIN32)
@@ -153,6 +175,8 @@ namespace hicc::mmap {
             // #endif
         }
         inline void mmaplib::connect(bool writeable, bool shareable, FILE_HANDLE fd) {
+            writeable_ = writeable;
+            shareable_ = shareable;
 #if defined(_WIN32)
             if (fd == INVALID_HANDLE_VALUE) {
                 std::runtime_error("");
@@ -209,6 +233,53 @@ namespace hicc::mmap {
             cleanup();
         }
 
+        inline bool mmaplib::sync(std::size_t offset, std::size_t length) {
+            if (!is_open() || offset >= size_) return false;
+            if (length == 0 || offset + length > size_) length = size_ - offset;
+#if defined(_WIN32)
+            return ::FlushViewOfFile((char *) addr_ + offset, length) && ::FlushFileBuffers(hFile_);
+#else
+            const auto page = std::size_t(::sysconf(_SC_PAGESIZE));
+            const std::size_t begin = offset / page * page;
+            return ::msync((char *) addr_ + begin, offset + length - begin, MS_SYNC) == 0;
+#endif
+        }
+
+        inline bool mmaplib::resize(std::size_t size) {
+            if (!is_open()) return false;
+#if defined(_WIN32)
+            ::UnmapViewOfFile(addr_);
+            ::CloseHandle(hMapping_);
+            addr_ = MAP_FAILED;
+            hMapping_ = NULL;
+            LARGE_INTEGER li;
+            li.QuadPart = (LONGLONG) size;
+            if (!::SetFilePointerEx(hFile_, li, NULL, FILE_BEGIN) || !::SetEndOfFile(hFile_)) {
+                cleanup();
+                return false;
+            }
+            hMapping_ = ::CreateFileMapping(hFile_, NULL, (writeable_ ? PAGE_READWRITE : PAGE_READONLY), 0, 0, NULL);
+            if (hMapping_ != NULL)
+                addr_ = ::MapViewOfFile(hMapping_, FILE_MAP_READ | (writeable_ ? FILE_MAP_WRITE : 0), 0, 0, 0);
+            if (addr_ == NULL)
+                addr_ = MAP_FAILED;
+#else
+            ::munmap(addr_, size_);
+            addr_ = MAP_FAILED;
+            if (::ftruncate(fd_, off_t(size)) != 0) {
+                cleanup();
+                return false;
+            }
+            addr_ = ::mmap(NULL, size, PROT_READ | (writeable_ ? PROT_WRITE : 0), shareable_ ? MAP_SHARED : MAP_PRIVATE, fd_, 0);
+#endif
+            if (addr_ == MAP_FAILED) {
+                cleanup();
+                return false;
+            }
+            size_ = size;
+            return true;
+        }
+
         inline void mmaplib::cleanup() {
 #if defined(_WIN32)
             if (addr_) {
@@ -289,6 +360,11 @@ namespace hicc::mmap {
         const char *data() const { return _mm.data(); }
         char *data() { return _mm.data(); }
 
+        // see detail::mmaplib::sync()
+        bool sync(std::size_t offset = 0, std::size_t length = 0) { return _mm.sync(offset, length); }
+        // see detail::mmaplib::resize()
+        bool resize(std::size_t size) { return _mm.resize(size); }
+
     private:
         detail::mmaplib _mm;
     }; // class mmap_um
@@ -12,17 +12,27 @@
 // To enable debugging output for thread pool, adding this definition in your cmake script:
 // -DHICC_TEST_THREAD_POOL_DBGOUT=1
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
 #include <future>
 #include <mutex>
 #include <thread>
 
+#include <deque>
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
 #include <optional>
 #include <queue>
 #include <random>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #if __cplusplus >= 202002L
@@ -32,6 +42,7 @@
 
 #include "hz-defs.hh"
 #include "hz-log.hh"
+#include "hz-priority-queue.hh"
 #include "hz-ringbuf.hh"
 
 #if HICC_TEST_THREAD_POOL_DBGOUT
@@ -307,6 +318,216 @@ namespace hicc::pool {
 
 } // namespace hicc::pool
 
+// inplace_task, light_future, light_promise
+namespace hicc::pool {
+
+  /**
+     * @brief a move-only `void()` callable with small buffer optimization.
+     * 
+     * @details A callable fits in Capacity bytes (and is nothrow
+     * move-constructible) is stored inline, so wrapping it allocates
+     * nothing. A bigger one is kept on the heap.
+     * 
+     * The default capacity makes an inplace_task be one cache line.
+     */
+  template<std::size_t Capacity = 48>
+  class basic_inplace_task {
+    struct vtable {
+      void (*invoke)(void *);
+      void (*move)(void *dst, void *src) noexcept; // move-construct dst from src, and destroy src
+      void (*destroy)(void *) noexcept;
+    };
+
+    template<class D>
+    static constexpr bool fits_inline = sizeof(D) <= Capacity && alignof(D) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<D>;
+
+    template<class D>
+    static constexpr vtable inline_vtable{
+        [](void *p) { (*static_cast<D *>(p))(); },
+        [](void *dst, void *src) noexcept {
+          new (dst) D(std::move(*static_cast<D *>(src)));
+          static_cast<D *>(src)->~D();
+        },
+        [](void *p) noexcept { static_cast<D *>(p)->~D(); },
+    };
+    template<class D>
+    static constexpr vtable heap_vtable{
+        [](void *p) { (**static_cast<D **>(p))(); },
+        [](void *dst, void *src) noexcept { *static_cast<D **>(dst) = *static_cast<D **>(src); },
+        [](void *p) noexcept { delete *static_cast<D **>(p); },
+    };
+
+  public:
+    basic_inplace_task() = default;
+    template<class F, class D = std::decay_t<F>,
+             std::enable_if_t<!std::is_same_v<D, basic_inplace_task>, int> = 0>
+    basic_inplace_task(F &&f) {
+      if constexpr (fits_inline<D>) {
+        new (_buf) D(std::forward<F>(f));
+        _vt = &inline_vtable<D>;
+      } else {
+        *reinterpret_cast<D **>(_buf) = new D(std::forward<F>(f));
+        _vt = &heap_vtable<D>;
+      }
+    }
+    basic_inplace_task(basic_inplace_task &&o) noexcept { _take(o); }
+    basic_inplace_task &operator=(basic_inplace_task &&o) noexcept {
+      if (this != &o) {
+        _reset();
+        _take(o);
+      }
+      return *this;
+    }
+    basic_inplace_task(basic_inplace_task const &) = delete;
+    basic_inplace_task &operator=(basic_inplace_task const &) = delete;
+    ~basic_inplace_task() { _reset(); }
+
+    void operator()() { _vt->invoke(_buf); }
+    explicit operator bool() const { return _vt != nullptr; }
+
+  private:
+    void _take(basic_inplace_task &o) noexcept {
+      if (o._vt) {
+        o._vt->move(_buf, o._buf);
+        _vt = o._vt;
+        o._vt = nullptr;
+      }
+    }
+    void _reset() noexcept {
+      if (_vt) {
+        _vt->destroy(_buf);
+        _vt = nullptr;
+      }
+    }
+
+  private:
+    alignas(std::max_align_t) unsigned char _buf[Capacity];
+    vtable const *_vt{nullptr};
+  }; // class basic_inplace_task
+
+  using inplace_task = basic_inplace_task<>;
+
+  template<class R>
+  class light_promise;
+
+  namespace detail {
+    template<class R>
+    struct light_result { std::optional<R> _value{}; };
+    template<>
+    struct light_result<void> {};
+  } // namespace detail
+
+  /**
+     * @brief a future whose shared state lives inside itself, so that
+     * neither side allocates anything (unless an exception is thrown).
+     * 
+     * @details The price is that a light_future cannot move: it's
+     * returned as a prvalue (C++17 guaranteed copy elision) and pinned
+     * at where you declared it:
+     * @code{c++}
+     * auto f = pool.submit([] { return 42; });
+     * std::cout << f.get();
+     * @endcode
+     * And its destructor waits for the task, like the one from std::async.
+     */
+  template<class R>
+  class light_future : detail::light_result<R> {
+  public:
+    // launcher will be invoked with the pinned address of this future.
+    template<class Launcher>
+    explicit light_future(std::in_place_t, Launcher &&launcher) { launcher(this); }
+    ~light_future() { wait(); }
+    CLAZZ_NON_COPYABLE(light_future);
+
+    void wait() const {
+      std::unique_lock<std::mutex> lk(_m);
+      _cv.wait(lk, [this] { return _ready; });
+    }
+    template<class Rep, class Period>
+    bool wait_for(std::chrono::duration<Rep, Period> const &rel_time) const {
+      std::unique_lock<std::mutex> lk(_m);
+      return _cv.wait_for(lk, rel_time, [this] { return _ready; });
+    }
+    bool ready() const {
+      std::lock_guard<std::mutex> lk(_m);
+      return _ready;
+    }
+    // get() rethrows the exception from the task. Call it once only.
+    R get() {
+      wait();
+      if (_ex)
+        std::rethrow_exception(_ex);
+      if constexpr (!std::is_void_v<R>)
+        return std::move(*this->_value);
+    }
+
+  private:
+    friend class light_promise<R>;
+    template<class Setter>
+    void _set(Setter &&setter) {
+      // notify under the lock: the waiter may destroy us as soon as it sees _ready.
+      std::lock_guard<std::mutex> lk(_m);
+      setter();
+      _ready = true;
+      _cv.notify_all();
+    }
+
+  private:
+    mutable std::mutex _m{};
+    mutable std::condition_variable _cv{};
+    bool _ready{false};
+    std::exception_ptr _ex{};
+  }; // class light_future
+
+  /**
+     * @brief the producer side of a light_future. It's movable and
+     * one pointer wide. A promise destroyed without being satisfied
+     * breaks its future with std::future_errc::broken_promise.
+     */
+  template<class R>
+  class light_promise {
+  public:
+    explicit light_promise(light_future<R> *f)
+        : _f(f) {}
+    light_promise(light_promise &&o) noexcept
+        : _f(std::exchange(o._f, nullptr)) {}
+    light_promise &operator=(light_promise &&o) noexcept {
+      if (this != &o) {
+        _break();
+        _f = std::exchange(o._f, nullptr);
+      }
+      return *this;
+    }
+    light_promise(light_promise const &) = delete;
+    light_promise &operator=(light_promise const &) = delete;
+    ~light_promise() { _break(); }
+
+    template<class... V>
+    void set_value(V &&...v) {
+      light_future<R> *f = std::exchange(_f, nullptr);
+      f->_set([f, &v...] {
+        UNUSED(f);
+        if constexpr (!std::is_void_v<R>)
+          f->_value.emplace(std::forward<V>(v)...);
+      });
+    }
+    void set_exception(std::exception_ptr ex) {
+      light_future<R> *f = std::exchange(_f, nullptr);
+      f->_set([f, &ex] { f->_ex = std::move(ex); });
+    }
+
+  private:
+    void _break() {
+      if (_f)
+        set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+    }
+
+  private:
+    light_future<R> *_f;
+  }; // class light_promise
+
+} // namespace hicc::pool
+
 // threaded_message_queue, thread_pool
 namespace hicc::pool {
 
@@ -321,6 +542,20 @@ namespace hicc::pool {
       }
       _cv.notify_one();
     }
+    // moves [first, last) into the queue under one lock.
+    template<class It>
+    void emplace_back_bulk(It first, It last) {
+      std::size_t n = 0;
+      {
+        locker l_(_m);
+        for (; first != last; ++first, ++n)
+          _data.emplace_back(std::move(*first));
+      }
+      if (n > 1)
+        _cv.notify_all();
+      else if (n == 1)
+        _cv.notify_one();
+    }
     // void push_back(T const &t) {
     //     {
     //         locker l_(_m);
@@ -352,6 +587,16 @@ namespace hicc::pool {
       std::this_thread::yield();
       return ret;
     }
+    // never blocks, returns std::nullopt if the queue is empty.
+    inline std::optional<T> try_pop_front() {
+      std::optional<T> ret;
+      locker l_(_m);
+      if (!_abort && !_data.empty()) {
+        ret.emplace(std::move(_data.back()));
+        _data.pop_back();
+      }
+      return ret;
+    }
     // inline std::optional<T> pop_front_bad() {
     //     locker l(_m);
     //     _cv.wait(l, [this] { return _abort || !_data.empty(); });
@@ -381,6 +626,13 @@ namespace hicc::pool {
     bool _abort = false;
   }; // class threaded_message_queue
 
+  // the worker count of a pool made with n: n, or one per hardware thread if n <= 0.
+  inline std::size_t pool_size(int n) {
+    if (n > 0)
+      return static_cast<std::size_t>(n);
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
   /**
      * @brief a c++11 thread pool with pre-created, fixed running threads and free tasks management.
      * 
@@ -390,17 +642,16 @@ namespace hicc::pool {
      */
   class thread_pool {
   public:
-#define DEFAULT_POOL_SIZE (n > 0 ? n : std::thread::hardware_concurrency())
     thread_pool(int n = 1u)
 #if HICC_ENABLE_THREAD_POOL_READY_SIGNAL
 #if __cplusplus >= 202002L
-        : _sync_point(DEFAULT_POOL_SIZE, [] {})
+        : _sync_point(pool_size(n), [] {})
 #else
-        : _cv_started(DEFAULT_POOL_SIZE)
+        : _cv_started(pool_size(n))
 #endif
 #endif
     {
-      start_thread(DEFAULT_POOL_SIZE);
+      start_thread(pool_size(n));
     }
     // thread_pool(thread_pool &&) = delete;
     // thread_pool &operator=(thread_pool &&) = delete;
@@ -430,9 +681,88 @@ namespace hicc::pool {
       std::this_thread::yield();
       return r;
     }
+    /**
+         * @brief post a fire-and-forget task.
+         * @details No packaged_task, no shared state and no future: the
+         * task is stored inline in the queue, so a small one allocates
+         * nothing at all.
+         */
+    template<class F>
+    void post(F &&task) {
+      _tasks.emplace_back(task_type(std::forward<F>(task)));
+    }
+    /**
+         * @brief queue a task and get its result through a light_future,
+         * which allocates nothing.
+         * @details The returned light_future cannot be moved, and its
+         * destructor waits for the task:
+         * @code{c++}
+         * auto f = pool.submit([] { return 42; });
+         * std::cout << f.get();
+         * @endcode
+         */
+    template<class F, class R = std::invoke_result_t<std::decay_t<F>>>
+    light_future<R> submit(F &&task) {
+      return light_future<R>(std::in_place, [this, &task](light_future<R> *f) {
+        post([p = light_promise<R>(f), fn = std::forward<F>(task)]() mutable {
+          try {
+            if constexpr (std::is_void_v<R>) {
+              fn();
+              p.set_value();
+            } else {
+              p.set_value(fn());
+            }
+          } catch (...) {
+            p.set_exception(std::current_exception());
+          }
+        });
+      });
+    }
+    /**
+         * @brief post a batch of tasks with one lock and one notify.
+         * @details The elements of [first, last) are moved from, they
+         * should be convertible to inplace_task.
+         */
+    template<class It>
+    void post_bulk(It first, It last) {
+      struct to_task {
+        It it;
+        task_type operator*() const { return task_type(std::move(*it)); }
+        to_task &operator++() {
+          ++it;
+          return *this;
+        }
+        bool operator!=(to_task const &o) const { return it != o.it; }
+      };
+      _tasks.emplace_back_bulk(to_task{first}, to_task{last});
+    }
+    /**
+         * @brief run one queued task on the calling thread, if there is any.
+         * @details So that a thread waiting for its own tasks can help
+         * instead of blocking, see parallel_for().
+         * @return false if the queue was empty.
+         */
+    bool try_run_one() {
+      auto task = _tasks.try_pop_front();
+      if (!task)
+        return false;
+      ++_active;
+      try {
+        (*task)();
+      } catch (...) {
+        --_active;
+        throw;
+      }
+      --_active;
+      return true;
+    }
     void join() { clear_threads(); }
     std::size_t active_threads() const { return _active; }
     std::size_t total_threads() const { return _threads.size(); }
+    std::size_t idle_threads() const {
+      std::size_t active = _active, total = _threads.size();
+      return active < total ? total - active : 0;
+    }
     auto &tasks() { return _tasks; }
     auto const &tasks() const { return _tasks; }
 
@@ -496,8 +826,11 @@ namespace hicc::pool {
     }
 
   private:
-    std::vector<std::future<void>> _threads{};                           // fixed, running pool
-    mutable threaded_message_queue<std::packaged_task<void()>> _tasks{}; // the futures
+    // a LIFO queue (see threaded_message_queue::pop_front), so a vector
+    // keeps its capacity and costs no allocation per task.
+    using task_type = inplace_task;
+    std::vector<std::future<void>> _threads{};                                  // fixed, running pool
+    mutable threaded_message_queue<task_type, std::vector<task_type>> _tasks{}; // the futures
     std::atomic<std::size_t> _active{0};
 #if HICC_ENABLE_THREAD_POOL_READY_SIGNAL
 #if __cplusplus >= 202002L
@@ -589,4 +922,677 @@ namespace hicc::pool {
 
 } // namespace hicc::pool
 
+// parallel_for, parallel_reduce, parallel_transform
+namespace hicc::pool {
+
+  namespace detail {
+    // the element at an index or an iterator.
+    template<class It>
+    inline decltype(auto) element(It const &it) {
+      if constexpr (std::is_integral_v<It>)
+        return it;
+      else
+        return *it;
+    }
+
+    /**
+     * @brief runs body(b, e) over the sub-ranges of [first, last) on a
+     * thread_pool, and joins them.
+     */
+    template<class It, class Body>
+    class range_runner {
+    public:
+      range_runner(thread_pool &pool, std::size_t grain, Body &body)
+          : _pool(pool)
+          , _grain(grain)
+          , _body(body) {}
+      CLAZZ_NON_COPYABLE(range_runner);
+
+      void run(It first, It last) {
+        std::size_t n = static_cast<std::size_t>(last - first);
+        if (n == 0)
+          return;
+        if (_grain == 0)
+          _grain = std::max<std::size_t>(1, n / ((_pool.total_threads() + 1) * 8));
+
+        // the first batch: a piece for each idle worker and one for us.
+        std::size_t parts = std::min(_pool.idle_threads() + 1, (n + _grain - 1) / _grain);
+        if (parts > 1) {
+          std::vector<piece> batch;
+          batch.reserve(parts - 1);
+          for (std::size_t i = 1; i < parts; i++)
+            batch.push_back(_piece(first + static_cast<std::ptrdiff_t>(n * i / parts),
+                                   first + static_cast<std::ptrdiff_t>(n * (i + 1) / parts)));
+          _pool.post_bulk(batch.begin(), batch.end());
+        }
+        _guarded(first, first + static_cast<std::ptrdiff_t>(n / parts));
+        _wait();
+        if (_ex)
+          std::rethrow_exception(_ex);
+      }
+
+    private:
+      // a queued sub-range. Dropped without being run (the pool was
+      // cleared), it breaks the whole run.
+      struct piece {
+        range_runner *r;
+        It b, e;
+        piece(range_runner *r_, It b_, It e_)
+            : r(r_)
+            , b(b_)
+            , e(e_) {}
+        piece(piece &&o) noexcept
+            : r(std::exchange(o.r, nullptr))
+            , b(o.b)
+            , e(o.e) {}
+        piece &operator=(piece &&) = delete;
+        ~piece() {
+          if (r) {
+            r->_fail(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            r->_finish_one();
+          }
+        }
+        void operator()() {
+          range_runner *rr = std::exchange(r, nullptr);
+          rr->_queued.fetch_sub(1, std::memory_order_relaxed);
+          rr->_guarded(b, e);
+          rr->_finish_one();
+        }
+      };
+
+      piece _piece(It b, It e) {
+        {
+          std::lock_guard<std::mutex> lk(_m);
+          ++_pending;
+        }
+        _queued.fetch_add(1, std::memory_order_relaxed);
+        return piece(this, b, e);
+      }
+
+      // runs [b, e) grain by grain, and splits off the upper half for
+      // a worker which went idle meanwhile.
+      void _run_part(It b, It e) {
+        while (b != e && !_cancelled.load(std::memory_order_relaxed)) {
+          std::size_t n = static_cast<std::size_t>(e - b);
+          if (n >= 2 * _grain && _pool.idle_threads() > _queued.load(std::memory_order_relaxed)) {
+            It mid = b + static_cast<std::ptrdiff_t>(n / 2);
+            _pool.post(_piece(mid, e));
+            e = mid;
+            continue;
+          }
+          It ce = b + static_cast<std::ptrdiff_t>(std::min(n, _grain));
+          _body(b, ce);
+          b = ce;
+        }
+      }
+      void _guarded(It b, It e) {
+        try {
+          _run_part(b, e);
+        } catch (...) {
+          _fail(std::current_exception());
+        }
+      }
+      void _fail(std::exception_ptr ex) {
+        std::lock_guard<std::mutex> lk(_m);
+        if (!_ex)
+          _ex = std::move(ex);
+        _cancelled.store(true, std::memory_order_relaxed);
+      }
+      void _finish_one() {
+        // notify under the lock: _wait() may return and destroy us as
+        // soon as it sees _pending == 0.
+        std::lock_guard<std::mutex> lk(_m);
+        if (--_pending == 0)
+          _cv.notify_all();
+      }
+      // helps the pool instead of blocking. The park is a short one so
+      // that nested calls from the workers cannot wait on each other
+      // while their pieces sit in the queue.
+      void _wait() {
+        for (;;) {
+          {
+            std::lock_guard<std::mutex> lk(_m);
+            if (_pending == 0)
+              return;
+          }
+          try {
+            if (_pool.try_run_one())
+              continue;
+          } catch (...) {
+            _fail(std::current_exception());
+            continue;
+          }
+          std::unique_lock<std::mutex> lk(_m);
+          if (_cv.wait_for(lk, std::chrono::milliseconds(1), [this] { return _pending == 0; }))
+            return;
+        }
+      }
+
+    private:
+      thread_pool &_pool;
+      std::size_t _grain;
+      Body &_body;
+      std::mutex _m{};
+      std::condition_variable _cv{};
+      std::size_t _pending{0};              // pieces not finished, guarded by _m
+      std::atomic<std::size_t> _queued{0};  // pieces not started yet
+      std::atomic_bool _cancelled{false};
+      std::exception_ptr _ex{};
+    }; // class range_runner
+  }    // namespace detail
+
+  /**
+     * @brief calls fn for each element of [first, last) on the pool.
+     * 
+     * @details [first, last) is a range of integers or random access
+     * iterators, fn takes an integer or a dereferenced iterator. fn may
+     * take a sub-range (b, e) instead, to run a whole piece at once.
+     * 
+     * The range is cut into pieces of at least @p grain elements (0 for
+     * an automatic one). The first batch, a piece for each idle worker,
+     * is posted with one lock, and a running piece splits off its upper
+     * half whenever another worker goes idle. The calling thread runs a
+     * piece too, then helps running the queued tasks rather than
+     * blocking on futures. The first exception thrown by fn cancels the
+     * pieces not started yet, and is rethrown here.
+     * 
+     * @code{c++}
+     * hicc::pool::parallel_for(pool, std::size_t(0), v.size(), 1024, [&](std::size_t i) { v[i] *= 2; });
+     * hicc::pool::parallel_for(pool, v, 0, [](int &x) { x *= 2; });
+     * @endcode
+     */
+  template<class It, class Fn>
+  inline void parallel_for(thread_pool &pool, It first, It last, std::size_t grain, Fn &&fn) {
+    if constexpr (std::is_invocable_v<Fn &, It, It>) {
+      detail::range_runner<It, std::remove_reference_t<Fn>>(pool, grain, fn).run(first, last);
+    } else {
+      auto body = [&fn](It b, It e) {
+        for (; b != e; ++b)
+          fn(detail::element(b));
+      };
+      detail::range_runner<It, decltype(body)>(pool, grain, body).run(first, last);
+    }
+  }
+  template<class Range, class Fn>
+  inline void parallel_for(thread_pool &pool, Range &&range, std::size_t grain, Fn &&fn) {
+    parallel_for(pool, std::begin(range), std::end(range), grain, std::forward<Fn>(fn));
+  }
+
+  /**
+     * @brief reduces [first, last) with op, like std::reduce: op must be
+     * associative and commutative, since the pieces are folded in any
+     * order. init is folded once.
+     */
+  template<class It, class T, class Op>
+  inline T parallel_reduce(thread_pool &pool, It first, It last, std::size_t grain, T init, Op op) {
+    std::mutex m;
+    std::optional<T> total;
+    auto body = [&](It b, It e) {
+      T acc = detail::element(b);
+      for (++b; b != e; ++b)
+        acc = op(std::move(acc), detail::element(b));
+      std::lock_guard<std::mutex> lk(m);
+      if (total)
+        *total = op(std::move(*total), std::move(acc));
+      else
+        total.emplace(std::move(acc));
+    };
+    detail::range_runner<It, decltype(body)>(pool, grain, body).run(first, last);
+    return total ? op(std::move(init), std::move(*total)) : init;
+  }
+  template<class Range, class T, class Op>
+  inline T parallel_reduce(thread_pool &pool, Range &&range, std::size_t grain, T init, Op op) {
+    return parallel_reduce(pool, std::begin(range), std::end(range), grain, std::move(init), std::move(op));
+  }
+
+  /**
+     * @brief writes fn(element) of [first, last) to d_first.., which
+     * must be a random access iterator.
+     * @return the end of the output range.
+     */
+  template<class It, class OutIt, class Fn>
+  inline OutIt parallel_transform(thread_pool &pool, It first, It last, OutIt d_first, std::size_t grain, Fn fn) {
+    auto body = [&](It b, It e) {
+      OutIt out = d_first + (b - first);
+      for (; b != e; ++b, ++out)
+        *out = fn(detail::element(b));
+    };
+    detail::range_runner<It, decltype(body)>(pool, grain, body).run(first, last);
+    return d_first + (last - first);
+  }
+  template<class Range, class OutIt, class Fn>
+  inline OutIt parallel_transform(thread_pool &pool, Range &&range, OutIt d_first, std::size_t grain, Fn fn) {
+    return parallel_transform(pool, std::begin(range), std::end(range), d_first, grain, std::move(fn));
+  }
+
+} // namespace hicc::pool
+
+// work_stealing_deque, work_stealing_pool
+namespace hicc::pool {
+
+  /**
+     * @brief Chase-Lev work-stealing deque.
+     * 
+     * @details The owner thread pushes and pops at the bottom (LIFO,
+     * cache-hot), any other thread steals from the top (FIFO). Only
+     * the owner and a thief racing for the last element need a CAS.
+     * The ring grows when full, the retired rings are kept till the
+     * deque dies since a thief might be still reading them.
+     * 
+     * @par See also "Correct and Efficient Work-Stealing for Weak
+     * Memory Models", Lê, Pop, Cohen, Zappa Nardelli, PPoPP'13.
+     * 
+     * @tparam T should be a pointer (or another trivially copyable type
+     * whose T{} means nothing).
+     */
+  template<typename T>
+  class work_stealing_deque {
+    static_assert(std::is_trivially_copyable_v<T>, "work_stealing_deque holds trivially copyable items only");
+
+    struct ring {
+      explicit ring(std::int64_t cap)
+          : _cap(cap), _mask(cap - 1), _items(new std::atomic<T>[static_cast<std::size_t>(cap)]) {}
+      T get(std::int64_t i) const { return _items[static_cast<std::size_t>(i & _mask)].load(std::memory_order_relaxed); }
+      void put(std::int64_t i, T x) { _items[static_cast<std::size_t>(i & _mask)].store(x, std::memory_order_relaxed); }
+      std::int64_t _cap, _mask;
+      std::unique_ptr<std::atomic<T>[]> _items;
+    };
+
+  public:
+    explicit work_stealing_deque(std::int64_t capacity = 256) {
+      std::int64_t cap = 2;
+      while (cap < capacity) cap <<= 1;
+      auto r = std::make_unique<ring>(cap);
+      _ring.store(r.get(), std::memory_order_relaxed);
+      _rings.push_back(std::move(r));
+    }
+    CLAZZ_NON_COPYABLE(work_stealing_deque);
+
+    // owner only
+    void push(T x) {
+      std::int64_t b = _bottom.load(std::memory_order_relaxed);
+      std::int64_t t = _top.load(std::memory_order_acquire);
+      ring *r = _ring.load(std::memory_order_relaxed);
+      if (b - t > r->_cap - 1)
+        r = _grow(r, b, t);
+      r->put(b, x);
+      std::atomic_thread_fence(std::memory_order_release);
+      _bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    // owner only, returns T{} if empty.
+    T pop() {
+      std::int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+      ring *r = _ring.load(std::memory_order_relaxed);
+      _bottom.store(b, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      std::int64_t t = _top.load(std::memory_order_relaxed);
+      T x{};
+      if (t <= b) {
+        x = r->get(b);
+        if (t == b) {
+          // the last one, race against the thieves
+          if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            x = T{};
+          _bottom.store(b + 1, std::memory_order_relaxed);
+        }
+      } else {
+        _bottom.store(b + 1, std::memory_order_relaxed);
+      }
+      return x;
+    }
+    // any thread, returns T{} if empty or lost the race.
+    T steal() {
+      std::int64_t t = _top.load(std::memory_order_acquire);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      std::int64_t b = _bottom.load(std::memory_order_acquire);
+      if (t < b) {
+        ring *r = _ring.load(std::memory_order_acquire);
+        T x = r->get(t);
+        if (_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+          return x;
+      }
+      return T{};
+    }
+
+    bool empty() const { return size() == 0; }
+    std::size_t size() const {
+      std::int64_t b = _bottom.load(std::memory_order_relaxed), t = _top.load(std::memory_order_relaxed);
+      return b > t ? static_cast<std::size_t>(b - t) : 0;
+    }
+
+  private:
+    ring *_grow(ring *r, std::int64_t b, std::int64_t t) {
+      auto nr = std::make_unique<ring>(r->_cap * 2);
+      for (std::int64_t i = t; i < b; i++)
+        nr->put(i, r->get(i));
+      r = nr.get();
+      _ring.store(r, std::memory_order_release);
+      _rings.push_back(std::move(nr));
+      return r;
+    }
+
+  private:
+    alignas(cross::cacheline_align_v) std::atomic<std::int64_t> _top{0};
+    alignas(cross::cacheline_align_v) std::atomic<std::int64_t> _bottom{0};
+    alignas(cross::cacheline_align_v) std::atomic<ring *> _ring{nullptr};
+    std::vector<std::unique_ptr<ring>> _rings{}; // owner only: the current and all retired rings
+  }; // class work_stealing_deque
+
+  /**
+     * @brief a thread pool with a work-stealing scheduler.
+     * 
+     * @details Each worker owns a work_stealing_deque. A task queued
+     * from inside a worker goes to its own deque, a task queued from
+     * any other thread goes to the shared injection queue. An idle
+     * worker looks at its deque first, then takes a batch from the
+     * injection queue, then tries to steal from random victims, and
+     * parks at last.
+     * 
+     * It has the same queue_task() API as thread_pool. Unlike
+     * thread_pool, join() runs out the queued tasks before it stops
+     * the workers.
+     */
+  class work_stealing_pool {
+  public:
+    work_stealing_pool(int n = 1u) {
+      start_thread(pool_size(n));
+    }
+    CLAZZ_NON_COPYABLE(work_stealing_pool);
+    ~work_stealing_pool() {
+      join();
+      // the ones queued by foreign threads after join(), their futures get broken_promise.
+      for (auto *t : _injection) delete t;
+    }
+
+  public:
+    template<class F, class R = std::invoke_result_t<F>>
+    std::future<R> queue_task(F &&task) {
+      auto p = std::packaged_task<R()>(std::forward<F>(task));
+      auto r = p.get_future();
+      _submit(new task_type(std::move(p)));
+      return r;
+    }
+    template<class F, class R = std::invoke_result_t<F>>
+    std::future<R> queue_task(F const &task) {
+      auto p = std::packaged_task<R()>(task);
+      auto r = p.get_future();
+      _submit(new task_type(std::move(p)));
+      return r;
+    }
+    void join() {
+      if (_stop.exchange(true))
+        return;
+      _idle.notify_all();
+      for (auto &t : _threads)
+        if (t.joinable()) t.join();
+    }
+    std::size_t active_threads() const { return _active; }
+    std::size_t total_threads() const { return _workers.size(); }
+    // the index of the calling worker in this pool, or -1 for a foreign thread.
+    int current_worker_index() const {
+      return _tls_worker != nullptr && _tls_worker->_pool == this ? static_cast<int>(_tls_worker->_index) : -1;
+    }
+
+  private:
+    using task_type = std::packaged_task<void()>;
+    struct worker {
+      worker(work_stealing_pool *pool_, std::size_t index_)
+          : _pool(pool_), _index(index_), _seed(static_cast<std::uint32_t>(index_ * 2654435761u + 1)) {}
+      work_stealing_pool *_pool;
+      std::size_t _index;
+      std::uint32_t _seed;
+      work_stealing_deque<task_type *> _deque{};
+    };
+    static constexpr std::size_t injection_batch = 32;
+
+    void _submit(task_type *t) {
+      if (worker *w = _tls_worker; w != nullptr && w->_pool == this) {
+        w->_deque.push(t);
+      } else {
+        std::lock_guard<std::mutex> lk(_injection_m);
+        _injection.push_back(t);
+        _injected.store(_injection.size(), std::memory_order_relaxed);
+      }
+      _idle.notify(1);
+    }
+
+    // moves a batch from the injection queue into w's deque, returns one of them.
+    task_type *_take_injected(worker &w) {
+      if (_injected.load(std::memory_order_relaxed) == 0)
+        return nullptr;
+      std::lock_guard<std::mutex> lk(_injection_m);
+      if (_injection.empty())
+        return nullptr;
+      // a fair share, so that the other workers can take theirs
+      std::size_t n = std::min({injection_batch, _injection.size(), _injection.size() / _workers.size() + 1});
+      task_type *t = _injection.front();
+      // push the rest reversely, so that w pops them in FIFO order
+      for (std::size_t i = n - 1; i > 0; i--)
+        w._deque.push(_injection[i]);
+      _injection.erase(_injection.begin(), _injection.begin() + static_cast<std::ptrdiff_t>(n));
+      _injected.store(_injection.size(), std::memory_order_relaxed);
+      return t;
+    }
+    task_type *_steal(worker &w) {
+      std::size_t n = _workers.size();
+      if (n < 2)
+        return nullptr;
+      // xorshift32, pick a random victim and sweep from it
+      w._seed ^= w._seed << 13;
+      w._seed ^= w._seed >> 17;
+      w._seed ^= w._seed << 5;
+      std::size_t start = w._seed % n;
+      for (std::size_t i = 0; i < n; i++) {
+        worker &victim = *_workers[(start + i) % n];
+        if (&victim == &w)
+          continue;
+        if (task_type *t = victim._deque.steal(); t != nullptr)
+          return t;
+      }
+      return nullptr;
+    }
+    task_type *_find_task(worker &w) {
+      if (task_type *t = w._deque.pop(); t != nullptr)
+        return t;
+      if (task_type *t = _take_injected(w); t != nullptr)
+        return t;
+      return _steal(w);
+    }
+    bool _has_task() const {
+      if (_injected.load(std::memory_order_relaxed) > 0)
+        return true;
+      for (auto const &w : _workers)
+        if (!w->_deque.empty())
+          return true;
+      return false;
+    }
+
+    void _run(worker &w) {
+      _tls_worker = &w;
+      for (;;) {
+        task_type *t = _find_task(w);
+        for (int i = 0; t == nullptr && i < 8; i++) {
+          std::this_thread::yield();
+          t = _find_task(w);
+        }
+        if (t != nullptr) {
+          std::unique_ptr<task_type> task{t};
+          ++_active;
+          try {
+            (*task)();
+          } catch (...) {
+            // no one to rethrow to, the worker must survive it
+            pool_debug("  . work_stealing_pool: a task threw, dropped.");
+          }
+          --_active;
+          continue;
+        }
+
+        auto key = _idle.prepare_wait();
+        if (_has_task()) {
+          _idle.cancel_wait();
+          continue;
+        }
+        if (_stop.load(std::memory_order_acquire)) {
+          _idle.cancel_wait();
+          break;
+        }
+        _idle.wait(key);
+      }
+      _tls_worker = nullptr;
+    }
+
+    void start_thread(std::size_t n) {
+      for (std::size_t i = 0; i < n; i++)
+        _workers.push_back(std::make_unique<worker>(this, i));
+      for (auto &w : _workers)
+        _threads.emplace_back([this, &w] { _run(*w); });
+      pool_debug("  . work_stealing_pool.started (%lu workers)..", _workers.size());
+    }
+
+  private:
+    std::vector<std::unique_ptr<worker>> _workers{};
+    std::vector<std::thread> _threads{};
+    std::mutex _injection_m{};
+    std::deque<task_type *> _injection{};
+    std::atomic_size_t _injected{0};
+    ringbuf::eventcount _idle{};
+    std::atomic_bool _stop{false};
+    std::atomic<std::size_t> _active{0};
+    static inline thread_local worker *_tls_worker{nullptr};
+  }; // class work_stealing_pool
+
+  /**
+     * @brief a thread pool running the tasks of higher priority first.
+     * 
+     * @details The tasks are queued into a queue::multi_queue, so the
+     * producers and the workers seldom meet on a lock, but the order is
+     * relaxed: a worker may take a task a few ranks after the best one,
+     * and the tasks of equal priority are not strictly FIFO.
+     * 
+     * The greater Priority runs first. Like work_stealing_pool, join()
+     * runs out the queued tasks before it stops the workers.
+     * @tparam Priority any type having operator<
+     */
+  template<class Priority = int>
+  class priority_thread_pool {
+  public:
+    /**
+         * @param n the workers, one per hardware thread if n <= 0
+         * @param c the queue shards per worker. One worker with one
+         * shard runs the tasks in the exact priority order.
+         */
+    priority_thread_pool(int n = 1u, std::size_t c = 2)
+        : _tasks(pool_size(n), c) {
+      start_thread(pool_size(n));
+    }
+    CLAZZ_NON_COPYABLE(priority_thread_pool);
+    ~priority_thread_pool() { join(); }
+
+  public:
+    template<class F, class R = std::invoke_result_t<F>>
+    std::future<R> queue_task(Priority const &priority, F &&task) {
+      auto p = std::packaged_task<R()>(std::forward<F>(task));
+      auto r = p.get_future();
+      post(priority, std::move(p));
+      return r;
+    }
+    // post a fire-and-forget task, stored inline in the queue. If it
+    // throws, the exception is dropped; use queue_task() to get it.
+    template<class F>
+    void post(Priority const &priority, F &&task) {
+      _tasks.emplace(entry{priority, task_type(std::forward<F>(task))});
+      _idle.notify(1);
+    }
+    /**
+         * @brief run one queued task on the calling thread, if there is any.
+         * @return false if the queue was empty.
+         */
+    bool try_run_one() {
+      entry e;
+      if (!_tasks.try_pop(e))
+        return false;
+      ++_active;
+      try {
+        e.task();
+      } catch (...) {
+        --_active;
+        throw;
+      }
+      --_active;
+      return true;
+    }
+    void join() {
+      if (_stop.exchange(true))
+        return;
+      _idle.notify_all();
+      for (auto &t : _threads)
+        if (t.joinable()) t.join();
+    }
+    std::size_t active_threads() const { return _active; }
+    std::size_t total_threads() const { return _threads.size(); }
+    std::size_t pending_tasks() const { return _tasks.size(); }
+
+  private:
+    using task_type = inplace_task;
+    struct entry {
+      Priority priority{};
+      task_type task{};
+    };
+    struct by_priority {
+      int operator()(entry const &lhs, entry const &rhs) const {
+        return lhs.priority < rhs.priority ? -1 : rhs.priority < lhs.priority ? 1
+                                                                              : 0;
+      }
+    };
+
+    void _run() {
+      for (;;) {
+        entry e;
+        bool got = _tasks.try_pop(e);
+        for (int i = 0; !got && i < 8; i++) {
+          std::this_thread::yield();
+          got = _tasks.try_pop(e);
+        }
+        if (got) {
+          ++_active;
+          try {
+            e.task();
+          } catch (...) {
+            // a post()ed task has no one to rethrow to, the worker must survive it
+            pool_debug("  . priority_thread_pool: a task threw, dropped.");
+          }
+          --_active;
+          continue;
+        }
+
+        auto key = _idle.prepare_wait();
+        if (!_tasks.empty()) {
+          _idle.cancel_wait();
+          continue;
+        }
+        if (_stop.load(std::memory_order_acquire)) {
+          _idle.cancel_wait();
+          break;
+        }
+        _idle.wait(key);
+      }
+    }
+
+    void start_thread(std::size_t n) {
+      for (std::size_t i = 0; i < n; i++)
+        _threads.emplace_back([this] { _run(); });
+      pool_debug("  . priority_thread_pool.started (%lu workers)..", n);
+    }
+
+  private:
+    queue::multi_queue<entry, int, by_priority> _tasks;
+    std::vector<std::thread> _threads{};
+    ringbuf::eventcount _idle{};
+    std::atomic_bool _stop{false};
+    std::atomic<std::size_t> _active{0};
+  }; // class priority_thread_pool
+
+} // namespace hicc::pool
+
 #endif //HICC_CXX_POOL_HH
@@ -5,19 +5,27 @@
 #ifndef HICC_CXX_HZ_PRIORITY_QUEUE_HH
 #define HICC_CXX_HZ_PRIORITY_QUEUE_HH
 
+#include <algorithm>
 #include <functional>
 #include <list>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <utility>
 
 #include <cassert>
 
+#include "hz-defs.hh"
+
 
 namespace hicc::queue {
 
@@ -50,11 +58,13 @@ namespace hicc::queue {
     public:
         struct element;
         using value_type = T;
+        // a position in the tree, kept for compatibility: my_iterator does
+        // not use it any more, see element::next().
         struct _It {
             element *_el{};
             std::size_t _pos{(std::size_t) -1};
 
-            priority_queue::value_type *get() const;
+            [[deprecated("O(pos) per call, iterate with begin()/end() instead")]] priority_queue::value_type *get() const;
             bool operator==(_It const &rhs) const { return _el == rhs._el && _pos == rhs._pos; }
             bool operator!=(_It const &rhs) const { return _el != rhs._el || _pos != rhs._pos; }
             bool operator()() const { return _el != nullptr; }
@@ -132,7 +142,7 @@ namespace hicc::queue {
                     }
                     if (!_list.empty()) {
                         count--;
-                        T t;
+                        T t{};
                         std::swap(t, _list.front());
                         _list.pop_front();
                         return t;
@@ -155,7 +165,7 @@ namespace hicc::queue {
                 }
                 if (!_list.empty()) {
                     count--;
-                    T t;
+                    T t{};
                     std::swap(t, _list.front());
                     _list.pop_front();
                     return t;
@@ -169,7 +179,8 @@ namespace hicc::queue {
                 return _null;
             }
 
-            _It next(std::size_t pos) {
+            // the position after pos in the pop order, within this subtree only.
+            [[deprecated("quadratic over a whole walk, iterate with begin()/end() instead")]] _It next(std::size_t pos) {
                 if (ReverseComp) {
                     if (pos == (std::size_t) -1) {
                         if (_left) {
@@ -228,6 +239,12 @@ namespace hicc::queue {
 
             static priority_queue::value_type _null;
         };
+        /**
+         * @brief forward iterator over the elements in the pop order.
+         * @details It holds the elements still to be visited on a stack,
+         * so a full iteration is O(n) whatever the shape of the tree, and
+         * dereferencing is O(1).
+         */
         struct my_iterator {
             using iterator_category = std::forward_iterator_tag;
             using difference_type = std::ptrdiff_t;
@@ -236,31 +253,22 @@ namespace hicc::queue {
             using reference = priority_queue::value_type &;
 
             my_iterator() = default;
-            my_iterator(element *ptr, std::size_t pos = (std::size_t) -1)
-                    : _it{ptr, pos} {}
-
-            reference operator*() const {
-                _It &it = const_cast<_It &>(_it);
-                // pointer ptr = it.get();
-                auto &z = it._el->_list;
-                auto x = z.begin();
-                std::advance(x, it._pos);
-                reference data = (*x);
-                return data;
+            explicit my_iterator(element *root) {
+                _descend(root);
+                _next_element();
             }
-            pointer operator->() {
-                _It &it = const_cast<_It &>(_it);
-                // return it.get();
-                auto &z = it._el->_list;
-                auto x = z.begin();
-                std::advance(x, it._pos);
-                reference data = (*x);
-                auto *ptr = &data;
-                return ptr;
+            // the former (element, position) form: the walk over the subtree
+            // of root, pos elements in.
+            [[deprecated("use priority_queue::begin()/end()")]] my_iterator(element *root, std::size_t pos)
+                    : my_iterator(root) {
+                for (std::size_t i = 0; pos != (std::size_t) -1 && i < pos && _el != nullptr; i++) ++*this;
             }
+
+            reference operator*() const { return *_it; }
+            pointer operator->() const { return &*_it; }
             my_iterator &operator++() {
-                if (_it._el != nullptr)
-                    _it = _it->next(_it._pos);
+                if (++_it == _el->_list.end())
+                    _next_element();
                 return *this;
             }
             my_iterator operator++(int) {
@@ -268,11 +276,34 @@ namespace hicc::queue {
                 ++(*this);
                 return tmp;
             }
-            friend bool operator==(const my_iterator &a, const my_iterator &b) { return a._it == b._it; };
-            friend bool operator!=(const my_iterator &a, const my_iterator &b) { return a._it != b._it; };
+            friend bool operator==(const my_iterator &a, const my_iterator &b) { return a._el == b._el && (a._el == nullptr || a._it == b._it); };
+            friend bool operator!=(const my_iterator &a, const my_iterator &b) { return !(a == b); };
 
         private:
-            _It _it;
+            using list_iterator = decltype(std::declval<Container &>().begin());
+
+            // e and the chain of the children of it to be visited before it
+            void _descend(element *e) {
+                for (; e; e = (ReverseComp ? e->_left : e->_right).get())
+                    _path.push_back(e);
+            }
+            void _next_element() {
+                while (!_path.empty()) {
+                    element *e = _path.back();
+                    _path.pop_back();
+                    _descend((ReverseComp ? e->_right : e->_left).get());
+                    if (!e->_list.empty()) {
+                        _el = e;
+                        _it = e->_list.begin();
+                        return;
+                    }
+                }
+                _el = nullptr;
+            }
+
+            std::vector<element *> _path;
+            element *_el{};
+            list_iterator _it{};
         };
 
     public:
@@ -281,8 +312,8 @@ namespace hicc::queue {
                 , _comparer{} {}
         virtual ~priority_queue() {}
 
-        my_iterator begin() { return my_iterator{_root.get(), 0}; }
-        my_iterator end() { return my_iterator(nullptr); }
+        my_iterator begin() { return my_iterator{_root.get()}; }
+        my_iterator end() { return my_iterator{}; }
         void push_back(T const &data) { push(data); }
         void pop_front() { _root->pop(_count); }
         T &front() { return *begin(); }
@@ -296,6 +327,31 @@ namespace hicc::queue {
         T pop() { return _root->pop(_count); }
         static bool is_null(T const &t) { return t == element::_null; }
 
+        /**
+         * @brief visits the elements in the pop order, in O(n).
+         * @param fn void(T const &)
+         */
+        template<class Fn>
+        void for_each(Fn &&fn) const {
+            for (my_iterator it{_root.get()}, last{}; it != last; ++it)
+                fn(*it);
+        }
+        /**
+         * @brief copies the first k elements in the pop order, all of
+         * them by default.
+         * @details The tree is ordered already, so this is a walk, it
+         * stops after k elements.
+         */
+        std::vector<T> sorted_snapshot(std::size_t k = std::size_t(-1)) const {
+            std::vector<T> vec;
+            vec.reserve(std::min(k, _count));
+            for (my_iterator it{_root.get()}, last{}; it != last && vec.size() < k; ++it)
+                vec.push_back(*it);
+            return vec;
+        }
+        // the k elements to be popped first, in order
+        std::vector<T> top_k(std::size_t k) const { return sorted_snapshot(k); }
+
     public:
         void dump(std::function<void(element *)> const &fn) { ReverseComp ? _root->LNR(fn) : _root->RNL(fn); }
 
@@ -369,6 +425,591 @@ namespace hicc::queue {
             bool ReverseComp>
     inline typename priority_queue<T, PT, Comp, Container, ReverseComp>::value_type priority_queue<T, PT, Comp, Container, ReverseComp>::element::_null{};
 
+
+    //
+
+
+    namespace detail {
+        /**
+         * @brief copies the values of the first k slots in the pop order,
+         * all of them by default, in O(n + k log k).
+         * @details The slots are partitioned around the k-th one by
+         * std::nth_element, then only the first k are sorted.
+         * @param before true if a slot is to be popped before another one
+         */
+        template<class Slot, class Before>
+        inline auto heap_sorted_snapshot(std::vector<Slot> const &slots, std::size_t k, Before const &before) {
+            std::vector<decltype(Slot::value)> vec;
+            k = std::min(k, slots.size());
+            std::vector<Slot const *> order(slots.size());
+            for (std::size_t i = 0; i < slots.size(); i++) order[i] = &slots[i];
+            auto by_ptr = [&before](Slot const *a, Slot const *b) { return before(*a, *b); };
+            if (k < order.size())
+                std::nth_element(order.begin(), order.begin() + std::ptrdiff_t(k), order.end(), by_ptr);
+            std::sort(order.begin(), order.begin() + std::ptrdiff_t(k), by_ptr);
+            vec.reserve(k);
+            for (std::size_t i = 0; i < k; i++) vec.push_back(order[i]->value);
+            return vec;
+        }
+        /**
+         * @brief the values of the k slots to be popped first from the
+         * Arity-heap in slots, in order, in O(k log k) and without
+         * touching the heap.
+         * @details A heap of candidates starts with the root; the best
+         * candidate is taken each time, and its children become
+         * candidates.
+         */
+        template<std::size_t Arity, class Slot, class Before>
+        inline auto heap_top_k(std::vector<Slot> const &slots, std::size_t k, Before const &before) {
+            std::vector<decltype(Slot::value)> vec;
+            k = std::min(k, slots.size());
+            vec.reserve(k);
+            if (k == 0) return vec;
+            auto worse = [&](std::size_t a, std::size_t b) { return before(slots[b], slots[a]); };
+            std::vector<std::size_t> candidates{0};
+            candidates.reserve(k * (Arity - 1) + 1);
+            while (vec.size() < k) {
+                std::pop_heap(candidates.begin(), candidates.end(), worse);
+                std::size_t pos = candidates.back();
+                candidates.pop_back();
+                vec.push_back(slots[pos].value);
+                std::size_t first = pos * Arity + 1, last = std::min(first + Arity, slots.size());
+                for (std::size_t c = first; c < last; c++) {
+                    candidates.push_back(c);
+                    std::push_heap(candidates.begin(), candidates.end(), worse);
+                }
+            }
+            return vec;
+        }
+    } // namespace detail
+
+    /**
+     * @brief a d-ary heap in one contiguous array, with the API of
+     * priority_queue.
+     * @details Comp is the three-way comparer of priority_queue: the
+     * greatest element is popped first, or the least one if ReverseComp.
+     * Equal elements are popped in the order they were pushed, as in
+     * priority_queue, by a push sequence number kept beside each value.
+     *
+     * A node's children are at [i*Arity+1, i*Arity+Arity], so a wider
+     * heap is shallower and its children share a cache line or two. push()
+     * and pop() are O(log n) with no allocation but the array growth,
+     * which reserve() avoids. Move-only elements are supported.
+     * @tparam T the element
+     * @tparam PT the result of Comp
+     * @tparam Comp returns a negative PT if lhs has a lower priority than
+     * rhs, a positive one if higher, 0 if equal
+     * @tparam Arity the children count of a node, 2 or more
+     * @tparam ReverseComp pops the least element first
+     */
+    template<class T,
+            class PT = int,
+            class Comp = comparer<T, PT>,
+            std::size_t Arity = 4,
+            bool ReverseComp = false>
+    class dary_heap {
+        static_assert(Arity >= 2, "dary_heap Arity should be 2 or more");
+
+    public:
+        using value_type = T;
+        using size_type = std::size_t;
+
+        dary_heap() = default;
+        explicit dary_heap(Comp const &comp)
+                : _comparer(comp) {}
+        dary_heap(dary_heap const &) = default;
+        dary_heap(dary_heap &&) = default;
+        dary_heap &operator=(dary_heap const &) = default;
+        dary_heap &operator=(dary_heap &&) = default;
+        virtual ~dary_heap() {}
+
+        void push_back(T const &data) { push(data); }
+        void push_back(T &&data) { push(std::move(data)); }
+        void pop_front() { (void) pop(); }
+        // the element to be popped next, the queue must not be empty
+        T const &front() const { return _slots.front().value; }
+        std::size_t size() const { return _slots.size(); }
+        bool empty() const { return _slots.empty(); }
+        void reserve(std::size_t n) { _slots.reserve(n); }
+        std::size_t capacity() const { return _slots.capacity(); }
+        void clear() {
+            _slots.clear();
+            _seq = 0;
+        }
+
+        void push(T const &data) { emplace(data); }
+        void push(T &&data) { emplace(std::move(data)); }
+        template<class... Args>
+        void emplace(Args &&...args) {
+            _slots.push_back(slot{T(std::forward<Args>(args)...), _seq++});
+            _sift_up(_slots.size() - 1);
+        }
+
+        /**
+         * @brief removes the front element and returns it, a
+         * value-initialized T if the queue is empty.
+         */
+        T pop() {
+            if (_slots.empty()) return T{};
+            T t = std::move(_slots.front().value);
+            slot last = std::move(_slots.back());
+            _slots.pop_back();
+            if (!_slots.empty()) _sift_down(0, std::move(last));
+            return t;
+        }
+
+        // copies the first k elements in the pop order, all of them by
+        // default, see detail::heap_sorted_snapshot()
+        std::vector<T> sorted_snapshot(std::size_t k = std::size_t(-1)) const {
+            return detail::heap_sorted_snapshot(_slots, k, [this](slot const &a, slot const &b) { return _before(a, b); });
+        }
+        // the k elements to be popped first, in order, see detail::heap_top_k()
+        std::vector<T> top_k(std::size_t k) const {
+            return detail::heap_top_k<Arity>(_slots, k, [this](slot const &a, slot const &b) { return _before(a, b); });
+        }
+
+    private:
+        struct slot {
+            T value;
+            std::uint64_t seq; // the push order among equal elements
+        };
+
+        // true if a is to be popped before b
+        bool _before(slot const &a, slot const &b) const {
+            PT ret = _comparer(a.value, b.value);
+            if (ret != PT{}) return ReverseComp ? ret < PT{} : ret > PT{};
+            return a.seq < b.seq;
+        }
+
+        // moves the slot at pos up into place, along a hole
+        void _sift_up(std::size_t pos) {
+            slot s = std::move(_slots[pos]);
+            while (pos > 0) {
+                std::size_t parent = (pos - 1) / Arity;
+                if (!_before(s, _slots[parent])) break;
+                _slots[pos] = std::move(_slots[parent]);
+                pos = parent;
+            }
+            _slots[pos] = std::move(s);
+        }
+
+        /**
+         * @brief fills the hole at pos with s or the best of its descendants.
+         * @details The hole goes down to a leaf along the best children
+         * first, then s goes up from there (Floyd's way): s is the last
+         * leaf, it seldom goes back up far, and the way down skips the
+         * comparing with s at each level.
+         */
+        void _sift_down(std::size_t pos, slot &&s) {
+            const std::size_t n = _slots.size();
+            for (;;) {
+                std::size_t first = pos * Arity + 1;
+                if (first >= n) break;
+                std::size_t last = first + Arity < n ? first + Arity : n;
+                std::size_t best = first;
+                for (std::size_t c = first + 1; c < last; c++)
+                    if (_before(_slots[c], _slots[best])) best = c;
+                _slots[pos] = std::move(_slots[best]);
+                pos = best;
+            }
+            _slots[pos] = std::move(s);
+            _sift_up(pos);
+        }
+
+    private:
+        std::vector<slot> _slots;
+        Comp _comparer{};
+        std::uint64_t _seq{};
+    };
+
+
+    //
+
+
+    /**
+     * @brief a d-ary heap whose elements can be reached by the handles
+     * push() returns, to be updated or erased in place.
+     * @details The order is the one of dary_heap. Each element carries
+     * its handle's index, and the heap position of every index is kept in
+     * one flat array, so a move in the heap updates one entry and no
+     * element owns any allocation of the index.
+     *
+     * A handle stays valid until its element is popped or erased. Its
+     * index is reused then, with the generation bumped, so contains()
+     * tells a stale handle from a live one.
+     * @tparam T the element
+     * @tparam PT the result of Comp
+     * @tparam Comp the three-way comparer, see dary_heap
+     * @tparam Arity the children count of a node, 2 or more
+     * @tparam ReverseComp pops the least element first
+     */
+    template<class T,
+            class PT = int,
+            class Comp = comparer<T, PT>,
+            std::size_t Arity = 4,
+            bool ReverseComp = false>
+    class indexed_heap {
+        static_assert(Arity >= 2, "indexed_heap Arity should be 2 or more");
+
+    public:
+        using value_type = T;
+        using size_type = std::size_t;
+
+        struct handle {
+            std::uint32_t index{npos};
+            std::uint32_t generation{};
+            bool operator==(handle const &rhs) const { return index == rhs.index && generation == rhs.generation; }
+            bool operator!=(handle const &rhs) const { return !(*this == rhs); }
+        };
+
+        indexed_heap() = default;
+        explicit indexed_heap(Comp const &comp)
+                : _comparer(comp) {}
+        virtual ~indexed_heap() {}
+
+        void pop_front() { (void) pop(); }
+        // the element to be popped next, the queue must not be empty
+        T const &front() const { return _slots.front().value; }
+        handle front_handle() const { return {_slots.front().index, _generations[_slots.front().index]}; }
+        std::size_t size() const { return _slots.size(); }
+        bool empty() const { return _slots.empty(); }
+        void reserve(std::size_t n) {
+            _slots.reserve(n);
+            _positions.reserve(n);
+            _generations.reserve(n);
+        }
+        void clear() {
+            for (auto const &s : _slots) _release(s.index);
+            _slots.clear();
+            _seq = 0;
+        }
+
+        handle push(T const &data) { return emplace(data); }
+        handle push(T &&data) { return emplace(std::move(data)); }
+        template<class... Args>
+        handle emplace(Args &&...args) {
+            std::uint32_t index = _acquire();
+            _slots.push_back(slot{T(std::forward<Args>(args)...), _seq++, index});
+            _sift_up(_slots.size() - 1);
+            return {index, _generations[index]};
+        }
+
+        /**
+         * @brief removes the front element and returns it, a
+         * value-initialized T if the queue is empty.
+         */
+        T pop() {
+            if (_slots.empty()) return T{};
+            T t = std::move(_slots.front().value);
+            _remove_at(0);
+            return t;
+        }
+
+        bool contains(handle h) const {
+            return h.index < _generations.size() && _generations[h.index] == h.generation && _positions[h.index] != npos;
+        }
+        // the element of a live handle
+        T const &get(handle h) const { return _slots[_positions[h.index]].value; }
+
+        /**
+         * @brief replaces the element of h and moves it into place, in
+         * O(log n). Among equal elements it goes behind, as if pushed now.
+         * @return false if h is not live
+         */
+        bool update(handle h, T data) {
+            if (!contains(h)) return false;
+            std::size_t pos = _positions[h.index];
+            _slots[pos].value = std::move(data);
+            _slots[pos].seq = _seq++;
+            _fix(pos);
+            return true;
+        }
+        /**
+         * @brief removes the element of h, in O(log n).
+         * @return false if h is not live
+         */
+        bool erase(handle h) {
+            if (!contains(h)) return false;
+            _remove_at(_positions[h.index]);
+            return true;
+        }
+
+        // copies the first k elements in the pop order, all of them by
+        // default, see detail::heap_sorted_snapshot()
+        std::vector<T> sorted_snapshot(std::size_t k = std::size_t(-1)) const {
+            return detail::heap_sorted_snapshot(_slots, k, [this](slot const &a, slot const &b) { return _before(a, b); });
+        }
+        // the k elements to be popped first, in order, see detail::heap_top_k()
+        std::vector<T> top_k(std::size_t k) const {
+            return detail::heap_top_k<Arity>(_slots, k, [this](slot const &a, slot const &b) { return _before(a, b); });
+        }
+
+    private:
+        static constexpr std::uint32_t npos = std::uint32_t(-1);
+
+        struct slot {
+            T value;
+            std::uint64_t seq;   // the push order among equal elements
+            std::uint32_t index; // of the handle
+        };
+
+        // true if a is to be popped before b
+        bool _before(slot const &a, slot const &b) const {
+            PT ret = _comparer(a.value, b.value);
+            if (ret != PT{}) return ReverseComp ? ret < PT{} : ret > PT{};
+            return a.seq < b.seq;
+        }
+
+        std::uint32_t _acquire() {
+            if (!_free.empty()) {
+                std::uint32_t index = _free.back();
+                _free.pop_back();
+                return index;
+            }
+            _positions.push_back(npos);
+            _generations.push_back(0);
+            return std::uint32_t(_positions.size() - 1);
+        }
+        void _release(std::uint32_t index) {
+            _positions[index] = npos;
+            _generations[index]++;
+            _free.push_back(index);
+        }
+
+        void _place(std::size_t pos, slot &&s) {
+            _positions[s.index] = std::uint32_t(pos);
+            _slots[pos] = std::move(s);
+        }
+
+        // removes the element at pos, the last one fills the hole
+        void _remove_at(std::size_t pos) {
+            _release(_slots[pos].index);
+            slot last = std::move(_slots.back());
+            _slots.pop_back();
+            if (pos == _slots.size()) return;
+            _place(pos, std::move(last));
+            _fix(pos);
+        }
+        // moves the element at pos up or down into place
+        void _fix(std::size_t pos) {
+            if (pos > 0 && _before(_slots[pos], _slots[(pos - 1) / Arity]))
+                _sift_up(pos);
+            else
+                _sift_down(pos);
+        }
+
+        void _sift_up(std::size_t pos) {
+            slot s = std::move(_slots[pos]);
+            while (pos > 0) {
+                std::size_t parent = (pos - 1) / Arity;
+                if (!_before(s, _slots[parent])) break;
+                _place(pos, std::move(_slots[parent]));
+                pos = parent;
+            }
+            _place(pos, std::move(s));
+        }
+
+        void _sift_down(std::size_t pos) {
+            const std::size_t n = _slots.size();
+            slot s = std::move(_slots[pos]);
+            for (;;) {
+                std::size_t first = pos * Arity + 1;
+                if (first >= n) break;
+                std::size_t last = first + Arity < n ? first + Arity : n;
+                std::size_t best = first;
+                for (std::size_t c = first + 1; c < last; c++)
+                    if (_before(_slots[c], _slots[best])) best = c;
+                if (!_before(_slots[best], s)) break;
+                _place(pos, std::move(_slots[best]));
+                pos = best;
+            }
+            _place(pos, std::move(s));
+        }
+
+    private:
+        std::vector<slot> _slots;
+        std::vector<std::uint32_t> _positions;   // the heap position of each handle index
+        std::vector<std::uint32_t> _generations; // of each handle index
+        std::vector<std::uint32_t> _free;        // the handle indexes to reuse
+        Comp _comparer{};
+        std::uint64_t _seq{};
+    };
+
+
+    //
+
+
+    namespace detail {
+        /**
+         * @brief a test-and-test-and-set spinlock, it meets Lockable.
+         * @details A waiter spins on a plain load, so the cache line stays
+         * shared until the lock is released, and yields after a while in
+         * case the owner has been preempted.
+         */
+        class spin_lock {
+        public:
+            void lock() noexcept {
+                for (int spins = 0;; spins++) {
+                    if (try_lock()) return;
+                    if (spins < 64) hicc::cross::cpu_relax();
+                    else std::this_thread::yield();
+                }
+            }
+            bool try_lock() noexcept {
+                return !_locked.load(std::memory_order_relaxed) && !_locked.exchange(true, std::memory_order_acquire);
+            }
+            void unlock() noexcept { _locked.store(false, std::memory_order_release); }
+
+        private:
+            std::atomic_bool _locked{false};
+        };
+
+        // a xorshift32 generator per thread, for picking the shards
+        inline std::uint32_t shard_random() {
+            thread_local std::uint32_t x = static_cast<std::uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id())) | 1u;
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            return x;
+        }
+    } // namespace detail
+
+    /**
+     * @brief a concurrent relaxed priority queue, the MultiQueue.
+     * @details It is c*threads dary_heap shards, each one behind its own
+     * spin_lock. push() puts the element into a random shard; pop() looks
+     * at two random shards and pops the better front of them. So the
+     * threads seldom meet on one lock, and the throughput goes up nearly
+     * with the threads, but the order is relaxed: a pop may return an
+     * element a few ranks after the best one (O(c*threads) on average),
+     * and the equal elements are in FIFO order only inside a shard.
+     *
+     * try_pop() fails only after it found every shard empty.
+     * @tparam T the element, default-constructible and movable
+     * @tparam PT the result of Comp
+     * @tparam Comp the three-way comparer of dary_heap
+     * @tparam Arity the children count of a node of each shard
+     * @tparam ReverseComp pops the least element first
+     */
+    template<class T,
+            class PT = int,
+            class Comp = comparer<T, PT>,
+            std::size_t Arity = 4,
+            bool ReverseComp = false>
+    class multi_queue {
+    public:
+        using value_type = T;
+        using size_type = std::size_t;
+
+        /**
+         * @param threads the threads expected to work on the queue
+         * @param c the shards per thread, 2 or more keeps the contention low
+         */
+        explicit multi_queue(std::size_t threads = std::thread::hardware_concurrency(), std::size_t c = 2, Comp const &comp = Comp{})
+                : _shards(std::max<std::size_t>(threads * c, 1))
+                , _comparer(comp) {
+            for (auto &s : _shards) s.heap = heap_type(comp);
+        }
+        multi_queue(multi_queue const &) = delete;
+        multi_queue &operator=(multi_queue const &) = delete;
+
+        void push(T const &data) { emplace(data); }
+        void push(T &&data) { emplace(std::move(data)); }
+        template<class... Args>
+        void emplace(Args &&...args) {
+            shard *s = &_pick();
+            for (int i = 0; !s->lock.try_lock(); i++) {
+                if (i == 3) {
+                    s->lock.lock();
+                    break;
+                }
+                s = &_pick();
+            }
+            std::lock_guard<detail::spin_lock> lk(s->lock, std::adopt_lock);
+            s->heap.emplace(std::forward<Args>(args)...);
+            s->size.store(s->heap.size(), std::memory_order_release);
+        }
+
+        /**
+         * @brief pops the better front of two random shards into out.
+         * @return false if every shard was found empty.
+         */
+        bool try_pop(T &out) {
+            for (int i = 0; i < 8; i++) {
+                shard *a = &_pick(), *b = &_pick();
+                if (a == b || b->size.load(std::memory_order_acquire) == 0) b = nullptr;
+                if (a->size.load(std::memory_order_acquire) == 0) std::swap(a, b);
+                if (a == nullptr) continue;
+                if (b != nullptr && b < a) std::swap(a, b); // the locking order
+                if (!a->lock.try_lock()) continue;
+                std::lock_guard<detail::spin_lock> lka(a->lock, std::adopt_lock);
+                if (b != nullptr && !b->lock.try_lock()) b = nullptr;
+                std::unique_lock<detail::spin_lock> lkb;
+                if (b != nullptr) lkb = std::unique_lock<detail::spin_lock>(b->lock, std::adopt_lock);
+                shard *from = a;
+                if (b != nullptr && !b->heap.empty() && (a->heap.empty() || _better(b->heap.front(), a->heap.front())))
+                    from = b;
+                if (from->heap.empty()) continue;
+                out = from->heap.pop();
+                from->size.store(from->heap.size(), std::memory_order_release);
+                return true;
+            }
+            // mostly empty, or busy: sweep all of the shards from a random one
+            std::size_t n = _shards.size(), start = _index(detail::shard_random());
+            for (std::size_t i = 0; i < n; i++) {
+                shard &s = _shards[(start + i) % n];
+                if (s.size.load(std::memory_order_acquire) == 0) continue;
+                std::lock_guard<detail::spin_lock> lk(s.lock);
+                if (s.heap.empty()) continue;
+                out = s.heap.pop();
+                s.size.store(s.heap.size(), std::memory_order_release);
+                return true;
+            }
+            return false;
+        }
+        // pops an element as try_pop(), a value-initialized T if the queue is empty.
+        T pop() {
+            T t{};
+            (void) try_pop(t);
+            return t;
+        }
+
+        // the sum of the shard sizes, exact only while no one else is working on it.
+        std::size_t size() const {
+            std::size_t n = 0;
+            for (auto const &s : _shards) n += s.size.load(std::memory_order_acquire);
+            return n;
+        }
+        bool empty() const {
+            for (auto const &s : _shards)
+                if (s.size.load(std::memory_order_acquire) != 0) return false;
+            return true;
+        }
+        std::size_t shards() const { return _shards.size(); }
+
+    private:
+        using heap_type = dary_heap<T, PT, Comp, Arity, ReverseComp>;
+        struct alignas(hicc::cross::cacheline_align_v) shard {
+            detail::spin_lock lock{};
+            std::atomic_size_t size{0}; // heap.size(), to skip an empty shard without locking it
+            heap_type heap{};
+        };
+
+        std::size_t _index(std::uint32_t r) const {
+            return static_cast<std::size_t>((std::uint64_t(r) * _shards.size()) >> 32);
+        }
+        shard &_pick() { return _shards[_index(detail::shard_random())]; }
+        // true if a is to be popped before b
+        bool _better(T const &a, T const &b) const {
+            PT ret = _comparer(a, b);
+            return ReverseComp ? ret < PT{} : ret > PT{};
+        }
+
+    private:
+        std::vector<shard> _shards;
+        Comp _comparer;
+    };
+
 } // namespace hicc::queue
 
 
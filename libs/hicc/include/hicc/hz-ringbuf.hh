@@ -11,11 +11,18 @@
 #include <mutex>
 #include <thread>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
 #include <optional>
 #include <queue>
 #include <random>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include "hz-defs.hh"
@@ -29,112 +36,492 @@ namespace hicc::ringbuf {
     enum CannotEnqueue {
         CE_DEFAULT,
         CE_BLOCKED_AND_SPIN,
+        CE_BLOCKED_AND_PARK, // spin adaptively for a while, and then sleep till notified
+    };
+
+    /**
+     * @brief eventcount lets a lock-free structure park its waiters
+     * without putting a lock on the fast path.
+     * @details A waiter takes a key by prepare_wait(), re-checks its
+     * condition, and then either cancel_wait() or wait(key). A
+     * notifier changes the state first and calls notify(n) later,
+     * which costs a fence and a load only while nobody is waiting.
+     *
+     * std::atomic::wait() has no timed variant (and needs C++20), so
+     * the sleeping side is a std::condition_variable, which is a
+     * futex on Linux anyway.
+     */
+    class eventcount {
+    public:
+        using key_type = std::uint64_t;
+
+        key_type prepare_wait() {
+            _waiters.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the one in notify()
+            return _epoch.load(std::memory_order_seq_cst);
+        }
+        void cancel_wait() { _waiters.fetch_sub(1, std::memory_order_seq_cst); }
+        void wait(key_type key) {
+            std::unique_lock<std::mutex> lk(_m);
+            _cv.wait(lk, [this, key] { return _epoch.load(std::memory_order_relaxed) != key; });
+            _waiters.fetch_sub(1, std::memory_order_seq_cst);
+        }
+        // returns false if the deadline passed before being notified.
+        template<class Clock, class Duration>
+        bool wait_until(key_type key, std::chrono::time_point<Clock, Duration> const &deadline) {
+            std::unique_lock<std::mutex> lk(_m);
+            bool ok = _cv.wait_until(lk, deadline, [this, key] { return _epoch.load(std::memory_order_relaxed) != key; });
+            _waiters.fetch_sub(1, std::memory_order_seq_cst);
+            return ok;
+        }
+        // wakes up n waiters at most.
+        void notify(std::size_t n = 1) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::size_t waiters = _waiters.load(std::memory_order_relaxed);
+            if (waiters == 0 || n == 0)
+                return;
+            {
+                std::lock_guard<std::mutex> lk(_m);
+                _epoch.fetch_add(1, std::memory_order_seq_cst);
+            }
+            if (n >= waiters)
+                _cv.notify_all();
+            else
+                while (n-- > 0) _cv.notify_one();
+        }
+        void notify_all() { notify(std::numeric_limits<std::size_t>::max()); }
+
+    private:
+        std::atomic<key_type> _epoch{0};
+        std::atomic_size_t _waiters{0};
+        std::mutex _m{};
+        std::condition_variable _cv{};
+    }; // class eventcount
+
+    /**
+     * @brief how many producers and consumers may work on a ring_buffer concurrently.
+     */
+    enum Cardinality {
+        CA_MPMC, // multiple producers, multiple consumers
+        CA_MPSC, // multiple producers, single consumer
+        CA_SPSC, // single producer, single consumer
     };
 
     /**
      * @brief lock-free ring-buffer, MPMC enabled.
-     * @tparam T 
+     * @details Each slot carries its own sequence number (Dmitry
+     * Vyukov's bounded MPMC queue). A producer claims a position
+     * by CAS on the front index only if the slot sequence says it
+     * has been drained, writes the element, and then publishes it
+     * by bumping the slot sequence. A consumer claims a position
+     * only if the slot sequence says it has been published. So no
+     * side can touch a slot before the other side finished with it.
+     *
+     * The slots are cacheline-aligned to avoid false sharing between
+     * neighbouring producers/consumers.
+     *
+     * CA_MPSC drops the CAS on the back index since the only consumer
+     * owns it. CA_SPSC drops the slot sequences too: each side owns
+     * its index, publishes it with a plain release store, and caches
+     * the other side's index so that it reloads it only when the
+     * buffer looks full (or empty). Both are wait-free for the single
+     * side, but it's your duty to keep the promised cardinality.
+     * @tparam T the element type, should be default-constructible and movable.
+     * @tparam CANNOT_ENQUEUE CannotEnqueue
+     * @tparam CARDINALITY Cardinality
      */
-    template<typename T, int CANNOT_ENQUEUE = CE_DEFAULT>
+    template<typename T, int CANNOT_ENQUEUE = CE_DEFAULT, int CARDINALITY = CA_MPMC>
     class ring_buffer {
     public:
         ring_buffer(int capacity = 2 << 8) {
             resize(capacity);
         }
         ~ring_buffer() { clear(); }
+        CLAZZ_NON_COPYABLE(ring_buffer);
 
     public:
         void clear() {}
         // don't resize in working mode (enqueue/dequeue-ing).
         void resize(int capacity) {
             std::size_t size = _round_up_to_pow2(capacity);
-            _coll.resize(size);
-            _f = 0;
-            _b = 0;
+            _cells.reset(new cell[size]);
+            if constexpr (CARDINALITY != CA_SPSC) {
+                for (std::size_t i = 0; i < size; i++)
+                    _cells[i]._seq.store(i, std::memory_order_relaxed);
+            }
+            _f.store(0, std::memory_order_relaxed);
+            _b.store(0, std::memory_order_relaxed);
+            _b_cached = _f_cached = 0;
             _size = size;
             _Mask = size - 1;
         }
 
         // the free space
-        std::size_t free() const {
-            size_t b = _b.load(std::memory_order_acquire), f = _f.load(std::memory_order_acquire);
-            return b > f ? b - f - 1 : _size + (b - f) - 1;
-        }
+        std::size_t free() const { return _size - qty(); }
+        // the count of queued elements, a snapshot only under contention.
         std::size_t qty() const {
             size_t b = _b.load(std::memory_order_acquire), f = _f.load(std::memory_order_acquire);
-            return f > b ? f - b : _size + (f - b);
+            return f > b ? (f - b > _size ? _size : f - b) : 0;
         }
         // the available capacity in this ring-buffer
-        std::size_t capacity() const { return _Mask; }
+        std::size_t capacity() const { return _size; }
         // the allocated size of the internal container
         std::size_t size() const { return _size; }
-        bool empty() const {
-            size_t b = _b.load(std::memory_order_acquire), f = _f.load(std::memory_order_acquire);
-            return _empty(b, f);
-        }
-        bool full() const {
-            size_t b = _b.load(std::memory_order_acquire), f = _f.load(std::memory_order_acquire);
-            return _full(b, f);
-        }
-        bool _empty(size_t b, size_t f) const { return f == b; }
-        inline bool _full(size_t b, size_t f) const { return ((f + 1) & _Mask) == b; }
+        bool empty() const { return qty() == 0; }
+        bool full() const { return qty() == _size; }
 
     public:
-        DISABLE_UNUSED_WARNINGS
         bool enqueue(T &&elem) {
-            size_t b, f, nf;
-        _retry:
-            b = _b.load(std::memory_order_acquire), f = _f.load(std::memory_order_acquire);
-            if (!_full(b, f)) {
-                nf = (f + 1) & _Mask;
-                if (_f.compare_exchange_strong(f, nf, std::memory_order_release)) {
-                    _coll[f & _Mask] = std::move(elem);
-                    return true;
-                }
-            }
+            return _retry_until(_not_full, [&] { return _try_enqueue(elem); }, no_deadline{});
+        }
+        std::optional<T> dequeue() {
+            std::optional<T> ret;
+            _retry_until(_not_empty, [&] { return _try_dequeue(ret); }, no_deadline{});
+            return ret;
+        }
+
+        /**
+         * @brief enqueue elem, or give up after rel_time.
+         * @details The elem is left untouched if it cannot be enqueued.
+         * In CE_BLOCKED_AND_PARK mode the thread sleeps till a slot is
+         * drained or the time is up, in the other modes it spins.
+         * @return true if elem was enqueued.
+         */
+        template<class R, class P>
+        bool enqueue_for(T &&elem, std::chrono::duration<R, P> const &rel_time) {
+            return enqueue_until(std::move(elem), std::chrono::steady_clock::now() + rel_time);
+        }
+        template<class C, class D>
+        bool enqueue_until(T &&elem, std::chrono::time_point<C, D> const &timeout_time) {
+            return _retry_until(_not_full, [&] { return _try_enqueue(elem); }, timeout_time);
+        }
+        /**
+         * @brief dequeue one element, or give up after rel_time.
+         * @return std::nullopt if nothing arrived in time.
+         */
+        template<class R, class P>
+        std::optional<T> dequeue_for(std::chrono::duration<R, P> const &rel_time) {
+            return dequeue_until(std::chrono::steady_clock::now() + rel_time);
+        }
+        template<class C, class D>
+        std::optional<T> dequeue_until(std::chrono::time_point<C, D> const &timeout_time) {
+            std::optional<T> ret;
+            _retry_until(_not_empty, [&] { return _try_dequeue(ret); }, timeout_time);
+            return ret;
+        }
 
-            if constexpr (CANNOT_ENQUEUE == CE_DEFAULT)
+        /**
+         * @brief enqueue [first, last) by reserving a contiguous range of
+         * slots with one update of the front index.
+         * @details In CE_DEFAULT mode it enqueues as many elements as the
+         * free space allows and returns at once. In the blocked modes it
+         * returns after all of them are enqueued.
+         * @return the count of elements moved into the ring-buffer.
+         */
+        template<typename FwdIt>
+        std::size_t enqueue_bulk(FwdIt first, FwdIt last) {
+            std::size_t n = static_cast<std::size_t>(std::distance(first, last)), done = 0;
+            if (n == 0)
+                return 0;
+            _retry_until(
+                    _not_full, [&] {
+                        done += _try_enqueue_bulk(first, n - done);
+                        return done == n;
+                    },
+                    no_deadline{});
+            return done;
+        }
+        /**
+         * @brief dequeue up to max elements into out with one update of
+         * the back index.
+         * @details In the blocked modes it waits until one element at
+         * least is available.
+         * @return the count of elements moved out.
+         */
+        template<typename OutIt>
+        std::size_t dequeue_bulk(OutIt out, std::size_t max) {
+            std::size_t got = 0;
+            if (max > 0)
+                _retry_until(
+                        _not_empty, [&] { return (got = _try_dequeue_bulk(out, max)) > 0; },
+                        no_deadline{});
+            return got;
+        }
+
+    private:
+        struct no_deadline {};
+
+        // runs try_once till it succeeds, in the manner of CANNOT_ENQUEUE.
+        // ec is the eventcount that will be notified when it's worth trying again.
+        template<typename TryOnce, typename Deadline>
+        bool _retry_until(eventcount &ec, TryOnce &&try_once, Deadline const &deadline) {
+            constexpr bool forever = std::is_same_v<Deadline, no_deadline>;
+            if (try_once())
+                return true;
+
+            if constexpr (CANNOT_ENQUEUE == CE_DEFAULT && forever) {
+                UNUSED(ec, deadline);
                 return false;
-            if constexpr (CANNOT_ENQUEUE == CE_BLOCKED_AND_SPIN) {
+            } else if constexpr (CANNOT_ENQUEUE == CE_BLOCKED_AND_PARK) {
+                // spin a little before parking. The budget follows how long
+                // the recent successful spins took (like glibc's adaptive
+                // mutex), and is halved when spinning didn't help. There's
+                // nothing to spin for on a uniprocessor.
+                static const bool smp = std::thread::hardware_concurrency() > 1;
+                int budget = _spin_budget.load(std::memory_order_relaxed);
+                int limit = smp ? std::min(spin_max, budget * 2 + 16) : 0;
+                for (int i = 0; i < limit; i++) {
+                    cross::cpu_relax();
+                    if (try_once()) {
+                        _spin_budget.store(budget + (i - budget) / 8, std::memory_order_relaxed);
+                        return true;
+                    }
+                }
+                _spin_budget.store(budget / 2, std::memory_order_relaxed);
+                for (int i = 0; i < yield_max; i++) {
+                    std::this_thread::yield();
+                    if (try_once())
+                        return true;
+                }
+
+                for (;;) {
+                    auto key = ec.prepare_wait();
+                    if (try_once()) {
+                        ec.cancel_wait();
+                        return true;
+                    }
+                    if constexpr (forever) {
+                        ec.wait(key);
+                    } else if (!ec.wait_until(key, deadline)) {
+                        return try_once();
+                    }
+                }
+            } else {
+                UNUSED(ec);
                 using namespace std::chrono_literals;
-                std::this_thread::yield();
+                for (;;) {
+                    if constexpr (!forever) {
+                        if (Deadline::clock::now() >= deadline)
+                            return false;
+                    }
+                    std::this_thread::yield();
 #if OS_LINUX
-                std::this_thread::sleep_for(1ns);
+                    std::this_thread::sleep_for(1ns);
 #endif
-                goto _retry;
+                    if (try_once())
+                        return true;
+                }
+            }
+        }
+
+        // moves out of elem only if a slot was claimed.
+        bool _try_enqueue(T &elem) {
+            std::size_t pos;
+            if (cell *c = _claim_for_enqueue(pos); c != nullptr) {
+                c->_data = std::move(elem);
+                _publish_enqueued(c, pos);
+                if constexpr (CANNOT_ENQUEUE == CE_BLOCKED_AND_PARK)
+                    _not_empty.notify(1);
+                return true;
             }
-#if !OS_WIN
             return false;
-#endif
         }
-        std::optional<T> dequeue() {
-            size_t b, f, nb;
-            std::optional<T> ret;
-        _retry:
-            b = _b.load(std::memory_order_acquire), f = _f.load(std::memory_order_acquire);
-            if (!_empty(b, f)) {
-                nb = (b + 1) & _Mask;
-                if (_b.compare_exchange_strong(b, nb, std::memory_order_release)) {
-                    ret.emplace(std::move(_coll[b & _Mask]));
-                    return ret;
+        bool _try_dequeue(std::optional<T> &ret) {
+            std::size_t pos;
+            if (cell *c = _claim_for_dequeue(pos); c != nullptr) {
+                ret.emplace(std::move(c->_data));
+                _publish_dequeued(c, pos);
+                if constexpr (CANNOT_ENQUEUE == CE_BLOCKED_AND_PARK)
+                    _not_full.notify(1);
+                return true;
+            }
+            return false;
+        }
+        template<typename FwdIt>
+        std::size_t _try_enqueue_bulk(FwdIt &first, std::size_t n) {
+            std::size_t pos, k = _claim_bulk_for_enqueue(pos, n);
+            if (k > 0) {
+                for (std::size_t i = 0; i < k; i++, ++first)
+                    _cells[(pos + i) & _Mask]._data = std::move(*first);
+                _publish_bulk_enqueued(pos, k);
+                if constexpr (CANNOT_ENQUEUE == CE_BLOCKED_AND_PARK)
+                    _not_empty.notify(k);
+            }
+            return k;
+        }
+        template<typename OutIt>
+        std::size_t _try_dequeue_bulk(OutIt &out, std::size_t max) {
+            std::size_t pos, k = _claim_bulk_for_dequeue(pos, max);
+            if (k > 0) {
+                for (std::size_t i = 0; i < k; i++, ++out)
+                    *out = std::move(_cells[(pos + i) & _Mask]._data);
+                _publish_bulk_dequeued(pos, k);
+                if constexpr (CANNOT_ENQUEUE == CE_BLOCKED_AND_PARK)
+                    _not_full.notify(k);
+            }
+            return k;
+        }
+
+    private:
+        DISABLE_MSVC_WARNINGS(4324) // structure was padded due to alignment specifier
+        struct alignas(cacheline_align_v) seq_cell {
+            std::atomic_size_t _seq{0};
+            T _data{};
+        };
+        RESTORE_MSVC_WARNINGS
+        struct plain_cell {
+            T _data{};
+        };
+        // SPSC slots are touched by one producer and one consumer in
+        // order, packing them keeps the prefetcher happy.
+        using cell = std::conditional_t<CARDINALITY == CA_SPSC, plain_cell, seq_cell>;
+
+        // returns the claimed cell and its position, or nullptr if the ring-buffer is full.
+        cell *_claim_for_enqueue(std::size_t &pos) {
+            pos = _f.load(std::memory_order_relaxed);
+            if constexpr (CARDINALITY == CA_SPSC) {
+                if (pos - _b_cached >= _size) {
+                    _b_cached = _b.load(std::memory_order_acquire);
+                    if (pos - _b_cached >= _size)
+                        return nullptr;
+                }
+                return &_cells[pos & _Mask];
+            } else {
+                for (;;) {
+                    cell *c = &_cells[pos & _Mask];
+                    std::size_t seq = c->_seq.load(std::memory_order_acquire);
+                    auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+                    if (diff == 0) {
+                        if (_f.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                            return c;
+                    } else if (diff < 0) {
+                        return nullptr; // the slot has not been drained, so we're full
+                    } else {
+                        pos = _f.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+        }
+        // returns the claimed cell and its position, or nullptr if the ring-buffer is empty.
+        cell *_claim_for_dequeue(std::size_t &pos) {
+            pos = _b.load(std::memory_order_relaxed);
+            if constexpr (CARDINALITY == CA_SPSC) {
+                if (pos == _f_cached) {
+                    _f_cached = _f.load(std::memory_order_acquire);
+                    if (pos == _f_cached)
+                        return nullptr;
+                }
+                return &_cells[pos & _Mask];
+            } else if constexpr (CARDINALITY == CA_MPSC) {
+                cell *c = &_cells[pos & _Mask];
+                if (c->_seq.load(std::memory_order_acquire) != pos + 1)
+                    return nullptr; // the slot has not been published, so we're empty
+                return c;
+            } else {
+                for (;;) {
+                    cell *c = &_cells[pos & _Mask];
+                    std::size_t seq = c->_seq.load(std::memory_order_acquire);
+                    auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+                    if (diff == 0) {
+                        if (_b.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                            return c;
+                    } else if (diff < 0) {
+                        return nullptr; // the slot has not been published, so we're empty
+                    } else {
+                        pos = _b.load(std::memory_order_relaxed);
+                    }
                 }
             }
+        }
 
-            if constexpr (CANNOT_ENQUEUE == CE_DEFAULT)
-                return ret; // std::nullopt;
-            if constexpr (CANNOT_ENQUEUE == CE_BLOCKED_AND_SPIN) {
-                using namespace std::chrono_literals;
-                std::this_thread::yield();
-#if OS_LINUX
-                std::this_thread::sleep_for(1ns);
-#endif
-                goto _retry;
+        // claims up to n slots from the returned pos. Only the leading
+        // run of drained slots is taken, so one CAS covers the batch.
+        std::size_t _claim_bulk_for_enqueue(std::size_t &pos, std::size_t n) {
+            pos = _f.load(std::memory_order_relaxed);
+            if constexpr (CARDINALITY == CA_SPSC) {
+                if (_size - (pos - _b_cached) < n)
+                    _b_cached = _b.load(std::memory_order_acquire);
+                return std::min(n, _size - (pos - _b_cached));
+            } else {
+                for (;;) {
+                    std::size_t k = 0;
+                    while (k < n && _cells[(pos + k) & _Mask]._seq.load(std::memory_order_acquire) == pos + k)
+                        k++;
+                    if (k == 0) {
+                        std::size_t seq = _cells[pos & _Mask]._seq.load(std::memory_order_acquire);
+                        if (static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos) < 0)
+                            return 0; // full
+                        pos = _f.load(std::memory_order_relaxed);
+                    } else if (_f.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) {
+                        return k;
+                    }
+                }
+            }
+        }
+        // claims up to n published slots from the returned pos.
+        std::size_t _claim_bulk_for_dequeue(std::size_t &pos, std::size_t n) {
+            pos = _b.load(std::memory_order_relaxed);
+            if constexpr (CARDINALITY == CA_SPSC) {
+                if (_f_cached - pos < n)
+                    _f_cached = _f.load(std::memory_order_acquire);
+                return std::min(n, _f_cached - pos);
+            } else {
+                for (;;) {
+                    std::size_t k = 0;
+                    while (k < n && _cells[(pos + k) & _Mask]._seq.load(std::memory_order_acquire) == pos + k + 1)
+                        k++;
+                    if constexpr (CARDINALITY == CA_MPSC) {
+                        return k;
+                    } else {
+                        if (k == 0) {
+                            std::size_t seq = _cells[pos & _Mask]._seq.load(std::memory_order_acquire);
+                            if (static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1) < 0)
+                                return 0; // empty
+                            pos = _b.load(std::memory_order_relaxed);
+                        } else if (_b.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) {
+                            return k;
+                        }
+                    }
+                }
+            }
+        }
+        void _publish_bulk_enqueued(std::size_t pos, std::size_t k) {
+            if constexpr (CARDINALITY == CA_SPSC) {
+                _f.store(pos + k, std::memory_order_release);
+            } else {
+                for (std::size_t i = 0; i < k; i++)
+                    _cells[(pos + i) & _Mask]._seq.store(pos + i + 1, std::memory_order_release);
+            }
+        }
+        void _publish_bulk_dequeued(std::size_t pos, std::size_t k) {
+            if constexpr (CARDINALITY == CA_SPSC) {
+                _b.store(pos + k, std::memory_order_release);
+            } else {
+                for (std::size_t i = 0; i < k; i++)
+                    _cells[(pos + i) & _Mask]._seq.store(pos + i + _Mask + 1, std::memory_order_release);
+                if constexpr (CARDINALITY == CA_MPSC)
+                    _b.store(pos + k, std::memory_order_release);
+            }
+        }
+
+        void _publish_enqueued(cell *c, std::size_t pos) {
+            if constexpr (CARDINALITY == CA_SPSC) {
+                UNUSED(c);
+                _f.store(pos + 1, std::memory_order_release);
+            } else {
+                c->_seq.store(pos + 1, std::memory_order_release);
+            }
+        }
+        void _publish_dequeued(cell *c, std::size_t pos) {
+            if constexpr (CARDINALITY == CA_SPSC) {
+                UNUSED(c);
+                _b.store(pos + 1, std::memory_order_release);
+            } else {
+                c->_seq.store(pos + _Mask + 1, std::memory_order_release);
+                if constexpr (CARDINALITY == CA_MPSC)
+                    _b.store(pos + 1, std::memory_order_release);
             }
-#if !OS_WIN
-            return ret;
-#endif
         }
-        RESTORE_UNUSED_WARNINGS
 
     private:
         template<typename TI>
@@ -165,11 +552,19 @@ namespace hicc::ringbuf {
         }
 
     private:
-        std::vector<T> _coll;
+        std::unique_ptr<cell[]> _cells;
         alignas(cacheline_align_v)
-                std::atomic_size_t _f; // front ptr: the enqueue item will be put in here
+                std::atomic_size_t _f{0}; // front ptr: the enqueue item will be put in here
+        std::size_t _b_cached{0};         // SPSC only: the producer's view of _b
         alignas(cacheline_align_v)
-                std::atomic_size_t _b; // back ptr: the dequeue item will be pop from here
+                std::atomic_size_t _b{0}; // back ptr: the dequeue item will be pop from here
+        std::size_t _f_cached{0};         // SPSC only: the consumer's view of _f
+        // CE_BLOCKED_AND_PARK only: the parking lots for both sides.
+        alignas(cacheline_align_v) eventcount _not_empty{};
+        alignas(cacheline_align_v) eventcount _not_full{};
+        std::atomic_int _spin_budget{0};
+        static constexpr int spin_max = 4000;
+        static constexpr int yield_max = 8;
         alignas(cacheline_align_v)
                 std::size_t _size,
                 _Mask;
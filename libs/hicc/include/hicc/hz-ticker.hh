@@ -6,11 +6,14 @@
 #define HICC_CXX_TICKER_HH
 
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <ctime>
 
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <queue>         // for std::priority_queue
 #include <string>        // for std::string
 #include <tuple>         // for std::tuple
@@ -33,30 +36,45 @@ namespace hicc::chrono {
 
     using Clock = std::chrono::system_clock;
 
-    class timer_job {
+    /**
+     * @brief a job scheduled in a timer on Clock.
+     * @details A timer on std::chrono::steady_clock compares, sleeps
+     * and compensates in nanoseconds, and never jumps with the wall
+     * clock. See precise_timer and precise_ticker.
+     * 
+     * A job is owned by std::shared_ptr. Each launch shares the
+     * ownership with the pool task, so a fired job lives till its run
+     * completes, and no longer.
+     */
+    template<typename Clock = Clock>
+    class basic_timer_job : public std::enable_shared_from_this<basic_timer_job<Clock>> {
     public:
-        explicit timer_job(std::function<void()> &&f, bool recur = false, bool interval = false)
+        explicit basic_timer_job(std::function<void()> &&f, bool recur = false, bool interval = false)
             : _recur(recur)
             , _interval(interval)
             , _f(std::move(f))
             , _hit(0) {}
-        virtual ~timer_job() {}
-        Clock::time_point next_time_point() const { return next_time_point(Clock::now()); }
-        virtual Clock::time_point next_time_point(Clock::time_point const now) const = 0;
+        virtual ~basic_timer_job() {}
+        typename Clock::time_point next_time_point() const { return next_time_point(Clock::now()); }
+        virtual typename Clock::time_point next_time_point(typename Clock::time_point const now) const = 0;
 
-        void launch_to(pool::thread_pool &p, std::function<void(timer_job *tj)> const &post_job = nullptr) {
-            launch_fn_to_pool(_f, p, post_job);
+        void launch_to(pool::thread_pool &p, std::function<void(basic_timer_job *tj)> const &post_job = nullptr) {
+            launch_fn_to_pool(p, post_job);
         }
 
         std::size_t hits() const { return _hit; }
         void operator()() { _f(); }
 
     private:
-        void launch_fn_to_pool(std::function<void()> const &fn, pool::thread_pool &pool, std::function<void(timer_job *tj)> const &post_job = nullptr) {
-            pool.queue_task([=]() {
-                fn();
-                if (post_job)
-                    post_job(this);
+        void launch_fn_to_pool(pool::thread_pool &pool, std::function<void(basic_timer_job *tj)> const &post_job = nullptr) {
+            pool.post([self = this->shared_from_this(), post_job]() {
+                // an exception ends the run quietly, as the dropped future of queue_task() did.
+                try {
+                    self->_f();
+                    if (post_job)
+                        post_job(self.get());
+                } catch (...) {
+                }
             });
 #if defined(_DEBUG) || HICC_TEST_THREAD_POOL_DBGOUT
             if ((_hit % 10) == 0)
@@ -73,15 +91,17 @@ namespace hicc::chrono {
     protected:
         std::function<void()> _f;
         std::size_t _hit;
-    };
+    }; // class basic_timer_job
+
+    using timer_job = basic_timer_job<Clock>;
 
     namespace detail {
 
         template<typename Clock = Clock, bool GMT = false>
-        class in_job : public timer_job {
+        class in_job : public basic_timer_job<Clock> {
         public:
             explicit in_job(std::function<void()> &&f)
-                : timer_job(std::move(f)) {}
+                : basic_timer_job<Clock>(std::move(f)) {}
             virtual ~in_job() {}
 
             using time_point = typename Clock::time_point;
@@ -90,17 +110,17 @@ namespace hicc::chrono {
         };
 
         template<typename Clock = Clock, bool GMT = false>
-        class every_job : public timer_job {
+        class every_job : public basic_timer_job<Clock> {
         public:
             explicit every_job(typename Clock::duration d, std::function<void()> &&f, bool interval = false)
-                : timer_job(std::move(f), true, interval)
+                : basic_timer_job<Clock>(std::move(f), true, interval)
                 , dur(d) {}
             virtual ~every_job() {}
 
             typename Clock::time_point next_time_point(typename Clock::time_point const now) const override {
 #if defined(_DEBUG) || HICC_TEST_THREAD_POOL_DBGOUT
                 auto nxt = now + dur;
-                pool_debug("         %s -> %s", format_time_point(now).c_str(), format_time_point(nxt).c_str());
+                pool_debug("         now + %s", format_duration(dur).c_str()); // Clock may have no to_time_t()
                 return nxt;
 #else
                 return now + dur;
@@ -151,10 +171,10 @@ namespace hicc::chrono {
     namespace detail {
 
         template<typename Clock = std::chrono::system_clock, bool GMT = false>
-        class periodical_job : public timer_job {
+        class periodical_job : public basic_timer_job<Clock> {
         public:
             explicit periodical_job(anchors anchor_, int ordinal_, int offset_, int times_, std::function<void()> &&f, bool interval = false)
-                : timer_job(std::move(f), true, interval)
+                : basic_timer_job<Clock>(std::move(f), true, interval)
                 , last_pt(Clock::now())
                 , anchor(anchor_)
                 , ordinal(ordinal_)
@@ -428,6 +448,351 @@ namespace hicc::chrono {
     } // namespace detail
 
 
+    // ordered_wheel, hashed_wheel: the TimingWheel policies of timer
+
+    namespace detail {
+
+        /**
+         * @brief the default TimingWheel policy of timer: a sorted map
+         * from time-point to the jobs due at it.
+         * @details Insertion, cancellation and expiry cost O(log n).
+         * 
+         * A TimingWheel policy provides:
+         * - `add(tp, job)`: schedules a job, returns the pending count.
+         * - `remove(tp, job)`: cancels a job added at tp.
+         * - `pop_expired(now, out, picked)`: moves the due jobs to out,
+         *   sets picked to the latest due time-point.
+         * - `next_due(tp)`: the earliest time-point to check again.
+         * - `size()`, `empty()`.
+         * 
+         * Every method is called under the lock of the timer.
+         */
+        template<typename Clock = Clock>
+        class ordered_wheel {
+        public:
+            using time_point = typename Clock::time_point;
+            using Job = basic_timer_job<Clock>;
+            using _J = std::shared_ptr<Job>;
+            using Jobs = std::vector<_J>;
+
+            std::size_t add(time_point const &tp, _J &&job) {
+                _map[tp].emplace_back(std::move(job));
+                return _map.size();
+            }
+            bool remove(time_point const &tp, _J const &job) {
+                auto it = _map.find(tp);
+                if (it == _map.end())
+                    return false;
+                auto &coll = (*it).second;
+                auto size = coll.size();
+                coll.erase(std::remove(coll.begin(), coll.end(), job), coll.end());
+                bool removed = coll.size() != size;
+                if (coll.empty())
+                    _map.erase(it);
+                return removed;
+            }
+            bool pop_expired(time_point const &now, Jobs &out, time_point &picked) {
+                auto it = _map.begin();
+                for (; it != _map.end() && (*it).first <= now; ++it) {
+                    picked = (*it).first;
+                    for (auto &j : (*it).second)
+                        out.emplace_back(std::move(j));
+                }
+                bool found = it != _map.begin();
+                _map.erase(_map.begin(), it);
+                return found;
+            }
+            bool next_due(time_point &tp) const {
+                if (_map.empty())
+                    return false;
+                tp = (*_map.begin()).first;
+                return true;
+            }
+            std::size_t size() const { return _map.size(); }
+            bool empty() const { return _map.empty(); }
+
+        private:
+            std::map<time_point, Jobs> _map{};
+        }; // class ordered_wheel
+
+        /**
+         * @brief a hashed hierarchical timing wheel, the TimingWheel
+         * policy for lots of pending timeouts (such as per-connection
+         * idle timers).
+         * 
+         * @details Time is cut into ticks. Level 0 has 2^slot_bits slots
+         * of one tick each, and every upper level has as many slots, each
+         * one a whole round of the level below. A job lands at the lowest
+         * level its delay fits in, and cascades down a level when the
+         * wheel below wraps around. Insertion and cancellation are O(1),
+         * expiry is amortized O(1) per job. A job fires at the first tick
+         * boundary at or after its time-point, so it's never early and
+         * at most one tick late.
+         * 
+         * Delays beyond the range of the top level (2^(levels*slot_bits)
+         * ticks, 49 days by default) are parked at its far end and
+         * re-cascaded from there.
+         * 
+         * To configure the tick and the levels, derive a policy:
+         * @code{c++}
+         * template<typename Clock>
+         * struct coarse_wheel : hicc::chrono::detail::hashed_wheel<Clock> {
+         *     coarse_wheel() : hicc::chrono::detail::hashed_wheel<Clock>(std::chrono::milliseconds(10), 3) {}
+         * };
+         * @endcode
+         */
+        template<typename Clock = Clock>
+        class hashed_wheel {
+        public:
+            using time_point = typename Clock::time_point;
+            using duration = typename Clock::duration;
+            using Job = basic_timer_job<Clock>;
+            using _J = std::shared_ptr<Job>;
+            using Jobs = std::vector<_J>;
+            static constexpr std::uint32_t npos = ~std::uint32_t(0);
+
+            // returned by schedule(), for an O(1) cancel().
+            struct handle {
+                std::uint32_t index{npos};
+                std::uint32_t gen{0};
+            };
+
+            explicit hashed_wheel(duration tick = std::chrono::milliseconds(1), unsigned levels = 4, unsigned slot_bits = 8, time_point origin = Clock::now())
+                : _tick(tick > duration::zero() ? tick : duration(1))
+                , _bits(std::clamp(slot_bits, 1u, 16u))
+                , _levels(std::clamp(levels, 1u, 63u / _bits))
+                , _mask((std::uint64_t(1) << _bits) - 1)
+                , _range(std::uint64_t(1) << (_bits * _levels))
+                , _origin(origin)
+                , _heads(std::size_t(_levels) << _bits, npos)
+                , _occupied(((std::size_t(_levels) << _bits) + 63) / 64, 0) {}
+
+            handle schedule(time_point const &tp, _J &&job) {
+                std::uint32_t i = _alloc();
+                node &n = _nodes[i];
+                n.expire = std::max(_tick_of(tp, true), _cur);
+                n.job = std::move(job);
+                _link(i);
+                ++_count;
+                return {i, n.gen};
+            }
+            bool cancel(handle h) {
+                if (h.index >= _nodes.size() || _nodes[h.index].gen != h.gen || !_nodes[h.index].job)
+                    return false;
+                _unlink(h.index);
+                _release(h.index);
+                --_count;
+                return true;
+            }
+
+            std::size_t add(time_point const &tp, _J &&job) {
+                schedule(tp, std::move(job));
+                return _count;
+            }
+            // the slot of a job at every level is known from its expiry,
+            // so this looks at one slot per level only. Still a slot may
+            // hold many jobs, cancel() by the handle is O(1) always.
+            bool remove(time_point const &tp, _J const &job) {
+                std::uint64_t expire = std::max(_tick_of(tp, true), _cur);
+                for (unsigned level = 0; level < _levels; level++) {
+                    if (_remove_from(_slot(level, expire), job))
+                        return true;
+                }
+                // a far one parked by _link()
+                for (std::size_t s = std::size_t(_levels - 1) << _bits; s < _heads.size(); s++) {
+                    if (_remove_from(s, job))
+                        return true;
+                }
+                return false;
+            }
+            bool pop_expired(time_point const &now, Jobs &out, time_point &picked) {
+                std::uint64_t target = _tick_of(now, false);
+                std::size_t before = out.size();
+                std::uint64_t last{0};
+                while (_cur <= target) {
+                    if (_count == 0) {
+                        _cur = target + 1;
+                        break;
+                    }
+                    std::uint64_t slot0 = _cur & _mask;
+                    if (slot0 == 0)
+                        _cascade();
+                    std::uint64_t busy = _next_busy0(slot0);
+                    if (busy != slot0) {
+                        // skip the empty slots, up to the next cascading at most
+                        _cur += std::min(busy - slot0, target + 1 - _cur);
+                        continue;
+                    }
+                    _drain(std::size_t(slot0), out);
+                    last = _cur++;
+                }
+                if (out.size() == before)
+                    return false;
+                picked = _time_of(last);
+                return true;
+            }
+            // the next busy tick of level 0, or the next cascading.
+            bool next_due(time_point &tp) const {
+                if (_count == 0)
+                    return false;
+                std::uint64_t slot0 = _cur & _mask;
+                std::uint64_t busy = _next_busy0(slot0);
+                tp = _time_of(_cur - slot0 + busy);
+                return true;
+            }
+            std::size_t size() const { return _count; }
+            bool empty() const { return _count == 0; }
+            duration tick() const { return _tick; }
+
+        private:
+            struct node {
+                std::uint64_t expire{0}; // in ticks since _origin
+                _J job{};
+                std::uint32_t prev{npos}, next{npos};
+                std::uint32_t slot{npos}, gen{0};
+            };
+
+            std::uint64_t _tick_of(time_point const &tp, bool ceil) const {
+                auto d = tp - _origin;
+                if (d <= duration::zero())
+                    return 0;
+                auto t = std::uint64_t(d / _tick);
+                if (ceil && (d % _tick) != duration::zero())
+                    ++t;
+                return t;
+            }
+            time_point _time_of(std::uint64_t t) const {
+                return _origin + _tick * static_cast<typename duration::rep>(t);
+            }
+            std::size_t _slot(unsigned level, std::uint64_t expire) const {
+                return (std::size_t(level) << _bits) | std::size_t((expire >> (_bits * level)) & _mask);
+            }
+
+            std::uint32_t _alloc() {
+                if (_free != npos) {
+                    std::uint32_t i = _free;
+                    _free = _nodes[i].next;
+                    return i;
+                }
+                _nodes.emplace_back();
+                return std::uint32_t(_nodes.size() - 1);
+            }
+            void _release(std::uint32_t i) {
+                node &n = _nodes[i];
+                n.job.reset();
+                n.gen++;
+                n.slot = n.prev = npos;
+                n.next = _free;
+                _free = i;
+            }
+
+            void _link(std::uint32_t i) {
+                node &n = _nodes[i];
+                std::uint64_t delta = n.expire - _cur, at = n.expire;
+                unsigned level = 0;
+                while (level + 1 < _levels && delta >= (std::uint64_t(1) << (_bits * (level + 1))))
+                    level++;
+                if (delta >= _range)
+                    at = _cur + _range - 1;
+                std::size_t s = _slot(level, at);
+                n.slot = std::uint32_t(s);
+                n.prev = npos;
+                n.next = _heads[s];
+                if (n.next != npos)
+                    _nodes[n.next].prev = i;
+                _heads[s] = i;
+                _occupied[s / 64] |= std::uint64_t(1) << (s % 64);
+            }
+            void _unlink(std::uint32_t i) {
+                node &n = _nodes[i];
+                if (n.prev != npos)
+                    _nodes[n.prev].next = n.next;
+                else
+                    _heads[n.slot] = n.next;
+                if (n.next != npos)
+                    _nodes[n.next].prev = n.prev;
+                if (_heads[n.slot] == npos)
+                    _occupied[n.slot / 64] &= ~(std::uint64_t(1) << (n.slot % 64));
+            }
+            std::uint32_t _detach(std::size_t s) {
+                std::uint32_t i = _heads[s];
+                _heads[s] = npos;
+                _occupied[s / 64] &= ~(std::uint64_t(1) << (s % 64));
+                return i;
+            }
+            bool _remove_from(std::size_t s, _J const &job) {
+                for (std::uint32_t i = _heads[s]; i != npos; i = _nodes[i].next) {
+                    if (_nodes[i].job == job) {
+                        _unlink(i);
+                        _release(i);
+                        --_count;
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            // level 0 wrapped around: brings the current slot of each
+            // upper level down, as long as the level below wrapped too.
+            void _cascade() {
+                for (unsigned level = 1; level < _levels; level++) {
+                    std::size_t s = _slot(level, _cur);
+                    for (std::uint32_t i = _detach(s); i != npos;) {
+                        std::uint32_t next = _nodes[i].next;
+                        _link(i);
+                        i = next;
+                    }
+                    if ((s & _mask) != 0)
+                        break;
+                }
+            }
+            void _drain(std::size_t s, Jobs &out) {
+                for (std::uint32_t i = _detach(s); i != npos;) {
+                    std::uint32_t next = _nodes[i].next;
+                    out.emplace_back(std::move(_nodes[i].job));
+                    _release(i);
+                    --_count;
+                    i = next;
+                }
+            }
+            // the first busy slot of level 0 in [from, mask], or mask + 1.
+            std::uint64_t _next_busy0(std::uint64_t from) const {
+                for (std::uint64_t s = from; s <= _mask;) {
+                    std::uint64_t word = _occupied[s / 64] >> (s % 64);
+                    if (_mask < 63)
+                        word &= (std::uint64_t(1) << (_mask + 1 - s)) - 1;
+                    if (word != 0)
+                        return s + _ctz(word);
+                    s = (s / 64 + 1) * 64;
+                }
+                return _mask + 1;
+            }
+            static unsigned _ctz(std::uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+                return unsigned(__builtin_ctzll(v));
+#else
+                unsigned n = 0;
+                for (; (v & 1) == 0; v >>= 1) n++;
+                return n;
+#endif
+            }
+
+        private:
+            duration _tick;
+            unsigned _bits, _levels;
+            std::uint64_t _mask, _range;
+            time_point _origin;
+            std::uint64_t _cur{0}; // the next tick to process
+            std::size_t _count{0};
+            std::vector<node> _nodes{};
+            std::uint32_t _free{npos};
+            std::vector<std::uint32_t> _heads;    // (level << bits | slot) -> the first node
+            std::vector<std::uint64_t> _occupied; // a bit for each non-empty slot
+        }; // class hashed_wheel
+
+    } // namespace detail
+
+
     //
 
 
@@ -475,6 +840,8 @@ namespace hicc::chrono {
     /**
      * @brief timer provides the standard Timer interface.
      * @tparam Clock 
+     * @tparam TimingWheelT keeps the pending jobs, detail::ordered_wheel
+     * or detail::hashed_wheel.
      * @details We assume a standard Timer interface will be represented as:
      * 
      * ### A
@@ -483,7 +850,7 @@ namespace hicc::chrono {
      * 
      * 
      */
-    template<typename DerivedT = std::nullopt_t, typename Clock = Clock, bool GMT = false, typename ConcreteJob = detail::in_job<Clock, GMT>>
+    template<typename DerivedT = std::nullopt_t, typename Clock = Clock, bool GMT = false, typename ConcreteJob = detail::in_job<Clock, GMT>, typename TimingWheelT = detail::ordered_wheel<Clock>>
     class timer : public base<typename std::conditional<std::is_same_v<std::nullopt_t, DerivedT>, timer<DerivedT, Clock, GMT, ConcreteJob>, DerivedT>::type> {
         // public:
         //     class posix_ticker {
@@ -491,15 +858,15 @@ namespace hicc::chrono {
         //     }; // class posix_ticker
 
     public:
-        using _This = timer<DerivedT, Clock, GMT, ConcreteJob>;
+        using _This = timer<DerivedT, Clock, GMT, ConcreteJob, TimingWheelT>;
         using super = base<typename std::conditional<std::is_same_v<std::nullopt_t, DerivedT>, _This, DerivedT>::type>;
         using base_t = super;
-        using Job = timer_job;
+        using Job = basic_timer_job<Clock>;
         using _J = std::shared_ptr<Job>;
         using _C = Clock;
         using TP = std::chrono::time_point<_C>;
         using Jobs = std::vector<_J>;
-        using TimingWheel = std::map<TP, Jobs>;
+        using TimingWheel = TimingWheelT;
 
     protected:
         timer()
@@ -512,7 +879,6 @@ namespace hicc::chrono {
             __COPY(_f);
             // __COPY(_tk);
             __COPY(_twl);
-            __COPY(_pasts);
             // __COPY(_l_twl);
             // __COPY(_pool);
             // __COPY(_started);
@@ -595,8 +961,14 @@ namespace hicc::chrono {
     private:
         void stop() {
             dbg_debug("[runner] stopping...");
-            _t.detach();
+            if (_t.joinable()) // clear() may have stopped it already
+                _t.detach();
             _tk.kill();
+            {
+                std::unique_lock<std::mutex> l(_l_twl);
+                _woken = true;
+            }
+            _cv_twl.notify_all();
             // if (_t.joinable()) _t.join();
             _ended.wait();
             dbg_debug("[runner] stopped.");
@@ -614,143 +986,119 @@ namespace hicc::chrono {
 
         static void runner(timer *_this) { _this->runner_loop(); }
         void runner_loop() {
-            bool ret;
             using namespace std::literals::chrono_literals;
             const auto starting_gap = 10ns;
             std::chrono::nanoseconds d = starting_gap;
 #if defined(_DEBUG) || HICC_TEST_THREAD_POOL_DBGOUT
-            std::size_t hit{0}, loop{0};
+            std::size_t hit{0};
 #endif
             _started.set();
             dbg_trace("[runner] ready...");
-            while ((ret = _tk.wait_for(d)) != _tk.ConditionMatched) {
-                // std::this_thread::sleep_for(d);
-                dbg_debug("[runner] waked up. (_tk.terminated() == %d, ret=%d)", _tk.terminated(), ret);
-                d = _larger_gap;
-
-                TP picked;
-                Jobs jobs, recurred_jobs;
-                {
-                    auto [itp, itn, found] = find_next();
-                    if (!found) {
-                        dbg_debug("[runner] find_next() returned not found");
-                        continue;
-                    }
-
-                    dbg_debug("[runner] found a time-point");
-                    // got a picked point
-                    std::unique_lock<std::mutex> l(_l_twl);
-                    (*itp).second.swap(jobs);
-                    picked = (*itp).first;
-
-                    // erase all expired jobs
-                    _twl.erase(_twl.begin(), itp);
-
-                    if (itn != _twl.end()) {
-                        auto next_tp = (*itn).first;
-                        d = (next_tp - picked);
-                        if (d > _wastage)
-                            d -= _wastage;
-#if defined(_DEBUG) || HICC_TEST_THREAD_POOL_DBGOUT
-                        if ((hit % 10) == 0)
-                            pool_debug("[runner] [size: %u, hit: %u, loop: %u] picked = %s, next_tp = %s, duration = %s",
-                                       _twl.size(), hit, loop,
-                                       chrono::format_time_point(picked).c_str(),
-                                       chrono::format_time_point(next_tp).c_str(),
-                                       chrono::format_duration(d).c_str());
-                        hit++;
-#endif
-                    }
+            std::unique_lock<std::mutex> l(_l_twl);
+            while (!_tk.terminated()) {
+                // sleep till the next due job, or till add_task() brings an earlier one
+                auto planned = Clock::now() + d;
+                _wake_at = planned, _woken = false;
+                _cv_twl.wait_for(l, d, [this] { return _woken; });
+                if (_tk.terminated())
+                    break;
+
+                auto time_now = Clock::now();
+                if (!_woken && d > 0ns)
+                    learn_wastage(time_now - planned);
+                _wake_at = TP::max();
+
+                // woken early by _wastage on purpose, yield the last stretch away rather than oversleep it again
+                TP next_tp;
+                if (_twl.next_due(next_tp) && next_tp > time_now && next_tp - time_now <= _wastage) {
+                    l.unlock();
+                    while ((time_now = Clock::now()) < next_tp)
+                        std::this_thread::yield();
+                    l.lock();
                 }
 
-                // launch the jobs
-                for (auto it = jobs.begin(); it != jobs.end(); ++it) {
-                    std::shared_ptr<Job> &j = (*it);
-                    if (j->_interval) {
-                        // pool_debug("[runner] job starting, _interval");
-                        j->launch_to(_pool, [&](timer_job *tj) {
-                            add_task(tj->next_time_point(), std::move(j));
-                        });
-                    } else if (j->_recur) {
-                        // pool_debug("[runner] job starting, _recur");
-                        j->launch_to(_pool);
-                        recurred_jobs.emplace_back(std::move(j));
-                    } else {
-                        // pool_debug("[runner] job starting");
-                        j->launch_to(_pool);
-                    }
+                TP picked;
+                Jobs jobs;
+                if (_twl.pop_expired(time_now, jobs, picked)) {
+                    // dbg_debug("[runner] found a time-point");
+                    l.unlock();
+                    launch(jobs);
+                    l.lock();
                 }
 
-                // hold all past jobs to avoid heap-use-after-free sanitization
-                _pasts.emplace(picked, std::move(jobs));
-
-                for (auto &j : recurred_jobs) {
-                    auto tp = j->next_time_point();
+                d = next_sleep();
 #if defined(_DEBUG) || HICC_TEST_THREAD_POOL_DBGOUT
-                    auto dur = ((detail::every_job<Clock, GMT> *) j.get())->dur;
-                    auto size = add_task(tp, std::move(j));
-                    if ((loop % 10) == 0)
-                        pool_debug("[runner] [size: %u, hit: %u, loop: %u] _recur job/%d added: %s, dur = %s, d = %s",
-                                   size, hit, loop, recurred_jobs.size(),
-                                   chrono::format_time_point(tp).c_str(),
-                                   chrono::format_duration(dur).c_str(),
-                                   chrono::format_duration(d).c_str());
-                    UNUSED(size, dur);
-                    loop++;
-#else
-                    add_task(tp, std::move(j));
+                if ((hit++ % 10) == 0)
+                    pool_debug("[runner] [size: %u, hit: %u] duration = %s, wastage = %s",
+                               _twl.size(), hit,
+                               chrono::format_duration(d).c_str(),
+                               chrono::format_duration(_wastage).c_str());
 #endif
-                    d = tp - now();
-                    if (d > _wastage)
-                        d -= _wastage;
-                }
             }
-            dbg_debug("[runner] timer::runner ended (_tk.terminated() == %d, ret = %d).", _tk.terminated(), ret);
+            l.unlock();
+            dbg_debug("[runner] timer::runner ended (_tk.terminated() == %d).", _tk.terminated());
             _ended.set();
         }
-        std::tuple<typename TimingWheel::iterator, typename TimingWheel::iterator, bool>
-        find_next() {
-            auto time_now = Clock::to_time_t(Clock::now());
-            bool found{};
-
-            std::unique_lock<std::mutex> l(_l_twl);
-
-            typename TimingWheel::iterator itn = _twl.end();
-            typename TimingWheel::iterator itp = itn;
-
-            for (auto it = _twl.begin(); it != itn; ++it) {
-                auto &tp = (*it).first;
-                auto tmp = Clock::to_time_t(tp);
-                if (tmp > time_now) break;
-                itp = it, found = true;
-                continue;
+        void launch(Jobs &jobs) {
+            Jobs recurred_jobs;
+            for (auto it = jobs.begin(); it != jobs.end(); ++it) {
+                std::shared_ptr<Job> &j = (*it);
+                if (j->_interval) {
+                    // pool_debug("[runner] job starting, _interval");
+                    j->launch_to(_pool, [this](Job *tj) {
+                        add_task(tj->next_time_point(), tj->shared_from_this());
+                    });
+                } else if (j->_recur) {
+                    // pool_debug("[runner] job starting, _recur");
+                    j->launch_to(_pool);
+                    recurred_jobs.emplace_back(std::move(j));
+                } else {
+                    // pool_debug("[runner] job starting");
+                    j->launch_to(_pool);
+                }
             }
 
-            if (found) {
-                itn = itp;
-                itn++;
+            for (auto &j : recurred_jobs) {
+                auto tp = j->next_time_point();
+                add_task(tp, std::move(j));
             }
-            return {itp, itn, found};
+        }
+        // how long to sleep till the next due job, less the usual
+        // oversleeping, in nanoseconds. Under the lock.
+        std::chrono::nanoseconds next_sleep() const {
+            TP next_tp;
+            if (!_twl.next_due(next_tp))
+                return _larger_gap;
+            std::chrono::nanoseconds d = std::chrono::duration_cast<std::chrono::nanoseconds>(next_tp - Clock::now());
+            if (d > _larger_gap)
+                d = _larger_gap;
+            if (d > _wastage)
+                d -= _wastage;
+            return d;
+        }
+        // _wastage follows how late the timed waits woke up (a moving
+        // average, ignoring the hiccups over 1ms).
+        void learn_wastage(typename Clock::duration late) {
+            using namespace std::literals::chrono_literals;
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(late);
+            if (ns < 0ns || ns > 1ms)
+                return;
+            _wastage += (ns - _wastage) / 8;
         }
 
     protected:
         std::size_t add_task(TP const &tp, std::shared_ptr<Job> &&task) {
             std::size_t size;
+            bool wake;
             {
                 std::unique_lock<std::mutex> l(_l_twl);
-                auto it = _twl.find(tp);
-                if (it == _twl.end()) {
-                    Jobs coll;
-                    coll.emplace_back(std::move(task));
-                    _twl.emplace(tp, std::move(coll));
-                    pool_debug("add_task, tp not found. pool.size=%lu", _twl.size());
-                } else {
-                    auto &coll = (*it).second;
-                    coll.emplace_back(std::move(task));
-                    pool_debug("add_task, tp found. pool.size=%lu", _twl.size());
-                }
-                size = _twl.size();
+                size = _twl.add(tp, std::move(task));
+                pool_debug("add_task. pool.size=%lu", size);
+                if ((wake = tp < _wake_at))
+                    _wake_at = tp, _woken = true;
             }
+            if (wake)
+                _cv_twl.notify_one();
             std::this_thread::yield();
             return size;
         }
@@ -758,12 +1106,7 @@ namespace hicc::chrono {
             std::size_t size;
             {
                 std::unique_lock<std::mutex> l(_l_twl);
-
-                auto it = _twl.find(tp);
-                if (it != _twl.end()) {
-                    auto &coll = (*it).second;
-                    coll.erase(std::remove(coll.begin(), coll.end(), task), coll.end());
-                }
+                _twl.remove(tp, task);
                 size = _twl.size();
             }
             std::this_thread::yield();
@@ -778,12 +1121,14 @@ namespace hicc::chrono {
         std::thread _t;
         pool::timer_killer _tk{}; // to shut down the sleep+loop in `runner` thread gracefully
         TimingWheel _twl{};
-        TimingWheel _pasts{};
         std::mutex _l_twl{};
+        std::condition_variable _cv_twl{}; // wakes the runner up for an earlier job, or to stop
+        TP _wake_at{TP::max()};            // when the runner is going to wake up
+        bool _woken{false};
         pool::thread_pool _pool;
         pool::conditional_wait_for_bool _started{}, _ended{};                   // runner thread terminated.
         std::chrono::nanoseconds _larger_gap = std::chrono::milliseconds(3000); // = 3s
-        std::chrono::nanoseconds _wastage = std::chrono::milliseconds(0);
+        std::chrono::nanoseconds _wastage = std::chrono::milliseconds(0); // the oversleeping of the runner, learnt
     }; // class timer
 
     /**
@@ -791,8 +1136,8 @@ namespace hicc::chrono {
      * 
      * @par inspired by [https://github.com/Bosma/Scheduler](https://github.com/Bosma/Scheduler) and <https://github.com/jmettraux/rufus-scheduler>.
      */
-    template<typename DerivedT = std::nullopt_t, typename Clock = Clock, bool GMT = false, typename ConcreteJob = detail::every_job<Clock, GMT>>
-    class ticker : public timer<typename std::conditional<std::is_same_v<std::nullopt_t, DerivedT>, ticker<DerivedT, Clock, GMT, ConcreteJob>, DerivedT>::type, Clock, GMT, ConcreteJob> {
+    template<typename DerivedT = std::nullopt_t, typename Clock = Clock, bool GMT = false, typename ConcreteJob = detail::every_job<Clock, GMT>, typename TimingWheelT = detail::ordered_wheel<Clock>>
+    class ticker : public timer<typename std::conditional<std::is_same_v<std::nullopt_t, DerivedT>, ticker<DerivedT, Clock, GMT, ConcreteJob, TimingWheelT>, DerivedT>::type, Clock, GMT, ConcreteJob, TimingWheelT> {
     public:
         ticker(ticker const &o) {
             __copy(o);
@@ -801,8 +1146,8 @@ namespace hicc::chrono {
             __copy(o);
         }
         ~ticker() {}
-        using _This = ticker<DerivedT, Clock, GMT, ConcreteJob>;
-        using super = timer<typename std::conditional<std::is_same_v<std::nullopt_t, DerivedT>, _This, DerivedT>::type, Clock, GMT, ConcreteJob>;
+        using _This = ticker<DerivedT, Clock, GMT, ConcreteJob, TimingWheelT>;
+        using super = timer<typename std::conditional<std::is_same_v<std::nullopt_t, DerivedT>, _This, DerivedT>::type, Clock, GMT, ConcreteJob, TimingWheelT>;
         using base_t = typename super::base_t;
         // struct __W : public ticker<Clock, GMT, ConcreteJob> {
         //     __W() = default;
@@ -829,7 +1174,7 @@ namespace hicc::chrono {
             auto copy_fn = super::_f;
             std::shared_ptr<typename super::Job> t = std::make_shared<ConcreteJob>(_dur, std::move(copy_fn));
             auto next_time = t->next_time_point();
-            dbg_debug("next_time: %s", format_time_point(next_time).c_str());
+            dbg_debug("next_time: in %s", format_duration(next_time - Clock::now()).c_str());
             if (_interval)
                 super::add_task(Clock::now(), std::move(t));
             else
@@ -855,9 +1200,17 @@ namespace hicc::chrono {
         bool _interval{false};
     }; // class ticker
 
+    /**
+     * @brief the timer and ticker on std::chrono::steady_clock: the expiry
+     * checks, the sleeps and the compensation of oversleeping are all
+     * done in nanoseconds, and the wall clock may jump freely.
+     */
+    using precise_timer = timer<std::nullopt_t, std::chrono::steady_clock>;
+    using precise_ticker = ticker<std::nullopt_t, std::chrono::steady_clock>;
+
 
-    template<typename DerivedT = std::nullopt_t, typename Clock = Clock, bool GMT = false, typename ConcreteJob = detail::periodical_job<Clock, GMT>>
-    class alarmer : public ticker<typename std::conditional<std::is_same_v<std::nullopt_t, DerivedT>, alarmer<DerivedT, Clock, GMT, ConcreteJob>, DerivedT>::type, Clock, GMT, ConcreteJob> {
+    template<typename DerivedT = std::nullopt_t, typename Clock = Clock, bool GMT = false, typename ConcreteJob = detail::periodical_job<Clock, GMT>, typename TimingWheelT = detail::ordered_wheel<Clock>>
+    class alarmer : public ticker<typename std::conditional<std::is_same_v<std::nullopt_t, DerivedT>, alarmer<DerivedT, Clock, GMT, ConcreteJob, TimingWheelT>, DerivedT>::type, Clock, GMT, ConcreteJob, TimingWheelT> {
     public:
         alarmer(alarmer const &o) {
             __copy(o);
@@ -866,8 +1219,8 @@ namespace hicc::chrono {
             __copy(o);
         }
         ~alarmer() {}
-        using _This = alarmer<DerivedT, Clock, GMT, ConcreteJob>;
-        using super = ticker<typename std::conditional<std::is_same_v<std::nullopt_t, DerivedT>, _This, DerivedT>::type, Clock, GMT, ConcreteJob>;
+        using _This = alarmer<DerivedT, Clock, GMT, ConcreteJob, TimingWheelT>;
+        using super = ticker<typename std::conditional<std::is_same_v<std::nullopt_t, DerivedT>, _This, DerivedT>::type, Clock, GMT, ConcreteJob, TimingWheelT>;
         using base_t = typename super::base_t;
 
         // struct __W : public alarmer<Clock> {
@@ -889,7 +1242,7 @@ namespace hicc::chrono {
         void build() {
             std::shared_ptr<typename super::Job> t = std::make_shared<ConcreteJob>(_anchor, _ordinal, _offset, _times, std::move(super::_f));
             auto next_time = t->next_time_point();
-            dbg_debug("anchor: %d, count: %d, next_time: %s", _anchor, _ordinal, format_time_point(next_time).c_str());
+            dbg_debug("anchor: %d, count: %d, next_time: in %s", _anchor, _ordinal, format_duration(next_time - Clock::now()).c_str());
             super::add_task(next_time, std::move(t));
         }
 
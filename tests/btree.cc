@@ -2,8 +2,12 @@
 // Created by Hedzr Yeh on 2021/3/1.
 //
 
+#define HICC_TEST_BTREE_DBGOUT 0
+
+#include "hicc/hz-btree-mmap.hh"
 #include "hicc/hz-btree.hh"
 #include "hicc/hz-chrono.hh"
+#include "hicc/hz-pool.hh"
 
 #include <cstdio>
 #include <iomanip>
@@ -12,19 +16,30 @@
 #include <cstdlib>
 #include <ctime>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
 #include <fstream>
+#include <iterator>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <random>
+#include <set>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
 
 
 void n_test_btree() {
 
     auto source = {9, 11, 2, 7, 3, 5, 13, 17,
-#if 0
-// TODO btree not work
                    19, -19, 19, 21, 6, 8, 12, 29, 31, 18, 20, 16, 14, 15, -15, 15, 1, -1, 1, 10, 33, 47, 28, 55, 56, 66, 78, 88, 89, 69, -69, 69
-#endif
     };
 
     hicc::chrono::high_res_duration hrd([](auto duration) -> bool {
@@ -32,7 +47,7 @@ void n_test_btree() {
         return false;
     });
 
-    using btree = hicc::btree::btree<int, std::less<int>>;
+    using btree = hicc::btree::btree<int, 4>;
     btree bt;
     // bt.dot_prefix("tree");
     for (auto const &v : source) {
@@ -52,6 +67,7 @@ void n_test_btree() {
         }
         // NO_ASSERTIONS_ONLY(bt.dbg_dump());
     }
+    bt.assert_it();
 #if 0 //TODO
     assert(bt.exists(11));
     auto [ok, node, idx] = bt.find(11);
@@ -85,7 +101,7 @@ void n_test_btree_rand(int count = 100 * 1000) {
 
     std::srand((unsigned int) std::time(nullptr)); // use current time as seed for random generator
 
-    using btree = hicc::btree::btree<int, std::less<int>>;
+    using btree = hicc::btree::btree<int, 4>;
     std::vector<int> series;
     btree bt;
     // bt.dot_prefix("rand");
@@ -133,8 +149,1021 @@ void n_test_btree_rand(int count = 100 * 1000) {
     // dbg_dump<int, 3>(std::cout, bt);
 }
 
+template<class Storage>
+using dyn_btree = hicc::btree::btree<int, hicc::btree::dynamic_degree, std::less<int>, std::allocator<int>, Storage>;
+template<int Degree, class Storage = hicc::btree::pointer_storage>
+using fixed_btree = hicc::btree::btree<int, Degree, std::less<int>, std::allocator<int>, Storage>;
+
+// the fuzz key of v: v itself, or v zero-padded for string keys, so that
+// both orders agree.
+template<class K>
+K to_key(int v) {
+    if constexpr (std::is_same_v<K, std::string>) {
+        char buf[16];
+        std::snprintf(buf, sizeof(buf), "%06d", v);
+        return buf;
+    } else {
+        return K(v);
+    }
+}
+
+template<class btree, class K = typename btree::elem_type>
+void verify_btree(btree const &bt, std::set<K> const &expected, int degree);
+
+// a dynamic_degree btree takes the degree, a compile-time Degree takes none.
+template<class btree>
+btree make_btree(int degree) {
+    if constexpr (std::is_constructible_v<btree, int>) {
+        return btree(degree);
+    } else {
+        UNUSED(degree);
+        return btree();
+    }
+}
+
+template<class btree, class K = typename btree::elem_type>
+void test_btree_fuzz(int degree, int rounds) {
+    std::default_random_engine e1(2021u + (unsigned) degree);
+    std::uniform_int_distribution<int> uniform_dist(1, 4096);
+
+    btree bt = make_btree<btree>(degree);
+    std::set<K> expected;
+    for (int ix = 0; ix < rounds; ix++) {
+        K v = to_key<K>(uniform_dist(e1));
+        if (ix % 3 == 2 || expected.count(v)) {
+            bt.remove(v);
+            expected.erase(v);
+        } else {
+            bt.insert(v);
+            expected.insert(v);
+        }
+    }
+    verify_btree(bt, expected, degree);
+}
+
+// checks every query of bt against the same keys in a std::set.
+template<class btree, class K>
+void verify_btree(btree const &bt, std::set<K> const &expected, int degree) {
+    auto vec = bt.to_vector();
+    if (vec.size() != expected.size() || !std::equal(vec.begin(), vec.end(), expected.begin())) {
+        std::cerr << "btree fuzz (degree " << degree << ") mismatched std::set" << '\n';
+        std::abort();
+    }
+    for (int i = 0; i <= 4097; i++) {
+        K v = to_key<K>(i);
+        if (bt.exists(v) != (expected.count(v) > 0)) {
+            std::cerr << "btree fuzz (degree " << degree << ") exists(" << v << ") failed" << '\n';
+            std::abort();
+        }
+        auto rank = std::size_t(std::distance(expected.begin(), expected.lower_bound(v)));
+        if (bt.rank(v) != rank) {
+            std::cerr << "btree fuzz (degree " << degree << ") rank(" << v << ") = " << bt.rank(v) << ", expecting " << rank << '\n';
+            std::abort();
+        }
+    }
+    if (bt.size() != expected.size() || bt.size() != std::size_t(bt.total_count())) {
+        std::cerr << "btree fuzz (degree " << degree << ") size() = " << bt.size() << ", expecting " << expected.size() << '\n';
+        std::abort();
+    }
+    for (int i = 0; i < (int) vec.size(); i++) {
+        auto [ok, node, idx] = bt.find_by_index(i);
+        if (!ok || node[idx] != vec[std::size_t(i)]) {
+            std::cerr << "btree fuzz (degree " << degree << ") find_by_index(" << i << ") failed" << '\n';
+            std::abort();
+        }
+    }
+    if (std::get<0>(bt.find_by_index((int) vec.size()))) {
+        std::cerr << "btree fuzz (degree " << degree << ") find_by_index() out of range" << '\n';
+        std::abort();
+    }
+
+    if (!std::equal(bt.rbegin(), bt.rend(), expected.rbegin(), expected.rend())) {
+        std::cerr << "btree fuzz (degree " << degree << ") reverse iteration mismatched" << '\n';
+        std::abort();
+    }
+    for (int i = 0; i <= 4097; i += 7) {
+        K v = to_key<K>(i);
+        auto [lo, hi] = bt.equal_range(v);
+        auto [elo, ehi] = expected.equal_range(v);
+        if (std::distance(bt.begin(), lo) != std::distance(expected.begin(), elo) ||
+            std::distance(bt.begin(), hi) != std::distance(expected.begin(), ehi) ||
+            !std::equal(lo, bt.end(), elo, expected.end())) {
+            std::cerr << "btree fuzz (degree " << degree << ") equal_range(" << v << ") mismatched" << '\n';
+            std::abort();
+        }
+    }
+}
+
+template<class btree>
+void bench_btree(const char *title, int degree, std::vector<int> const &keys) {
+    using clock = std::chrono::steady_clock;
+
+    btree bt = make_btree<btree>(degree);
+    auto t0 = clock::now();
+    for (auto v : keys) bt.insert(v);
+    auto t1 = clock::now();
+    std::size_t hits{};
+    for (auto v : keys) hits += bt.exists(v);
+    auto t2 = clock::now();
+    if (hits != keys.size()) {
+        std::cerr << title << ": lost keys, " << hits << " of " << keys.size() << '\n';
+        std::abort();
+    }
+
+    using ms = std::chrono::duration<double, std::milli>;
+    printf("  %-24s degree %3d: insert %9.2fms, lookup %9.2fms\n", title, degree,
+           ms(t1 - t0).count(), ms(t2 - t1).count());
+}
+
+void test_btree_storage() {
+    printf("\n%s:\n", __FUNCTION_NAME__);
+    for (int degree : {4, 8, 16, 64}) {
+        test_btree_fuzz<dyn_btree<hicc::btree::pointer_storage>>(degree, 20000);
+        test_btree_fuzz<dyn_btree<hicc::btree::inline_storage>>(degree, 20000);
+    }
+
+    const int count = 200 * 1000;
+    std::vector<int> keys(count);
+    for (int i = 0; i < count; i++) keys[i] = i * 2 + 1;
+    std::shuffle(keys.begin(), keys.end(), std::default_random_engine(2021u));
+    for (int degree : {8, 16, 64}) {
+        bench_btree<dyn_btree<hicc::btree::pointer_storage>>("pointer_storage", degree, keys);
+        bench_btree<dyn_btree<hicc::btree::inline_storage>>("inline_storage", degree, keys);
+    }
+}
+
+void test_btree_static_degree() {
+    printf("\n%s:\n", __FUNCTION_NAME__);
+    constexpr int auto_degree = hicc::cross::btree_degree<int>();
+    static_assert(auto_degree % 2 == 0 && auto_degree >= 4);
+    static_assert(hicc::cross::btree_degree<std::array<char, 4096>>() == 4);
+    printf("  btree_degree<int>() = %d, btree_degree<double>() = %d\n",
+           auto_degree, hicc::cross::btree_degree<double>());
+
+    // a compile-time Degree takes no degree argument, a dynamic one is checked.
+    static_assert(!std::is_constructible_v<fixed_btree<16>, int>);
+    static_assert(std::is_constructible_v<dyn_btree<hicc::btree::pointer_storage>, int>);
+    for (int bad : {0, 2, 5, 7}) {
+        bool threw = false;
+        try {
+            dyn_btree<hicc::btree::pointer_storage> bt(bad);
+        } catch (std::invalid_argument const &) { threw = true; }
+        if (!threw) std::abort();
+    }
+
+    test_btree_fuzz<fixed_btree<4>>(4, 20000);
+    test_btree_fuzz<fixed_btree<16, hicc::btree::inline_storage>>(16, 20000);
+    test_btree_fuzz<hicc::btree::btree<int>>(auto_degree, 20000);
+
+    const int count = 200 * 1000;
+    std::vector<int> keys(count);
+    for (int i = 0; i < count; i++) keys[i] = i * 2 + 1;
+    std::shuffle(keys.begin(), keys.end(), std::default_random_engine(2021u));
+    bench_btree<dyn_btree<hicc::btree::inline_storage>>("inline, dynamic_degree", 16, keys);
+    bench_btree<fixed_btree<16, hicc::btree::inline_storage>>("inline, Degree", 16, keys);
+    bench_btree<dyn_btree<hicc::btree::inline_storage>>("inline, dynamic_degree", 64, keys);
+    bench_btree<fixed_btree<64, hicc::btree::inline_storage>>("inline, Degree", 64, keys);
+    bench_btree<hicc::btree::btree<int, auto_degree, std::less<int>, std::allocator<int>, hicc::btree::inline_storage>>("inline, btree_degree<int>", auto_degree, keys);
+}
+
+template<class K>
+void bench_node_search(const char *title) {
+    using clock = std::chrono::steady_clock;
+    using ns = std::chrono::duration<double, std::nano>;
+    const int probes = 1 << 20;
+
+    printf("  %s:\n  %8s %12s %12s %12s\n", title, "keys", "count_less", "branchless", "std::lower");
+    for (int n = 8; n <= 256; n *= 2) {
+        std::vector<K> keys{};
+        keys.resize(std::size_t(n));
+        for (int i = 0; i < n; i++) keys[std::size_t(i)] = K(i * 3);
+        std::vector<K> targets(probes);
+        std::default_random_engine e1(2021u);
+        std::uniform_int_distribution<int> dist(-1, n * 3 + 1);
+        for (auto &t : targets) t = K(dist(e1));
+
+        auto run = [&](auto &&search) {
+            long long sum{};
+            auto t0 = clock::now();
+            for (auto const &t : targets) sum += search(t);
+            return std::make_pair(ns(clock::now() - t0).count() / probes, sum);
+        };
+        auto *data = keys.data();
+        auto [t_linear, s_linear] = run([=](K const &t) { return hicc::btree::detail::count_less(data, n, t); });
+        auto [t_binary, s_binary] = run([=](K const &t) { return hicc::btree::detail::branchless_lower_bound(data, n, t); });
+        auto [t_std, s_std] = run([=](K const &t) { return int(std::lower_bound(data, data + n, t) - data); });
+        if (s_linear != s_std || s_binary != s_std) {
+            std::cerr << "intra-node search mismatched for " << n << " keys" << '\n';
+            std::abort();
+        }
+        printf("  %8d %10.2fns %10.2fns %10.2fns\n", n, t_linear, t_binary, t_std);
+    }
+}
+
+void test_btree_node_search() {
+    printf("\n%s:\n", __FUNCTION_NAME__);
+    bench_node_search<std::int32_t>("int32_t");
+    bench_node_search<double>("double");
+
+    test_btree_fuzz<fixed_btree<64, hicc::btree::inline_storage>>(64, 20000);
+    test_btree_fuzz<hicc::btree::btree<int, 256, std::less<int>, std::allocator<int>, hicc::btree::inline_storage>>(256, 20000);
+    // pointer_storage and non-arithmetic keys go through the binary search
+    test_btree_fuzz<fixed_btree<64>>(64, 20000);
+    using string_btree = hicc::btree::btree<std::string, 16>;
+    using inline_string_btree = hicc::btree::btree<std::string, 16, std::less<std::string>, std::allocator<std::string>, hicc::btree::inline_storage>;
+    test_btree_fuzz<string_btree>(16, 20000);
+    test_btree_fuzz<inline_string_btree>(16, 20000);
+}
+
+void test_btree_rank_select() {
+    printf("\n%s:\n", __FUNCTION_NAME__);
+    using clock = std::chrono::steady_clock;
+    using ms = std::chrono::duration<double, std::milli>;
+
+    const int count = 200 * 1000;
+    fixed_btree<16, hicc::btree::inline_storage> bt;
+    for (int i = 0; i < count; i++) bt.insert(i * 2);
+
+    auto t0 = clock::now();
+    std::size_t total{};
+    for (int i = 0; i < count; i++) total += bt.size();
+    auto t1 = clock::now();
+    for (int i = 0; i < count; i++) {
+        auto [ok, node, idx] = bt.find_by_index(i);
+        if (!ok || node[idx] != i * 2 || bt.rank(i * 2) != std::size_t(i) || bt.rank(i * 2 + 1) != std::size_t(i + 1)) {
+            std::cerr << "rank/select failed at " << i << '\n';
+            std::abort();
+        }
+    }
+    auto t2 = clock::now();
+    printf("  %d x size(): %.2fms (%zu), %d x find_by_index()+rank(): %.2fms\n",
+           count, ms(t1 - t0).count(), total / std::size_t(count), count, ms(t2 - t1).count());
+}
+
+void test_btree_iterators() {
+    printf("\n%s:\n", __FUNCTION_NAME__);
+    using clock = std::chrono::steady_clock;
+    using ms = std::chrono::duration<double, std::milli>;
+
+    fixed_btree<4> small;
+    if (small.begin() != small.end() || small.lower_bound(1) != small.end())
+        std::abort();
+    small.insert(3, 1, 2);
+    auto it = small.end();
+    if (*--it != 3 || *--it != 2 || *--it != 1 || it != small.begin() || *small.upper_bound(1) != 2)
+        std::abort();
+
+    const int count = 200 * 1000;
+    std::vector<int> keys(count);
+    for (int i = 0; i < count; i++) keys[std::size_t(i)] = i;
+    std::shuffle(keys.begin(), keys.end(), std::default_random_engine(2021u));
+    fixed_btree<16, hicc::btree::inline_storage> bt;
+    std::set<int> st;
+    for (auto v : keys) bt.insert(v), st.insert(v);
+
+    long long sum{};
+    auto t0 = clock::now();
+    for (auto v : bt) sum += v;
+    auto t1 = clock::now();
+    bt.walk([&sum](auto const &ctx) {
+        sum += *ctx.el;
+        return true;
+    });
+    auto t2 = clock::now();
+    for (auto v : st) sum += v;
+    auto t3 = clock::now();
+    for (auto i = bt.lower_bound(count / 2), e = bt.upper_bound(count / 2 + 999); i != e; ++i) sum += *i;
+    auto t4 = clock::now();
+    if (sum != 3ll * count * (count - 1) / 2 + 1000ll * (count / 2) + 999ll * 1000 / 2) {
+        std::cerr << "range scan sum mismatched: " << sum << '\n';
+        std::abort();
+    }
+    printf("  scan %d keys: iterator %.2fms, walk() %.2fms, std::set %.2fms; 1000 keys range %.3fms\n",
+           count, ms(t1 - t0).count(), ms(t2 - t1).count(), ms(t3 - t2).count(), ms(t4 - t3).count());
+}
+
+// every non-root node keeps [Degree/2-1, Degree-1] keys and all the leaves
+// are at the same level; returns the count of leaves.
+template<class btree>
+std::size_t check_btree_shape(btree const &bt, int degree) {
+    std::set<void const *> leaves;
+    int leaf_level = -1;
+    bt.walk([&](typename btree::traversal_context const &ctx) -> bool {
+        auto &n = ctx.curr;
+        if (ctx.level > 0 && (n.payload_count() < degree / 2 - 1 || n.payload_count() > degree - 1)) {
+            std::cerr << "bulk_load: node at level " << ctx.level << " holds " << n.payload_count() << " keys" << '\n';
+            std::abort();
+        }
+        if (n.is_leaf()) {
+            if (leaf_level < 0) leaf_level = ctx.level;
+            if (ctx.level != leaf_level) {
+                std::cerr << "bulk_load: leaves at level " << leaf_level << " and " << ctx.level << '\n';
+                std::abort();
+            }
+            leaves.insert(&n);
+        }
+        return true;
+    });
+    return leaves.size();
+}
+
+void test_btree_bulk_load() {
+    printf("\n%s:\n", __FUNCTION_NAME__);
+    using clock = std::chrono::steady_clock;
+    using ms = std::chrono::duration<double, std::milli>;
+
+    for (int degree : {4, 6, 16, 64}) {
+        for (int n : {0, 1, 2, 3, 7, 100, 1001, 5000}) {
+            for (double fill : {1.0, 0.7, 0.5}) {
+                std::vector<int> keys(std::size_t(n), 0);
+                for (int i = 0; i < n; i++) keys[std::size_t(i)] = i * 3;
+                dyn_btree<hicc::btree::pointer_storage> bt(degree);
+                bt.insert(1, 2); // dropped by bulk_load
+                bt.bulk_load(keys.begin(), keys.end(), fill);
+                std::set<int> expected(keys.begin(), keys.end());
+                verify_btree(bt, expected, degree);
+                check_btree_shape(bt, degree);
+
+                // the loaded tree must keep working under inserts and removes
+                std::default_random_engine e1(unsigned(n + degree));
+                std::uniform_int_distribution<int> dist(0, 3 * n + 10);
+                for (int i = 0; i < 2 * n; i++) {
+                    int v = dist(e1);
+                    if (i % 2 || expected.count(v)) {
+                        bt.remove(v);
+                        expected.erase(v);
+                    } else {
+                        bt.insert(v);
+                        expected.insert(v);
+                    }
+                }
+                verify_btree(bt, expected, degree);
+            }
+        }
+    }
+
+    // unsorted input is sorted first, lower fill factors give more leaves
+    {
+        std::vector<int> keys{9, 3, 7, 1, 5, 8, 2, 6, 4, 0};
+        fixed_btree<4, hicc::btree::inline_storage> bt;
+        bt.bulk_load(keys.begin(), keys.end());
+        verify_btree(bt, std::set<int>(keys.begin(), keys.end()), 4);
+
+        std::vector<int> seq(100000);
+        for (std::size_t i = 0; i < seq.size(); i++) seq[i] = int(i);
+        fixed_btree<16, hicc::btree::inline_storage> full, loose;
+        full.bulk_load(seq.begin(), seq.end(), 1.0);
+        loose.bulk_load(seq.begin(), seq.end(), 0.6);
+        auto l1 = check_btree_shape(full, 16), l2 = check_btree_shape(loose, 16);
+        if (l1 >= l2) {
+            std::cerr << "bulk_load: fill factor 1.0 gives " << l1 << " leaves, 0.6 gives " << l2 << '\n';
+            std::abort();
+        }
+    }
+
+    const int count = 1000 * 1000;
+    std::vector<int> keys(count);
+    for (int i = 0; i < count; i++) keys[std::size_t(i)] = i;
+    hicc::pool::thread_pool pool(int(std::max(2u, std::thread::hardware_concurrency())));
+
+    fixed_btree<32, hicc::btree::inline_storage> by_insert, serial, parallel;
+    auto t0 = clock::now();
+    for (auto v : keys) by_insert.insert(v);
+    auto t1 = clock::now();
+    serial.bulk_load(keys.begin(), keys.end());
+    auto t2 = clock::now();
+    parallel.bulk_load(pool, keys.begin(), keys.end());
+    auto t3 = clock::now();
+    if (!std::equal(serial.begin(), serial.end(), by_insert.begin(), by_insert.end()) ||
+        !std::equal(parallel.begin(), parallel.end(), keys.begin(), keys.end()) ||
+        parallel.size() != keys.size() || parallel.rank(count / 2) != std::size_t(count / 2)) {
+        std::cerr << "bulk_load mismatched repeated insert()" << '\n';
+        std::abort();
+    }
+    printf("  %d sorted keys: insert() %.2fms, bulk_load %.2fms, bulk_load on %zu threads %.2fms; leaves %zu vs %zu\n",
+           count, ms(t1 - t0).count(), ms(t2 - t1).count(), pool.total_threads(), ms(t3 - t2).count(),
+           check_btree_shape(by_insert, 32), check_btree_shape(serial, 32));
+}
+
+// counts the live allocations, to check that the node pool gives back
+// everything.
+struct alloc_counter {
+    static inline long live = 0, calls = 0;
+};
+template<class T>
+struct counting_allocator : alloc_counter {
+    using value_type = T;
+    counting_allocator() = default;
+    template<class U>
+    counting_allocator(counting_allocator<U> const &) {}
+    T *allocate(std::size_t n) {
+        live++, calls++;
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T *p, std::size_t n) {
+        live--;
+        std::allocator<T>().deallocate(p, n);
+    }
+    template<class U>
+    bool operator==(counting_allocator<U> const &) const { return true; }
+    template<class U>
+    bool operator!=(counting_allocator<U> const &) const { return false; }
+};
+
+template<class btree>
+void bench_btree_churn(const char *title, std::vector<int> const &keys) {
+    using clock = std::chrono::steady_clock;
+    using ms = std::chrono::duration<double, std::milli>;
+
+    btree bt;
+    auto t0 = clock::now();
+    for (int round = 0; round < 4; round++) {
+        for (auto v : keys) bt.insert(v);
+        for (std::size_t i = 0; i < keys.size(); i += 2) bt.remove(keys[i]);
+        for (std::size_t i = 1; i < keys.size(); i += 2) bt.remove(keys[i]);
+    }
+    auto t1 = clock::now();
+    for (auto v : keys) bt.insert(v);
+    auto t2 = clock::now();
+    bt.clear();
+    auto t3 = clock::now();
+    if (!bt.empty() || alloc_counter::live != 0) {
+        std::cerr << title << ": " << alloc_counter::live << " allocations left after clear()" << '\n';
+        std::abort();
+    }
+    const double ops = 4.0 * 2 * double(keys.size());
+    printf("  %-12s churn %9.2fms (%6.2f Mops/s), clear %zu keys %7.2fms, allocator calls %ld\n",
+           title, ms(t1 - t0).count(), ops / ms(t1 - t0).count() / 1000, keys.size(), ms(t3 - t2).count(),
+           alloc_counter::calls);
+    alloc_counter::calls = 0;
+}
+
+void test_btree_node_pool() {
+    printf("\n%s:\n", __FUNCTION_NAME__);
+    using namespace hicc::btree;
+    for (int degree : {4, 16}) {
+        test_btree_fuzz<btree<int, dynamic_degree, std::less<int>, std::allocator<int>, pointer_storage, heap_nodes>>(degree, 20000);
+        test_btree_fuzz<btree<int, dynamic_degree, std::less<int>, std::allocator<int>, inline_storage, slab_nodes>>(degree, 20000);
+    }
+
+    {
+        // cleared slabs must be given back, the tree works again after that
+        btree<int, 8, std::less<int>, counting_allocator<int>> bt;
+        for (int i = 0; i < 10000; i++) bt.insert(i);
+        for (int i = 0; i < 10000; i += 3) bt.remove(i);
+        bt.clear();
+        if (alloc_counter::live != 0) std::abort();
+        bt.insert(3, 1, 2);
+        if (bt.size() != 3 || *bt.begin() != 1) std::abort();
+        bt.clear();
+        if (alloc_counter::live != 0) std::abort();
+    }
+
+    const int count = 100 * 1000;
+    std::vector<int> keys(count);
+    for (int i = 0; i < count; i++) keys[std::size_t(i)] = i;
+    std::shuffle(keys.begin(), keys.end(), std::default_random_engine(2021u));
+    alloc_counter::calls = 0;
+    using ca = counting_allocator<int>;
+    bench_btree_churn<btree<int, 16, std::less<int>, ca, inline_storage, heap_nodes>>("heap_nodes", keys);
+    bench_btree_churn<btree<int, 16, std::less<int>, ca, inline_storage, slab_nodes>>("slab_nodes", keys);
+    bench_btree_churn<btree<int, 16, std::less<int>, ca, pointer_storage, heap_nodes>>("heap_nodes*", keys);
+    bench_btree_churn<btree<int, 16, std::less<int>, ca, pointer_storage, slab_nodes>>("slab_nodes*", keys);
+}
+
+template<class tree>
+void test_bplus_tree_fuzz(int rounds, int range) {
+    std::default_random_engine e1(2021u + unsigned(range));
+    std::uniform_int_distribution<int> dist(1, range);
+
+    tree bt;
+    std::map<int, int> expected;
+    for (int ix = 0; ix < rounds; ix++) {
+        int k = dist(e1);
+        if (ix % 3 == 2) {
+            if (bt.erase(k) != (expected.erase(k) > 0)) {
+                std::cerr << "bplus_tree erase(" << k << ") mismatched std::map" << '\n';
+                std::abort();
+            }
+        } else if (ix % 3 == 1) {
+            bt.insert_or_assign(k, ix);
+            expected[k] = ix;
+        } else if (bt.insert(k, ix) != expected.emplace(k, ix).second) {
+            std::cerr << "bplus_tree insert(" << k << ") mismatched std::map" << '\n';
+            std::abort();
+        }
+        if (ix % 1000 == 0) bt.assert_it();
+    }
+    bt.assert_it();
+
+    auto same = [](auto const &a, auto const &b) { return a.first == b.first && a.second == b.second; };
+    if (bt.size() != expected.size() ||
+        !std::equal(bt.begin(), bt.end(), expected.begin(), expected.end(), same) ||
+        !std::equal(std::make_reverse_iterator(bt.end()), std::make_reverse_iterator(bt.begin()),
+                    expected.rbegin(), expected.rend(), same)) {
+        std::cerr << "bplus_tree records mismatched std::map" << '\n';
+        std::abort();
+    }
+    for (int k = 0; k <= range + 1; k++) {
+        auto it = bt.find(k);
+        auto e = expected.find(k);
+        if ((it == bt.end()) != (e == expected.end()) || (e != expected.end() && it.value() != e->second) ||
+            std::distance(bt.begin(), bt.lower_bound(k)) != std::distance(expected.begin(), expected.lower_bound(k)) ||
+            std::distance(bt.begin(), bt.upper_bound(k)) != std::distance(expected.begin(), expected.upper_bound(k))) {
+            std::cerr << "bplus_tree find/bound(" << k << ") mismatched std::map" << '\n';
+            std::abort();
+        }
+    }
+    for (int lo = 0; lo <= range; lo += range / 17 + 1) {
+        int hi = lo + range / 5;
+        long sum = 0, esum = 0;
+        auto n = bt.scan(lo, hi, [&sum](int const &k, int const &v) { sum += k * 7 + v; });
+        auto en = std::distance(expected.lower_bound(lo), expected.lower_bound(hi));
+        for (auto i = expected.lower_bound(lo); i != expected.lower_bound(hi); ++i) esum += i->first * 7 + i->second;
+        if (n != std::size_t(en) || sum != esum) {
+            std::cerr << "bplus_tree scan(" << lo << ", " << hi << ") mismatched std::map" << '\n';
+            std::abort();
+        }
+    }
+
+    // drain it, the leaf chain must be empty at the end
+    for (auto const &[k, v] : expected) {
+        UNUSED(v);
+        bt.erase(k);
+    }
+    bt.assert_it();
+    if (!bt.empty() || bt.begin() != bt.end() || bt.height() != 0) std::abort();
+}
+
+void test_bplus_tree() {
+    printf("\n%s:\n", __FUNCTION_NAME__);
+    using namespace hicc::btree;
+    test_bplus_tree_fuzz<bplus_tree<int, int, 4>>(20000, 2000);
+    test_bplus_tree_fuzz<bplus_tree<int, int, 6, std::less<int>, std::allocator<std::pair<const int, int>>, heap_nodes>>(20000, 2000);
+    test_bplus_tree_fuzz<bplus_tree<int, int, 16>>(50000, 20000);
+    test_bplus_tree_fuzz<bplus_tree<int, int>>(50000, 20000);
+    {
+        bplus_tree<std::string, std::string, 4> names;
+        for (auto const *n : {"delta", "alpha", "echo", "charlie", "bravo"}) names.insert(n, std::string(n) + "!");
+        names.erase("charlie");
+        std::string all;
+        for (auto [k, v] : names) all += v;
+        if (all != "alpha!bravo!delta!echo!" || names.find("echo").value() != "echo!") std::abort();
+        names.assert_it();
+    }
+
+    using clock = std::chrono::steady_clock;
+    using ms = std::chrono::duration<double, std::milli>;
+
+    // time-ordered keys, scanned by windows of 1000 records
+    const int count = 1000 * 1000, window = 1000, scans = 2000;
+    bplus_tree<std::int64_t, std::int64_t> bp;
+    btree<std::int64_t, hicc::cross::btree_degree<std::int64_t>(), std::less<std::int64_t>, std::allocator<std::int64_t>, inline_storage> bt;
+    std::map<std::int64_t, std::int64_t> m;
+    for (std::int64_t i = 0; i < count; i++) {
+        bp.insert(i * 10, i);
+        bt.insert(i * 10);
+        m.emplace(i * 10, i);
+    }
+    std::default_random_engine e1(2021u);
+    std::uniform_int_distribution<std::int64_t> dist(0, count - window - 1);
+    std::vector<std::int64_t> starts(scans);
+    for (auto &v : starts) v = dist(e1) * 10;
+
+    std::int64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    auto t0 = clock::now();
+    for (auto lo : starts) bp.scan(lo, lo + window * 10, [&s0](std::int64_t const &k, std::int64_t const &v) { s0 += k + v; });
+    auto t1 = clock::now();
+    for (auto lo : starts)
+        for (auto i = bp.lower_bound(lo), e = bp.lower_bound(lo + window * 10); i != e; ++i) s1 += i.key() + i.value();
+    auto t2 = clock::now();
+    for (auto lo : starts)
+        for (auto i = bt.lower_bound(lo), e = bt.lower_bound(lo + window * 10); i != e; ++i) s2 += *i + *i / 10;
+    auto t3 = clock::now();
+    for (auto lo : starts)
+        for (auto i = m.lower_bound(lo), e = m.lower_bound(lo + window * 10); i != e; ++i) s3 += i->first + i->second;
+    auto t4 = clock::now();
+    if (s0 != s1 || s0 != s2 || s0 != s3) {
+        std::cerr << "range scans mismatched: " << s0 << ", " << s1 << ", " << s2 << ", " << s3 << '\n';
+        std::abort();
+    }
+    printf("  %d scans of %d records: bplus_tree scan() %.2fms, iterator %.2fms; btree iterator %.2fms; std::map %.2fms\n",
+           scans, window, ms(t1 - t0).count(), ms(t2 - t1).count(), ms(t3 - t2).count(), ms(t4 - t3).count());
+}
+
+// the btree guarded by a std::shared_mutex, as the baseline of concurrent_btree
+template<class T>
+struct locked_btree {
+    bool insert(T const &key) {
+        std::unique_lock<std::shared_mutex> lk(_m);
+        if (_bt.exists(key)) return false;
+        _bt.insert(key);
+        return true;
+    }
+    bool remove(T const &key) {
+        std::unique_lock<std::shared_mutex> lk(_m);
+        if (!_bt.exists(key)) return false;
+        _bt.remove(key);
+        return true;
+    }
+    bool exists(T const &key) const {
+        std::shared_lock<std::shared_mutex> lk(_m);
+        return _bt.exists(key);
+    }
+    hicc::btree::btree<T, hicc::cross::btree_degree<T>(), std::less<T>, std::allocator<T>, hicc::btree::inline_storage> _bt;
+    mutable std::shared_mutex _m;
+};
+
+// 90% lookups, 5% inserts and 5% removes over random keys, split among the threads
+template<class tree>
+double bench_concurrent_mix(tree &bt, int threads, int total_ops, int key_range) {
+    using clock = std::chrono::steady_clock;
+    std::atomic<long> hits{0};
+    std::vector<std::thread> workers;
+    auto t0 = clock::now();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&bt, &hits, t, ops = total_ops / threads, key_range]() {
+            std::default_random_engine e1(unsigned(t) * 7919u + 1u);
+            std::uniform_int_distribution<int> dist(0, key_range - 1), op(0, 99);
+            long h = 0;
+            for (int i = 0; i < ops; i++) {
+                int k = dist(e1), o = op(e1);
+                if (o < 5)
+                    bt.insert(k);
+                else if (o < 10)
+                    bt.remove(k);
+                else
+                    h += bt.exists(k);
+            }
+            hits += h;
+        });
+    }
+    for (auto &w : workers) w.join();
+    auto t1 = clock::now();
+    if (hits.load() == 0) std::abort();
+    return double(total_ops) / std::chrono::duration<double, std::micro>(t1 - t0).count();
+}
+
+void test_concurrent_btree() {
+    printf("\n%s:\n", __FUNCTION_NAME__);
+    using namespace hicc::btree;
+
+    {
+        // the keys below 1000 stay, the writers insert and remove the
+        // others while the readers must find every stable key.
+        concurrent_btree<int, 4> bt;
+        for (int i = 0; i < 1000; i++) bt.insert(i * 2);
+        const int writers = 4, per_writer = 20000;
+        std::atomic<bool> done{false};
+        std::atomic<long> missed{0};
+        std::vector<std::thread> workers;
+        for (int t = 0; t < writers; t++) {
+            workers.emplace_back([&bt, t]() {
+                for (int i = 0; i < per_writer; i++) {
+                    int k = 2000 + i * writers + t;
+                    if (!bt.insert(k)) std::abort();
+                    if (i % 3 == 0 && !bt.remove(k)) std::abort();
+                }
+            });
+        }
+        for (int t = 0; t < 2; t++) {
+            workers.emplace_back([&bt, &done, &missed]() {
+                while (!done.load()) {
+                    for (int i = 0; i < 1000; i++)
+                        if (!bt.exists(i * 2) || bt.exists(i * 2 + 1)) missed++;
+                }
+            });
+        }
+        for (int t = 0; t < writers; t++) workers[std::size_t(t)].join();
+        done = true;
+        for (std::size_t t = std::size_t(writers); t < workers.size(); t++) workers[t].join();
+
+        std::set<int> expected;
+        for (int i = 0; i < 1000; i++) expected.insert(i * 2);
+        for (int t = 0; t < writers; t++)
+            for (int i = 0; i < per_writer; i++)
+                if (i % 3) expected.insert(2000 + i * writers + t);
+        auto vec = bt.to_vector();
+        bt.assert_it();
+        if (missed.load() || bt.size() != expected.size() || !std::equal(vec.begin(), vec.end(), expected.begin(), expected.end())) {
+            std::cerr << "concurrent_btree mismatched, " << missed.load() << " lookups missed" << '\n';
+            std::abort();
+        }
+        for (int i = 0; i < 1000; i++) bt.remove(i * 2);
+        bt.clear();
+        if (!bt.empty() || bt.exists(2000) || !bt.insert(1) || !bt.exists(1)) std::abort();
+    }
+
+    const int key_range = 200 * 1000, total_ops = 400 * 1000;
+    printf("  %7s %18s %18s   (Mops/s, 90%% lookups, %u cpus)\n", "threads", "concurrent_btree", "shared_mutex", std::thread::hardware_concurrency());
+    for (int threads : {1, 2, 4, 8, 16, 32}) {
+        concurrent_btree<int> cbt;
+        locked_btree<int> lbt;
+        for (int k = 0; k < key_range; k += 2) cbt.insert(k), lbt.insert(k);
+        double c = bench_concurrent_mix(cbt, threads, total_ops, key_range);
+        double l = bench_concurrent_mix(lbt, threads, total_ops, key_range);
+        printf("  %7d %18.2f %18.2f\n", threads, c, l);
+    }
+}
+
+template<class tree>
+void verify_mmap_btree(tree const &bt, std::set<int> const &expected) {
+    bt.assert_it();
+    auto vec = bt.to_vector();
+    if (bt.size() != expected.size() || !std::equal(vec.begin(), vec.end(), expected.begin(), expected.end())) {
+        std::cerr << "mmap_btree mismatched, size " << bt.size() << " vs " << expected.size() << '\n';
+        std::abort();
+    }
+}
+
+void test_mmap_btree() {
+    printf("\n%s:\n", __FUNCTION_NAME__);
+    using namespace hicc::btree;
+    using clock = std::chrono::steady_clock;
+    using ms = std::chrono::duration<double, std::milli>;
+
+    auto path = hicc::path::tmpname_autoincr("hicc-mmap-btree-%d.db");
+    hicc::io::delete_file(path);
+    using small_tree = mmap_btree<int, 128>; // 8 children per page, deep trees
+    std::set<int> committed;
+    {
+        // random inserts and removes, committed every few hundred ops
+        small_tree bt(path);
+        if (!bt.empty() || bt.transaction() != 1) std::abort();
+        std::set<int> expected;
+        std::default_random_engine e1(7);
+        std::uniform_int_distribution<int> dist(0, 5000);
+        for (int i = 0; i < 30000; i++) {
+            int v = dist(e1);
+            if (i % 3 == 2) {
+                if (bt.remove(v) != (expected.erase(v) == 1)) std::abort();
+            } else {
+                if (bt.insert(v) != expected.insert(v).second) std::abort();
+            }
+            if (i % 700 == 0) {
+                verify_mmap_btree(bt, expected);
+                if (!bt.commit()) std::abort();
+                committed = expected;
+            }
+        }
+        if (!bt.commit()) std::abort();
+        committed = expected;
+        verify_mmap_btree(bt, committed);
+
+        // the freed pages are reused: the file stops growing under churn
+        auto pages = bt.pages();
+        for (int round = 0; round < 20; round++) {
+            for (int i = 0; i < 200; i++) {
+                int v = dist(e1);
+                if (committed.count(v)) bt.remove(v), committed.erase(v);
+                else bt.insert(v), committed.insert(v);
+            }
+            if (!bt.commit()) std::abort();
+        }
+        verify_mmap_btree(bt, committed);
+        printf("  pages: %llu after 30000 ops, %llu after 4000 more\n", (unsigned long long) pages, (unsigned long long) bt.pages());
+        if (bt.pages() > pages * 3 / 2) std::abort();
+
+        // rollback drops the uncommitted changes
+        for (int i = 0; i < 1000; i++) bt.insert(10000 + i);
+        bt.remove(*committed.begin());
+        bt.rollback();
+        verify_mmap_btree(bt, committed);
+        bt.clear();
+        if (!bt.empty()) std::abort();
+        bt.rollback();
+        verify_mmap_btree(bt, committed);
+
+        // closed without commit
+        for (int i = 0; i < 1000; i++) bt.insert(20000 + i);
+    }
+    {
+        small_tree bt(path);
+        verify_mmap_btree(bt, committed);
+        bt.insert(-1);
+        if (!bt.commit()) std::abort();
+    }
+    {
+        // a torn write of the latest superblock falls back to the
+        // previous commit.
+        std::uint64_t txn;
+        {
+            small_tree bt(path);
+            txn = bt.transaction() - 1;
+        }
+        {
+            std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+            f.seekp(std::streamoff((txn % 2) * 128 + 40));
+            f.put('\x5a');
+        }
+        small_tree bt(path);
+        if (bt.transaction() != txn || bt.exists(-1)) std::abort();
+        verify_mmap_btree(bt, committed);
+        bool threw = false;
+        try {
+            mmap_btree<long long, 128> other(path);
+        } catch (std::runtime_error const &) { threw = true; }
+        if (!threw) std::abort();
+    }
+    {
+        // a small file of something else is refused, not wiped
+        {
+            std::ofstream f(path, std::ios::binary | std::ios::trunc);
+            f << "not a btree";
+        }
+        bool threw = false;
+        try {
+            small_tree bt(path);
+        } catch (std::runtime_error const &) { threw = true; }
+        std::ifstream f(path, std::ios::binary);
+        std::string content((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+        if (!threw || content != "not a btree") std::abort();
+    }
+    hicc::io::delete_file(path);
+
+    // the start-up cost: mapping a tree of n keys against rebuilding it in
+    // memory from a sorted array.
+    const int n = 200 * 1000;
+    path = hicc::path::tmpname_autoincr("hicc-mmap-btree-%d.db");
+    hicc::io::delete_file(path);
+    {
+        mmap_btree<int> bt(path);
+        for (int i = 0; i < n; i++) bt.insert(i * 7 % n);
+        if (!bt.commit()) std::abort();
+    }
+    auto t0 = clock::now();
+    bool found;
+    {
+        mmap_btree<int> bt(path);
+        found = bt.exists(n / 2) && bt.size() == std::size_t(n);
+    }
+    auto t1 = clock::now();
+    std::vector<int> keys(static_cast<std::size_t>(n));
+    for (int i = 0; i < n; i++) keys[std::size_t(i)] = i;
+    {
+        fixed_btree<64> bt;
+        bt.bulk_load(keys.begin(), keys.end());
+        found = found && bt.exists(n / 2);
+    }
+    auto t2 = clock::now();
+    if (!found) std::abort();
+    printf("  %d keys: open + lookup %.3fms, in-memory bulk_load + lookup %.3fms\n", n, ms(t1 - t0).count(), ms(t2 - t1).count());
+    hicc::io::delete_file(path);
+}
+
+// a key counting its live instances, to see the versions being freed
+struct counted_key {
+    static std::atomic<long> live;
+    int v{};
+    counted_key() { live++; }
+    counted_key(int i)
+        : v(i) { live++; }
+    counted_key(counted_key const &o)
+        : v(o.v) { live++; }
+    counted_key &operator=(counted_key const &o) = default;
+    ~counted_key() { live--; }
+    bool operator<(counted_key const &o) const { return v < o.v; }
+};
+std::atomic<long> counted_key::live{0};
+
+template<class tree>
+void verify_cow_btree(tree const &bt, std::set<int> const &expected) {
+    auto vec = bt.to_vector();
+    if (bt.size() != expected.size() || vec.size() != expected.size() ||
+        !std::equal(vec.begin(), vec.end(), expected.begin(), [](counted_key const &a, int b) { return a.v == b; })) {
+        std::cerr << "cow_btree mismatched, size " << bt.size() << " vs " << expected.size() << '\n';
+        std::abort();
+    }
+}
+
+void test_cow_btree() {
+    printf("\n%s:\n", __FUNCTION_NAME__);
+    using namespace hicc::btree;
+    using clock = std::chrono::steady_clock;
+    using ms = std::chrono::duration<double, std::milli>;
+
+    {
+        // snapshots taken along random inserts and removes must keep
+        // their content while the tree goes on.
+        using tree = cow_btree<counted_key, 4>;
+        std::vector<std::pair<tree::snapshot_t, std::set<int>>> versions;
+        {
+            tree bt;
+            std::set<int> expected;
+            std::default_random_engine e1(11);
+            std::uniform_int_distribution<int> dist(0, 2000);
+            for (int i = 0; i < 40000; i++) {
+                int v = dist(e1);
+                if (i % 3 == 2) {
+                    if (bt.remove(v) != (expected.erase(v) == 1)) std::abort();
+                } else {
+                    if (bt.insert(v) != expected.insert(v).second) std::abort();
+                }
+                if (i % 97 == 0) versions.emplace_back(bt.snapshot(), expected);
+                if (i % 1000 == 0) {
+                    bt.assert_it();
+                    verify_cow_btree(bt, expected);
+                    // drop some of the old versions
+                    for (std::size_t j = 0; j < versions.size(); j += 2) {
+                        verify_cow_btree(versions[j].first, versions[j].second);
+                        versions.erase(versions.begin() + std::ptrdiff_t(j));
+                    }
+                }
+            }
+            bt.assert_it();
+            verify_cow_btree(bt, expected);
+            for (auto const &[snap, keys] : versions) verify_cow_btree(snap, keys);
+
+            auto copied = versions.back().first;
+            bt.clear();
+            if (!bt.empty() || bt.exists(*expected.begin()) || !copied.exists(*versions.back().second.begin())) std::abort();
+        }
+        // the snapshots outlive their tree
+        for (auto const &[snap, keys] : versions) verify_cow_btree(snap, keys);
+        versions.clear();
+        if (counted_key::live.load() != 0) {
+            std::cerr << counted_key::live.load() << " keys leaked" << '\n';
+            std::abort();
+        }
+    }
+
+    {
+        // readers check the snapshots the writer hands out, each holds a
+        // consecutive run of keys.
+        cow_btree<int> bt;
+        std::mutex mtx;
+        cow_btree<int>::snapshot_t published;
+        std::atomic<bool> done{false};
+        std::atomic<long> bad{0}, checked{0};
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 2; t++) {
+            readers.emplace_back([&]() {
+                while (!done.load()) {
+                    cow_btree<int>::snapshot_t snap;
+                    {
+                        std::lock_guard<std::mutex> lock(mtx);
+                        snap = published;
+                    }
+                    auto vec = snap.to_vector();
+                    if (vec.size() != snap.size()) bad++;
+                    for (std::size_t i = 1; i < vec.size(); i++)
+                        if (vec[i] != vec[i - 1] + 1) bad++;
+                    checked++;
+                }
+            });
+        }
+        for (int i = 0; i < 100000; i++) {
+            bt.insert(i);
+            if (i >= 500) bt.remove(i - 500);
+            if (i % 100 == 0) {
+                auto snap = bt.snapshot();
+                std::lock_guard<std::mutex> lock(mtx);
+                published = std::move(snap);
+            }
+        }
+        done = true;
+        for (auto &t : readers) t.join();
+        if (bad.load() || bt.size() != 500) std::abort();
+        printf("  %ld snapshots checked by the readers\n", checked.load());
+    }
+
+    // snapshot() against copying the keys out, and the writer cost of
+    // keeping a snapshot alive.
+    const int n = 200 * 1000;
+    cow_btree<int> bt;
+    for (int i = 0; i < n; i++) bt.insert(i);
+    auto t0 = clock::now();
+    auto snap = bt.snapshot();
+    auto t1 = clock::now();
+    auto vec = bt.to_vector();
+    auto t2 = clock::now();
+    for (int i = 0; i < n; i += 4) bt.remove(i);
+    auto t3 = clock::now();
+    snap = bt.snapshot();
+    for (int i = 1; i < n; i += 4) bt.remove(i);
+    auto t4 = clock::now();
+    snap = {};
+    for (int i = 2; i < n; i += 4) bt.remove(i);
+    auto t5 = clock::now();
+    if (vec.size() != std::size_t(n) || bt.size() != std::size_t(n / 4)) std::abort();
+    printf("  %d keys: snapshot() %.4fms, to_vector() %.3fms\n", n, ms(t1 - t0).count(), ms(t2 - t1).count());
+    printf("  %d removes: %.3fms with a live snapshot taken before, %.3fms with a new one, %.3fms without\n",
+           n / 4, ms(t3 - t2).count(), ms(t4 - t3).count(), ms(t5 - t4).count());
+}
+
 int main(int argc, char *argv[]) {
     n_test_btree();
+    test_btree_storage();
+    test_btree_static_degree();
+    test_btree_node_search();
+    test_btree_rank_select();
+    test_btree_iterators();
+    test_btree_bulk_load();
+    test_btree_node_pool();
+    test_bplus_tree();
+    test_concurrent_btree();
+    test_mmap_btree();
+    test_cow_btree();
 #if 0 // TODO
     if (argc > 1) {
         int count = std::atoi(argv[1]);
@@ -2,16 +2,26 @@
 // Created by Hedzr Yeh on 2021/7/13.
 //
 
-#define HICC_TEST_THREAD_POOL_DBGOUT 1
+// set to 1 to trace the pool internals, it floods test_pool_scaling though.
+#define HICC_TEST_THREAD_POOL_DBGOUT 0
 #define HICC_ENABLE_THREAD_POOL_READY_SIGNAL 1
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <mutex>
 #include <thread>
 
+#include <functional>
+#include <future>
+#include <new>
+#include <stdexcept>
 #include <sstream>
+#include <vector>
 
 #include "hicc/hz-log.hh"
 #include "hicc/hz-pool.hh"
@@ -20,6 +30,17 @@
 
 hicc::debug::X x_global_var;
 
+// counts the heap allocations, see test_pool_allocations().
+static std::atomic<std::size_t> g_allocs{0};
+void *operator new(std::size_t n) {
+    ++g_allocs;
+    if (void *p = std::malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
 class L {
 public:
     L() {}
@@ -264,6 +285,313 @@ void test_pool() {
     std::cout << "_tasks ended\n";
 }
 
+void test_work_stealing_pool() {
+    hicc::pool::work_stealing_pool pool(4);
+
+    // results through futures
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 100; i++)
+        results.push_back(pool.queue_task([i] { return i * i; }));
+    int sum = 0;
+    for (auto &r : results) sum += r.get();
+    std::cout << "sum of squares 0..99: " << sum << '\n';
+    if (sum != 328350) std::abort();
+
+    // tasks spawned from inside a worker go to its own deque, and can be stolen by others.
+    std::atomic_int done{0};
+    std::function<void(int)> spawn = [&](int depth) {
+        if (depth > 0) {
+            pool.queue_task([&spawn, depth] { spawn(depth - 1); });
+            pool.queue_task([&spawn, depth] { spawn(depth - 1); });
+        }
+        ++done;
+    };
+    pool.queue_task([&spawn] { spawn(10); });
+    while (done.load() < (1 << 11) - 1)
+        std::this_thread::yield();
+    std::cout << "nested tasks done: " << done.load() << '\n';
+
+    // a throwing task: its future gets the exception, and the workers go on
+    auto bad = pool.queue_task([]() -> int { throw std::runtime_error("boom"); });
+    bool threw = false;
+    try {
+        bad.get();
+    } catch (std::runtime_error const &) { threw = true; }
+    if (!threw || pool.queue_task([] { return 7; }).get() != 7) std::abort();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (pool.active_threads() != 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::yield();
+    if (pool.active_threads() != 0) std::abort();
+
+    // join() runs out the queued tasks
+    std::atomic_int late{0};
+    for (int i = 0; i < 1000; i++)
+        pool.queue_task([&late] { ++late; });
+    pool.join();
+    std::cout << "tasks ran before join returned: " << late.load() << '\n';
+    if (late.load() != 1000) std::abort();
+}
+
+void test_priority_pool() {
+    // holds the only worker of pool, queues the mixed priorities, then
+    // lets it go. Returns the priorities in the order they ran.
+    auto run_mixed = [](auto &pool) {
+        std::promise<void> gate, started;
+        auto opened = gate.get_future().share();
+        auto held = pool.queue_task(100, [opened, &started] {
+            started.set_value();
+            opened.wait();
+        });
+        started.get_future().wait();
+        std::mutex m;
+        std::vector<int> order;
+        for (int i = 0; i < 64; i++) {
+            int priority = (i * 37) % 64;
+            pool.post(priority, [&m, &order, priority] {
+                std::lock_guard<std::mutex> lk(m);
+                order.push_back(priority);
+            });
+        }
+        if (pool.pending_tasks() != 64) std::abort();
+        gate.set_value();
+        held.get();
+        pool.join();
+        return order;
+    };
+
+    // one worker on one shard: the exact priority order
+    hicc::pool::priority_thread_pool<int> exact(1, 1);
+    auto order = run_mixed(exact);
+    for (int i = 0; i < 64; i++)
+        if (order[std::size_t(i)] != 63 - i) std::abort();
+
+    // the default shards relax the order, but every task runs once
+    hicc::pool::priority_thread_pool<int> pool(1);
+    order = run_mixed(pool);
+    long first_half = 0;
+    for (std::size_t i = 0; i < 32; i++) first_half += order[i];
+    std::cout << "relaxed: priority of the first task: " << order.front() << ", mean of the first 32: " << first_half / 32 << '\n';
+    std::sort(order.begin(), order.end());
+    for (int i = 0; i < 64; i++)
+        if (order[std::size_t(i)] != i) std::abort();
+
+    // results through futures
+    hicc::pool::priority_thread_pool<int> workers(4);
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 100; i++)
+        results.push_back(workers.queue_task(i % 3, [i] { return i * i; }));
+    int sum = 0;
+    for (auto &r : results) sum += r.get();
+    if (sum != 328350) std::abort();
+
+    // a throwing post()ed task is dropped, and the worker goes on
+    hicc::pool::priority_thread_pool<> survivor(1);
+    survivor.post(1, [] { throw std::runtime_error("boom"); });
+    if (survivor.queue_task(0, [] { return 7; }).get() != 7) std::abort();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (survivor.active_threads() != 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::yield();
+    if (survivor.active_threads() != 0) std::abort();
+
+    // join() runs out the queued tasks
+    hicc::pool::priority_thread_pool<> drained(2);
+    std::atomic_int late{0};
+    for (int i = 0; i < 1000; i++)
+        drained.post(i, [&late] { ++late; });
+    drained.join();
+    if (late.load() != 1000 || drained.pending_tasks() != 0) std::abort();
+}
+
+void test_pool_scaling() {
+    // tasks/sec vs thread count, for the single-queue thread_pool and the work_stealing_pool.
+    auto work = [] {
+        volatile std::uint64_t x = 0;
+        for (int i = 0; i < 200; i++) x = x + i;
+    };
+    auto bench = [&work](const char *title, auto &pool, unsigned int threads, int tasks) {
+        std::vector<std::future<void>> fs;
+        fs.reserve(tasks);
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < tasks; i++)
+            fs.push_back(pool.queue_task(work));
+        for (auto &f : fs) f.get();
+        auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        printf("  %-20s %2u threads: %7d tasks in %8.3lfms, %12.1lf tasks/s\n",
+               title, threads, tasks, secs * 1000, tasks / secs);
+    };
+    auto bench_nested = [&work](auto &pool, unsigned int threads, int tasks) {
+        // one root task fans out the whole load from inside the pool.
+        std::atomic_int done{0};
+        auto t0 = std::chrono::steady_clock::now();
+        pool.queue_task([&] {
+            for (int i = 0; i < tasks; i++)
+                pool.queue_task([&] { work(); ++done; });
+        });
+        while (done.load() < tasks)
+            std::this_thread::yield();
+        auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        printf("  %-20s %2u threads: %7d tasks in %8.3lfms, %12.1lf tasks/s\n",
+               "work_stealing(nest)", threads, tasks, secs * 1000, tasks / secs);
+    };
+
+    unsigned int max_threads = std::max(4u, std::thread::hardware_concurrency());
+    const int tasks = 20000;
+    for (unsigned int n = 1; n <= max_threads; n *= 2) {
+        {
+            hicc::pool::thread_pool pool(static_cast<int>(n));
+            bench("thread_pool", pool, n, tasks);
+        }
+        {
+            hicc::pool::work_stealing_pool pool(static_cast<int>(n));
+            bench("work_stealing_pool", pool, n, tasks);
+            bench_nested(pool, n, tasks);
+        }
+    }
+}
+
+void test_pool_allocations() {
+    const int tasks = 20000;
+    auto report = [](const char *title, std::size_t allocs, double secs) {
+        printf("  %-36s %6.2lf allocs/task, %10.1lf tasks/s\n", title, double(allocs) / tasks, tasks / secs);
+    };
+    auto now = [] { return std::chrono::steady_clock::now(); };
+    auto elapsed = [](auto t0) { return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count(); };
+
+    {
+        hicc::pool::thread_pool pool(1);
+        auto a0 = g_allocs.load();
+        auto t0 = now();
+        for (int i = 0; i < tasks; i++)
+            pool.queue_task([i] { return i; }).get();
+        report("thread_pool::queue_task + get", g_allocs - a0, elapsed(t0));
+    }
+    {
+        hicc::pool::thread_pool pool(1);
+        std::atomic_int done{0};
+        pool.post([] {}); // warm up the queue storage
+        auto a0 = g_allocs.load();
+        auto t0 = now();
+        for (int i = 0; i < tasks; i++)
+            pool.post([&done] { ++done; });
+        while (done.load() < tasks)
+            std::this_thread::yield();
+        report("thread_pool::post", g_allocs - a0, elapsed(t0));
+    }
+    {
+        hicc::pool::thread_pool pool(1);
+        pool.submit([] {}).get();
+        auto a0 = g_allocs.load();
+        auto t0 = now();
+        for (int i = 0; i < tasks; i++) {
+            auto f = pool.submit([i] { return i; });
+            if (f.get() != i) std::abort();
+        }
+        report("thread_pool::submit + get", g_allocs - a0, elapsed(t0));
+    }
+    {
+        hicc::pool::thread_pool_lite pool(1);
+        auto a0 = g_allocs.load();
+        auto t0 = now();
+        for (int i = 0; i < tasks; i++)
+            pool.enqueue([i] { return i; }).get();
+        report("thread_pool_lite::enqueue + get", g_allocs - a0, elapsed(t0));
+    }
+
+    {
+        // exceptions go through the light_future
+        hicc::pool::thread_pool pool(1);
+        auto f = pool.submit([]() -> int { throw std::runtime_error("boom"); });
+        try {
+            f.get();
+            std::abort();
+        } catch (std::runtime_error const &e) {
+            std::cout << "  submit() rethrown: " << e.what() << '\n';
+        }
+    }
+}
+
+void test_parallel_algorithms() {
+    hicc::pool::thread_pool pool(4);
+
+    {
+        std::vector<int> v(100000, 1);
+        hicc::pool::parallel_for(pool, std::size_t(0), v.size(), 1000, [&](std::size_t i) { v[i] += int(i % 7); });
+        for (std::size_t i = 0; i < v.size(); i++)
+            if (v[i] != 1 + int(i % 7)) std::abort();
+        hicc::pool::parallel_for(pool, v, 0, [](int &x) { x *= 2; });
+        for (std::size_t i = 0; i < v.size(); i++)
+            if (v[i] != 2 + 2 * int(i % 7)) std::abort();
+
+        // a sub-range body
+        std::atomic<std::size_t> pieces{0}, seen{0};
+        hicc::pool::parallel_for(pool, v.begin(), v.end(), 4096, [&](auto b, auto e) {
+            ++pieces;
+            seen += std::size_t(e - b);
+        });
+        if (seen != v.size()) std::abort();
+        std::cout << "  parallel_for: " << pieces << " pieces of >= 4096 for " << v.size() << " elements\n";
+
+        long sum = hicc::pool::parallel_reduce(pool, v.begin(), v.end(), 1000, 10L, std::plus<>{});
+        long expected = 10;
+        for (int x : v) expected += x;
+        if (sum != expected) std::abort();
+        std::cout << "  parallel_reduce: " << sum << '\n';
+
+        std::vector<double> out(v.size());
+        auto end = hicc::pool::parallel_transform(pool, v, out.begin(), 0, [](int x) { return x * 0.5; });
+        if (end != out.end()) std::abort();
+        for (std::size_t i = 0; i < v.size(); i++)
+            if (out[i] != v[i] * 0.5) std::abort();
+
+        // empty ranges
+        hicc::pool::parallel_for(pool, 0, 0, 1, [](int) { std::abort(); });
+        if (hicc::pool::parallel_reduce(pool, v.begin(), v.begin(), 1, 7L, std::plus<>{}) != 7) std::abort();
+    }
+
+    {
+        // the first exception cancels the rest and is rethrown to the caller
+        std::atomic_int ran{0};
+        try {
+            hicc::pool::parallel_for(pool, 0, 1000, 1, [&](int i) {
+                ++ran;
+                if (i == 10) throw std::runtime_error("bad element");
+            });
+            std::abort();
+        } catch (std::runtime_error const &e) {
+            std::cout << "  parallel_for rethrown: " << e.what() << ", " << ran << " of 1000 ran\n";
+        }
+    }
+
+    {
+        // nested calls from the workers help each other rather than deadlock
+        std::atomic<long> total{0};
+        hicc::pool::parallel_for(pool, 0, 16, 1, [&](int) {
+            total += hicc::pool::parallel_reduce(pool, 0, 1000, 10, 0L, std::plus<>{});
+        });
+        if (total != 16 * 499500L) std::abort();
+    }
+
+    {
+        // hand-rolled chunking with queue_task against parallel_for
+        const std::size_t n = 1u << 22, chunk = 1u << 12;
+        std::vector<float> v(n, 1.0f);
+        auto work = [&](std::size_t b, std::size_t e) {
+            for (; b != e; ++b) v[b] = v[b] * 1.0001f + 0.5f;
+        };
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<std::future<void>> fs;
+        for (std::size_t b = 0; b < n; b += chunk)
+            fs.push_back(pool.queue_task([&work, b, chunk] { work(b, b + chunk); }));
+        for (auto &f : fs) f.get();
+        auto t1 = std::chrono::steady_clock::now();
+        hicc::pool::parallel_for(pool, std::size_t(0), n, chunk, work);
+        auto t2 = std::chrono::steady_clock::now();
+        printf("  %zu elements in %zu chunks: queue_task %.2lfms, parallel_for %.2lfms\n", n, n / chunk,
+               std::chrono::duration<double, std::milli>(t1 - t0).count(),
+               std::chrono::duration<double, std::milli>(t2 - t1).count());
+    }
+}
+
 int main() {
     // {
     //     unsigned int n = std::thread::hardware_concurrency();
@@ -281,6 +609,11 @@ int main() {
     // HICC_TEST_FOR(test_cv_1);
 
     HICC_TEST_FOR(test_pool);
+    HICC_TEST_FOR(test_work_stealing_pool);
+    HICC_TEST_FOR(test_priority_pool);
+    HICC_TEST_FOR(test_pool_scaling);
+    HICC_TEST_FOR(test_pool_allocations);
+    HICC_TEST_FOR(test_parallel_algorithms);
 
     HICC_TEST_FOR(test_mq);
 }
\ No newline at end of file
@@ -5,6 +5,19 @@
 #include "hicc/hz-priority-queue.hh"
 #include "hicc/hz-x-test.hh"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <random>
+#include <thread>
+
 void test_pq() {
     std::list<int> vi;
     // vi.pop_front();
@@ -82,6 +95,426 @@ void test_pq() {
 #endif
 }
 
+struct int_comp {
+    int operator()(int lhs, int rhs) const { return lhs < rhs ? -1 : (rhs < lhs ? 1 : 0); }
+};
+struct pair_comp {
+    int operator()(std::pair<int, int> const &lhs, std::pair<int, int> const &rhs) const { return int_comp{}(lhs.first, rhs.first); }
+};
+
+void test_dary_heap() {
+    // the same pop order as priority_queue, equal elements in push order
+    struct cmd_comp {
+        int operator()(std::string const &lhs, std::string const &rhs) const {
+            bool l = lhs.substr(0, 4) == "CMD:", r = rhs.substr(0, 4) == "CMD:";
+            if (l || r) return l == r ? 0 : (l ? 1 : -1);
+            return std::less()(lhs, rhs) ? -1 : 1;
+        }
+    };
+    std::vector<std::string> input{"CMD:CONNECT TO", "data:a123", "data:a125", "data:b1", "CMD:SEND", "data:tv1", "data:c3", "CMD:CLOSE"};
+    hicc::queue::priority_queue<std::string, int, cmd_comp> pq;
+    hicc::queue::dary_heap<std::string, int, cmd_comp> dh;
+    for (auto const &s : input) pq.push(s), dh.push(s);
+    while (!pq.empty()) {
+        auto a = pq.pop();
+        if (dh.front() != a || dh.pop() != a) std::abort();
+        std::cout << a << '\n';
+    }
+    if (!dh.empty() || !dh.pop().empty()) std::abort();
+
+    // against a sorted copy, for several arities and both orders
+    std::default_random_engine e1(3);
+    std::uniform_int_distribution<int> dist(0, 500);
+    std::vector<int> keys(20000);
+    for (auto &k : keys) k = dist(e1);
+    auto check = [&keys](auto &&heap, bool reverse) {
+        std::vector<int> sorted{keys};
+        std::sort(sorted.begin(), sorted.end());
+        if (!reverse) std::reverse(sorted.begin(), sorted.end());
+        std::size_t i = 0;
+        for (; i < keys.size() / 2; i++) heap.push(keys[i]);
+        std::vector<int> popped;
+        for (int j = 0; j < 1000; j++) popped.push_back(heap.pop());
+        for (; i < keys.size(); i++) heap.push(keys[i]);
+        while (!heap.empty()) popped.push_back(heap.pop());
+        std::vector<int> expected{popped.begin() + 1000, popped.end()};
+        if (!std::is_sorted(popped.begin(), popped.begin() + 1000, [reverse](int a, int b) { return reverse ? a < b : a > b; }) ||
+            !std::is_sorted(expected.begin(), expected.end(), [reverse](int a, int b) { return reverse ? a < b : a > b; })) std::abort();
+        std::sort(popped.begin(), popped.end());
+        if (!reverse) std::reverse(popped.begin(), popped.end());
+        if (!std::is_permutation(popped.begin(), popped.end(), sorted.begin())) std::abort();
+    };
+    check(hicc::queue::dary_heap<int, int, int_comp, 2>{}, false);
+    check(hicc::queue::dary_heap<int, int, int_comp>{}, false);
+    check(hicc::queue::dary_heap<int, int, int_comp, 8, true>{}, true);
+
+    // move-only elements
+    struct ptr_comp {
+        int operator()(std::unique_ptr<int> const &lhs, std::unique_ptr<int> const &rhs) const { return int_comp{}(*lhs, *rhs); }
+    };
+    hicc::queue::dary_heap<std::unique_ptr<int>, int, ptr_comp> up;
+    up.reserve(100);
+    if (up.capacity() < 100) std::abort();
+    for (int i : {5, 1, 9, 3, 7}) up.push(std::make_unique<int>(i));
+    up.emplace(new int(8));
+    for (int i : {9, 8, 7, 5, 3, 1})
+        if (*up.pop() != i) std::abort();
+    if (up.pop()) std::abort();
+}
+
+void test_indexed_heap() {
+    using heap = hicc::queue::indexed_heap<int, int, int_comp>;
+    using handle = heap::handle;
+
+    // against a model of the live handles, with random pushes, pops,
+    // updates and erases.
+    heap q;
+    std::vector<std::pair<handle, int>> live;
+    std::vector<handle> dead;
+    std::default_random_engine e1(9);
+    std::uniform_int_distribution<int> dist(0, 1000);
+    for (int i = 0; i < 50000; i++) {
+        int op = dist(e1) % 8;
+        if (op < 3 || live.empty()) {
+            int v = dist(e1);
+            live.emplace_back(q.push(v), v);
+        } else if (op == 3) {
+            auto best = std::max_element(live.begin(), live.end(), [](auto const &a, auto const &b) { return a.second < b.second; });
+            if (q.front() != best->second) std::abort();
+            auto h = q.front_handle();
+            auto it = std::find_if(live.begin(), live.end(), [h](auto const &a) { return a.first == h; });
+            if (it == live.end() || it->second != best->second || q.pop() != best->second) std::abort();
+            dead.push_back(h);
+            live.erase(it);
+        } else if (op < 6) {
+            auto &e = live[std::size_t(dist(e1)) % live.size()];
+            e.second = dist(e1);
+            if (!q.update(e.first, e.second)) std::abort();
+        } else {
+            std::size_t at = std::size_t(dist(e1)) % live.size();
+            if (!q.erase(live[at].first)) std::abort();
+            dead.push_back(live[at].first);
+            live.erase(live.begin() + std::ptrdiff_t(at));
+        }
+        if (i % 5000 == 0) {
+            for (auto const &[h, v] : live)
+                if (!q.contains(h) || q.get(h) != v) std::abort();
+            for (auto const &h : dead)
+                if (q.contains(h) || q.erase(h) || q.update(h, 1)) std::abort();
+        }
+    }
+    if (q.size() != live.size()) std::abort();
+    std::vector<int> popped, expected;
+    for (auto const &e : live) expected.push_back(e.second);
+    std::sort(expected.rbegin(), expected.rend());
+    while (!q.empty()) popped.push_back(q.pop());
+    if (popped != expected) std::abort();
+
+    // updated elements go behind their equals
+    hicc::queue::indexed_heap<int, int, int_comp, 2, true> r;
+    auto a = r.push(5), b = r.push(5), c = r.push(7);
+    r.update(a, 5);
+    r.update(c, 1);
+    if (r.front_handle() != c || r.pop() != 1 || r.front_handle() != b) std::abort();
+    r.clear();
+    if (!r.empty() || r.contains(a) || r.contains(b)) std::abort();
+
+    // reprioritizing queued jobs: update() against erase and insert in a
+    // std::set, and against popping and pushing them all again.
+    const int jobs = 100 * 1000, rounds = 200 * 1000;
+    std::vector<int> prio(jobs);
+    for (auto &p : prio) p = dist(e1);
+    std::vector<std::pair<int, int>> changes(rounds);
+    for (auto &ch : changes) ch = {int(std::size_t(dist(e1) * 1000 + dist(e1)) % jobs), dist(e1)};
+
+    auto t0 = std::chrono::steady_clock::now();
+    heap h;
+    h.reserve(jobs);
+    std::vector<handle> handles;
+    for (int p : prio) handles.push_back(h.push(p));
+    for (auto const &ch : changes) h.update(handles[std::size_t(ch.first)], ch.second);
+    auto t1 = std::chrono::steady_clock::now();
+    std::set<std::pair<int, int>> ordered;
+    std::vector<int> cur{prio};
+    for (int j = 0; j < jobs; j++) ordered.emplace(prio[std::size_t(j)], j);
+    for (auto const &ch : changes) {
+        ordered.erase({cur[std::size_t(ch.first)], ch.first});
+        cur[std::size_t(ch.first)] = ch.second;
+        ordered.emplace(ch.second, ch.first);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    hicc::queue::dary_heap<std::pair<int, int>, int, pair_comp> again;
+    std::vector<int> cur2{prio};
+    for (int j = 0; j < jobs; j++) again.push({prio[std::size_t(j)], j});
+    for (std::size_t i = 0; i < 5; i++) {
+        cur2[std::size_t(changes[i].first)] = changes[i].second;
+        hicc::queue::dary_heap<std::pair<int, int>, int, pair_comp> next;
+        next.reserve(jobs);
+        while (!again.empty()) {
+            auto job = again.pop();
+            next.push({cur2[std::size_t(job.second)], job.second});
+        }
+        std::swap(again, next);
+    }
+    auto t3 = std::chrono::steady_clock::now();
+    if (h.front() != ordered.rbegin()->first) std::abort();
+    using us = std::chrono::duration<double, std::micro>;
+    printf("  %d jobs, per reprioritizing: indexed_heap::update %.3fus, std::set %.3fus, pop and push all %.1fus\n",
+           jobs, us(t1 - t0).count() / rounds, us(t2 - t1).count() / rounds, us(t3 - t2).count() / 5);
+}
+
+void test_pq_ordered_views() {
+    using us = std::chrono::duration<double, std::micro>;
+    std::default_random_engine e1(13);
+    std::uniform_int_distribution<int> dist(0, 100 * 1000);
+
+    // the linked tree: iteration, for_each, snapshots against the pops,
+    // on random and on ascending (degenerated) input.
+    for (int kind : {1, 0}) {
+        const int n = kind == 0 ? 100 * 1000 : 5000;
+        hicc::queue::priority_queue<int, int, int_comp> pq, copy;
+        hicc::queue::priority_queue<int, int, int_comp, std::list<int>, true> rq;
+        std::vector<int> expected;
+        for (int i = 0; i < n; i++) {
+            int v = kind == 0 ? dist(e1) : i;
+            pq.push(v), copy.push(v), rq.push(v);
+            expected.push_back(v);
+        }
+        std::sort(expected.rbegin(), expected.rend());
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<int> walked;
+        for (int v : pq) walked.push_back(v);
+        auto t1 = std::chrono::steady_clock::now();
+        std::vector<int> visited;
+        pq.for_each([&visited](int v) { visited.push_back(v); });
+        auto all = pq.sorted_snapshot();
+        auto top = pq.top_k(100);
+        // popping all is quadratic in the linked tree, the emptied nodes
+        // stay in it: check the first pops only.
+        for (int i = 0; i < 100; i++)
+            if (copy.pop() != top[std::size_t(i)]) std::abort();
+        if (walked != expected || visited != expected || all != expected || pq.size() != std::size_t(n) ||
+            !std::equal(top.begin(), top.end(), expected.begin()) || top.size() != 100) std::abort();
+        auto least = rq.top_k(10);
+        for (int i = 0; i < 10; i++)
+            if (least[std::size_t(i)] != *(expected.rbegin() + i)) std::abort();
+        printf("  priority_queue, %s %d: full iteration %.1fus\n", kind == 0 ? "random" : "ascending", n, us(t1 - t0).count());
+    }
+
+    // the heaps: sorted_snapshot() and top_k() against the pops of a copy
+    const int n = 1000 * 1000;
+    hicc::queue::dary_heap<int, int, int_comp> dh;
+    hicc::queue::indexed_heap<int, int, int_comp, 8> ih;
+    dh.reserve(n);
+    for (int i = 0; i < n; i++) {
+        int v = dist(e1);
+        dh.push(v), ih.push(v);
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    auto top = dh.top_k(100);
+    auto t1 = std::chrono::steady_clock::now();
+    auto part = dh.sorted_snapshot(100);
+    auto t2 = std::chrono::steady_clock::now();
+    auto all = dh.sorted_snapshot();
+    auto t3 = std::chrono::steady_clock::now();
+    if (top != part || !std::equal(top.begin(), top.end(), all.begin()) || all.size() != std::size_t(n) || dh.size() != std::size_t(n))
+        std::abort();
+    if (ih.top_k(1000) != ih.sorted_snapshot(1000) || ih.top_k(1000) != dh.top_k(1000)) std::abort();
+    auto copy = dh;
+    for (int v : all)
+        if (copy.pop() != v) std::abort();
+    if (!dh.top_k(0).empty() || hicc::queue::dary_heap<int, int, int_comp>{}.top_k(5).size() != 0) std::abort();
+    printf("  dary_heap %d: top_k(100) %.1fus, sorted_snapshot(100) %.1fus, sorted_snapshot() %.1fus\n",
+           n, us(t1 - t0).count(), us(t2 - t1).count(), us(t3 - t2).count());
+}
+
+template<class Queue>
+double bench_queue(Queue &q, std::vector<int> const &keys) {
+    auto t0 = std::chrono::steady_clock::now();
+    long sum = 0;
+    for (int k : keys) q.push(k);
+    while (!q.empty()) sum += q.pop();
+    auto t1 = std::chrono::steady_clock::now();
+    if (sum == 42) std::cout << ' ';
+    return double(keys.size()) / std::chrono::duration<double, std::micro>(t1 - t0).count();
+}
+
+void bench_pq() {
+    struct std_queue : std::priority_queue<int> {
+        int pop() {
+            int t = top();
+            std::priority_queue<int>::pop();
+            return t;
+        }
+    };
+    std::default_random_engine e1(5);
+    std::uniform_int_distribution<int> uniform(0, 1 << 30);
+    std::geometric_distribution<int> skewed(0.01);
+    printf("  %-12s %10s %12s %12s %12s %12s %14s  (Mops/s, push all then pop all)\n",
+           "input", "n", "dary<2>", "dary<4>", "dary<8>", "std", "priority_queue");
+    for (int kind = 0; kind < 3; kind++) {
+        const char *title = kind == 0 ? "uniform" : (kind == 1 ? "skewed" : "ascending");
+        for (int n : {10 * 1000, 1000 * 1000}) {
+            std::vector<int> keys(static_cast<std::size_t>(n));
+            for (int i = 0; i < n; i++)
+                keys[std::size_t(i)] = kind == 0 ? uniform(e1) : (kind == 1 ? skewed(e1) : i);
+            hicc::queue::dary_heap<int, int, int_comp, 2> d2;
+            hicc::queue::dary_heap<int, int, int_comp, 4> d4;
+            hicc::queue::dary_heap<int, int, int_comp, 8> d8;
+            std_queue sq;
+            d4.reserve(keys.size());
+            printf("  %-12s %10d %12.2f %12.2f %12.2f %12.2f", title, n,
+                   bench_queue(d2, keys), bench_queue(d4, keys), bench_queue(d8, keys), bench_queue(sq, keys));
+            // the linked tree is quadratic on skewed input, and recurses
+            // as deep as the tree: keep it to the small runs.
+            if (n <= 10 * 1000) {
+                hicc::queue::priority_queue<int, int, int_comp> pq;
+                printf(" %14.2f\n", bench_queue(pq, keys));
+            } else {
+                printf(" %14s\n", "-");
+            }
+        }
+    }
+}
+
+// the mean count of better elements still queued when one is popped, keys are 0..n-1.
+template<class Queue>
+double mean_rank_error(Queue &q, int n) {
+    std::vector<int> keys(static_cast<std::size_t>(n));
+    for (int i = 0; i < n; i++) keys[std::size_t(i)] = i;
+    std::shuffle(keys.begin(), keys.end(), std::default_random_engine(11));
+    for (int k : keys) q.push(k);
+    // a fenwick tree over the keys still queued
+    std::vector<int> tree(keys.size() + 1);
+    auto add = [&tree](int i, int d) {
+        for (std::size_t x = std::size_t(i) + 1; x < tree.size(); x += x & (~x + 1)) tree[x] += d;
+    };
+    auto below = [&tree](int i) {
+        int sum = 0;
+        for (std::size_t x = std::size_t(i); x > 0; x -= x & (~x + 1)) sum += tree[x];
+        return sum;
+    };
+    for (int k : keys) add(k, 1);
+    double errors = 0;
+    std::vector<bool> seen(keys.size());
+    for (int i = n; i > 0; i--) {
+        int k;
+        if (!q.try_pop(k) || seen[std::size_t(k)]) std::abort();
+        seen[std::size_t(k)] = true;
+        errors += i - below(k + 1); // the queued ones greater than k
+        add(k, -1);
+    }
+    int k;
+    if (q.try_pop(k) || !q.empty()) std::abort();
+    return errors / n;
+}
+
+void test_multi_queue() {
+    // one shard is a plain dary_heap
+    hicc::queue::multi_queue<int, int, int_comp> one(1, 1);
+    hicc::queue::multi_queue<int, int, int_comp, 4, true> rev(1, 1);
+    for (int i : {5, 1, 9, 3, 7}) one.push(i), rev.push(i);
+    if (one.size() != 5 || one.shards() != 1) std::abort();
+    for (int i : {9, 7, 5, 3, 1})
+        if (one.pop() != i) std::abort();
+    for (int i : {1, 3, 5, 7, 9})
+        if (rev.pop() != i) std::abort();
+    if (!one.empty() || one.pop() != 0) std::abort();
+
+    // relaxed: every element once, a few ranks off the best at most on average
+    for (std::size_t threads : {1, 4, 16}) {
+        hicc::queue::multi_queue<int, int, int_comp> mq(threads);
+        double err = mean_rank_error(mq, 20000);
+        printf("  %2lu shards: mean rank error %.2f\n", mq.shards(), err);
+        if (err > double(mq.shards()) * 4) std::abort();
+    }
+
+    // move-only elements
+    struct ptr_comp {
+        int operator()(std::unique_ptr<int> const &lhs, std::unique_ptr<int> const &rhs) const { return int_comp{}(*lhs, *rhs); }
+    };
+    hicc::queue::multi_queue<std::unique_ptr<int>, int, ptr_comp> up(2);
+    up.emplace(new int(3));
+    up.push(std::make_unique<int>(4));
+    int sum = 0;
+    for (std::unique_ptr<int> p; up.try_pop(p);) sum += *p;
+    if (sum != 7 || up.pop()) std::abort();
+
+    // concurrent producers and consumers, each element popped exactly once
+    const int producers = 4, consumers = 4, per_producer = 20000;
+    hicc::queue::multi_queue<int, int, int_comp> mq(producers + consumers);
+    std::vector<std::atomic_int> counts(std::size_t(producers * per_producer));
+    std::atomic_int popped{0};
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++)
+        threads.emplace_back([&mq, p] {
+            for (int i = 0; i < per_producer; i++) mq.push(p * per_producer + i);
+        });
+    for (int c = 0; c < consumers; c++)
+        threads.emplace_back([&] {
+            int k;
+            while (popped.load() < producers * per_producer)
+                if (mq.try_pop(k)) ++counts[std::size_t(k)], ++popped;
+        });
+    for (auto &t : threads) t.join();
+    for (auto &c : counts)
+        if (c.load() != 1) std::abort();
+    if (!mq.empty()) std::abort();
+}
+
+void bench_multi_queue() {
+    // a mixed push/pop load on a prefilled queue, split over the threads
+    struct locked_heap {
+        std::mutex m;
+        hicc::queue::dary_heap<int, int, int_comp> heap;
+        void push(int k) {
+            std::lock_guard<std::mutex> lk(m);
+            heap.push(k);
+        }
+        bool try_pop(int &k) {
+            std::lock_guard<std::mutex> lk(m);
+            if (heap.empty()) return false;
+            k = heap.pop();
+            return true;
+        }
+    };
+    auto run = [](auto &q, unsigned threads, int ops) {
+        std::default_random_engine e1(7);
+        std::uniform_int_distribution<int> dist(0, 1 << 30);
+        for (int i = 0; i < 100000; i++) q.push(dist(e1));
+        std::vector<std::thread> ts;
+        auto t0 = std::chrono::steady_clock::now();
+        for (unsigned t = 0; t < threads; t++)
+            ts.emplace_back([&q, t, n = ops / int(threads)] {
+                std::default_random_engine e(t);
+                std::uniform_int_distribution<int> d(0, 1 << 30);
+                int k;
+                for (int i = 0; i < n; i++)
+                    if (i & 1) (void) q.try_pop(k);
+                    else q.push(d(e));
+            });
+        for (auto &t : ts) t.join();
+        auto t1 = std::chrono::steady_clock::now();
+        return double(ops) / std::chrono::duration<double, std::micro>(t1 - t0).count();
+    };
+    const int ops = 400000;
+    printf("  %u hardware threads\n", std::thread::hardware_concurrency());
+    printf("  %8s %14s %14s  (Mops/s, half push half pop)\n", "threads", "multi_queue", "mutex+heap");
+    for (unsigned threads : {1u, 2u, 4u, 8u, 16u}) {
+        hicc::queue::multi_queue<int, int, int_comp> mq(threads);
+        locked_heap lh;
+        double a = run(mq, threads, ops);
+        double b = run(lh, threads, ops);
+        printf("  %8u %14.2f %14.2f\n", threads, a, b);
+    }
+}
+
 int main() {
     HICC_TEST_FOR(test_pq);
+    HICC_TEST_FOR(test_dary_heap);
+    HICC_TEST_FOR(test_indexed_heap);
+    HICC_TEST_FOR(test_pq_ordered_views);
+    HICC_TEST_FOR(bench_pq);
+    HICC_TEST_FOR(test_multi_queue);
+    HICC_TEST_FOR(bench_multi_queue);
 }
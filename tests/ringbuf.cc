@@ -8,7 +8,9 @@
 #include <thread>
 
 #include <chrono>
+#include <cstdint>
 #include <cstring>
+#include <ctime>
 #include <iostream>
 
 #include <algorithm>
@@ -172,7 +174,8 @@ void test_ringbuf() {
         // enqueue/dequeue test
 
         // tiny_pool tp1;
-        unsigned int n = 5; // std::thread::hardware_concurrency()
+        // keep producers and consumers balanced, or the blocked ones never return.
+        unsigned int n = 4; // std::thread::hardware_concurrency()
         hicc::pool::thread_pool threads(n);
         hicc::pool::threaded_message_queue<std::string> messages;
         blocked_ring_buf rb(7);
@@ -189,6 +192,285 @@ void test_ringbuf() {
     printf("__ END2\n");
 }
 
+namespace {
+    // each item is (producer_id << 32 | seq), so the consumers can verify
+    // that nothing was lost, duplicated, or reordered per producer.
+    template<typename Q, typename Push, typename Pop>
+    void stress_mpmc(const char *title, Q &q, unsigned int producers, unsigned int consumers,
+                     std::uint64_t per_producer, bool check_order, Push &&push, Pop &&pop) {
+        std::uint64_t total = producers * per_producer;
+        std::uint64_t per_consumer = total / consumers;
+        std::atomic<std::uint64_t> sum{0}, count{0};
+        std::atomic_bool ordered{true};
+        std::vector<std::thread> threads;
+
+        auto t0 = std::chrono::steady_clock::now();
+        for (unsigned int c = 0; c < consumers; c++) {
+            threads.emplace_back([&] {
+                std::vector<std::uint64_t> last(producers, 0);
+                std::uint64_t local_sum{0};
+                for (std::uint64_t i = 0; i < per_consumer; i++) {
+                    std::uint64_t v = pop(q);
+                    auto pid = v >> 32, seq = v & 0xffffffff;
+                    if (seq < last[pid]) ordered = false;
+                    last[pid] = seq;
+                    local_sum += seq;
+                }
+                sum += local_sum;
+                count += per_consumer;
+            });
+        }
+        for (unsigned int p = 0; p < producers; p++) {
+            threads.emplace_back([&, p] {
+                for (std::uint64_t i = 1; i <= per_producer; i++)
+                    push(q, (std::uint64_t(p) << 32) | i);
+            });
+        }
+        for (auto &t : threads) t.join();
+        auto t1 = std::chrono::steady_clock::now();
+
+        auto ms = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() / 1000.0;
+        printf("  %-28s %2uP/%2uC: %8lu items in %9.3lfms, %12.1lf ops/s, ordered: %s\n",
+               title, producers, consumers, (unsigned long) count.load(), ms,
+               ms > 0 ? count.load() * 1000.0 / ms : 0.0, check_order ? (ordered ? "yes" : "NO") : "n/a");
+
+        std::uint64_t expected = producers * (per_producer * (per_producer + 1) / 2);
+        if (count != total || sum != expected || (check_order && !ordered)) {
+            fprintf(stderr, "  FAILED: count=%lu (expected %lu), sum=%lu (expected %lu)\n",
+                    (unsigned long) count.load(), (unsigned long) total,
+                    (unsigned long) sum.load(), (unsigned long) expected);
+            std::abort();
+        }
+    }
+
+    // spin (with yield) till the non-blocking ring_buffer accepts/returns one.
+    auto rb_push = [](auto &q, std::uint64_t v) {
+        while (!q.enqueue(std::move(v)))
+            std::this_thread::yield();
+    };
+    auto rb_pop = [](auto &q) {
+        for (;;) {
+            if (auto v = q.dequeue(); v.has_value())
+                return *v;
+            std::this_thread::yield();
+        }
+    };
+} // namespace
+
+void test_ringbuf_mpmc_stress() {
+    using rb_t = hicc::ringbuf::ring_buffer<std::uint64_t>;
+    using mq_t = hicc::pool::threaded_message_queue<std::uint64_t>;
+    auto mq_push = [](mq_t &q, std::uint64_t v) { q.emplace_back(std::move(v)); };
+    auto mq_pop = [](mq_t &q) { return *q.pop_front(); };
+
+    for (auto [np, nc] : {std::pair{1u, 1u}, {4u, 4u}, {16u, 16u}}) {
+        {
+            rb_t rb(1024);
+            stress_mpmc("ring_buffer<MPMC>", rb, np, nc, 20000, true, rb_push, rb_pop);
+        }
+        {
+            mq_t mq;
+            // threaded_message_queue pops from back, the order check is meaningless for it.
+            stress_mpmc("threaded_message_queue", mq, np, nc, 20000, false, mq_push, mq_pop);
+        }
+    }
+}
+
+void test_ringbuf_cardinality_bench() {
+    using namespace hicc::ringbuf;
+    using mpmc_t = ring_buffer<std::uint64_t, CE_DEFAULT, CA_MPMC>;
+    using mpsc_t = ring_buffer<std::uint64_t, CE_DEFAULT, CA_MPSC>;
+    using spsc_t = ring_buffer<std::uint64_t, CE_DEFAULT, CA_SPSC>;
+
+    const std::uint64_t n = 1000000;
+    {
+        mpmc_t rb(1024);
+        stress_mpmc("ring_buffer<MPMC>", rb, 1, 1, n, true, rb_push, rb_pop);
+    }
+    {
+        mpsc_t rb(1024);
+        stress_mpmc("ring_buffer<MPSC>", rb, 1, 1, n, true, rb_push, rb_pop);
+    }
+    {
+        spsc_t rb(1024);
+        stress_mpmc("ring_buffer<SPSC>", rb, 1, 1, n, true, rb_push, rb_pop);
+    }
+
+    for (unsigned int np : {4u, 16u}) {
+        {
+            mpmc_t rb(1024);
+            stress_mpmc("ring_buffer<MPMC>", rb, np, 1, n / np, true, rb_push, rb_pop);
+        }
+        {
+            mpsc_t rb(1024);
+            stress_mpmc("ring_buffer<MPSC>", rb, np, 1, n / np, true, rb_push, rb_pop);
+        }
+    }
+}
+
+namespace {
+    template<typename RB>
+    void check_bulk_wrap_around(const char *title) {
+        RB rb(8);
+        std::vector<std::uint64_t> in{1, 2, 3, 4, 5, 6, 7, 8, 9, 10}, out(16);
+
+        // an empty range is a no-op, on either side.
+        if (rb.enqueue_bulk(in.begin(), in.begin()) != 0 || rb.dequeue_bulk(out.begin(), 0) != 0 || !rb.empty()) {
+            fprintf(stderr, "  %s: FAILED at the empty batch\n", title);
+            std::abort();
+        }
+
+        // move the indices near to the end, so the next batch wraps around.
+        auto n = rb.enqueue_bulk(in.begin(), in.begin() + 5);
+        auto m = rb.dequeue_bulk(out.begin(), 5);
+        if (n != 5 || m != 5 || !std::equal(in.begin(), in.begin() + 5, out.begin())) {
+            fprintf(stderr, "  %s: FAILED at the first batch, n=%lu, m=%lu\n", title, (unsigned long) n, (unsigned long) m);
+            std::abort();
+        }
+
+        // only 8 slots, the last 2 elements must be refused.
+        n = rb.enqueue_bulk(in.begin(), in.end());
+        m = rb.dequeue_bulk(out.begin(), out.size());
+        if (n != 8 || m != 8 || !std::equal(in.begin(), in.begin() + 8, out.begin()) || !rb.empty()) {
+            fprintf(stderr, "  %s: FAILED at the wrapped batch, n=%lu, m=%lu\n", title, (unsigned long) n, (unsigned long) m);
+            std::abort();
+        }
+        printf("  %-28s bulk wrap-around ok\n", title);
+    }
+
+    template<typename RB>
+    void bench_bulk(const char *title, unsigned int producers, std::uint64_t per_producer, std::size_t batch) {
+        RB rb(1024);
+        std::uint64_t total = producers * per_producer, sum = 0, count = 0;
+        std::vector<std::thread> threads;
+        auto t0 = std::chrono::steady_clock::now();
+        for (unsigned int p = 0; p < producers; p++) {
+            threads.emplace_back([&rb, per_producer, batch] {
+                std::vector<std::uint64_t> buf(batch);
+                for (std::uint64_t i = 1; i <= per_producer;) {
+                    std::size_t k = std::min<std::uint64_t>(batch, per_producer - i + 1);
+                    for (std::size_t j = 0; j < k; j++) buf[j] = i + j;
+                    for (auto it = buf.begin(), end = buf.begin() + k; it != end;) {
+                        it += rb.enqueue_bulk(it, end);
+                        if (it != end) std::this_thread::yield();
+                    }
+                    i += k;
+                }
+            });
+        }
+        std::vector<std::uint64_t> buf(batch);
+        while (count < total) {
+            auto k = rb.dequeue_bulk(buf.begin(), batch);
+            for (std::size_t j = 0; j < k; j++) sum += buf[j];
+            count += k;
+            if (k == 0) std::this_thread::yield();
+        }
+        for (auto &t : threads) t.join();
+        auto t1 = std::chrono::steady_clock::now();
+
+        auto ms = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() / 1000.0;
+        printf("  %-28s %2uP/ 1C, batch %4lu: %8lu items in %9.3lfms, %12.1lf ops/s\n",
+               title, producers, (unsigned long) batch, (unsigned long) count, ms,
+               ms > 0 ? count * 1000.0 / ms : 0.0);
+        if (sum != producers * (per_producer * (per_producer + 1) / 2)) {
+            fprintf(stderr, "  FAILED: sum=%lu\n", (unsigned long) sum);
+            std::abort();
+        }
+    }
+} // namespace
+
+void test_ringbuf_bulk() {
+    using namespace hicc::ringbuf;
+    using mpmc_t = ring_buffer<std::uint64_t, CE_DEFAULT, CA_MPMC>;
+    using mpsc_t = ring_buffer<std::uint64_t, CE_DEFAULT, CA_MPSC>;
+    using spsc_t = ring_buffer<std::uint64_t, CE_DEFAULT, CA_SPSC>;
+
+    check_bulk_wrap_around<mpmc_t>("ring_buffer<MPMC>");
+    check_bulk_wrap_around<mpsc_t>("ring_buffer<MPSC>");
+    check_bulk_wrap_around<spsc_t>("ring_buffer<SPSC>");
+
+    const std::uint64_t n = 1000000;
+    for (std::size_t batch : {1u, 16u, 256u}) {
+        bench_bulk<mpmc_t>("ring_buffer<MPMC>", 1, n, batch);
+        bench_bulk<mpsc_t>("ring_buffer<MPSC>", 1, n, batch);
+        bench_bulk<spsc_t>("ring_buffer<SPSC>", 1, n, batch);
+        bench_bulk<mpmc_t>("ring_buffer<MPMC>", 4, n / 4, batch);
+        bench_bulk<mpsc_t>("ring_buffer<MPSC>", 4, n / 4, batch);
+    }
+}
+
+void test_ringbuf_park() {
+    using namespace hicc::ringbuf;
+    using namespace std::chrono_literals;
+    using park_t = ring_buffer<std::uint64_t, CE_BLOCKED_AND_PARK>;
+    using spin_t = ring_buffer<std::uint64_t, CE_BLOCKED_AND_SPIN>;
+
+    // correctness under blocking enqueue/dequeue, a small ring forces both sides to park.
+    auto push = [](auto &q, std::uint64_t v) { q.enqueue(std::move(v)); };
+    auto pop = [](auto &q) { return *q.dequeue(); };
+    for (auto [np, nc] : {std::pair{1u, 1u}, {4u, 4u}, {16u, 16u}}) {
+        park_t rb(16);
+        stress_mpmc("ring_buffer<PARK>", rb, np, nc, 20000, true, push, pop);
+    }
+
+    {
+        // timeouts
+        park_t rb(2);
+        auto t0 = std::chrono::steady_clock::now();
+        auto v = rb.dequeue_for(20ms);
+        auto elapsed = std::chrono::steady_clock::now() - t0;
+        std::uint64_t x = 1, y = 2, z = 3;
+        bool ok = !v.has_value() && elapsed >= 20ms;
+        ok = ok && rb.enqueue_for(std::move(x), 1ms) && rb.enqueue_for(std::move(y), 1ms);
+        ok = ok && !rb.enqueue_until(std::move(z), std::chrono::steady_clock::now() + 10ms) && z == 3;
+        ok = ok && rb.dequeue_until(std::chrono::system_clock::now() + 1ms) == 1u;
+        printf("  timeouts: dequeue_for(20ms) on empty took %.3lfms, %s\n",
+               std::chrono::duration<double, std::milli>(elapsed).count(), ok ? "ok" : "FAILED");
+        if (!ok) std::abort();
+    }
+
+    {
+        // idle consumers: the cpu time burnt while nothing arrives.
+        auto idle_cpu = [](auto &rb, const char *title) {
+            std::vector<std::thread> threads;
+            auto c0 = std::clock();
+            auto t0 = std::chrono::steady_clock::now();
+            for (int i = 0; i < 4; i++)
+                threads.emplace_back([&rb] { (void) rb.dequeue_for(200ms); });
+            for (auto &t : threads) t.join();
+            auto wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            auto cpu = double(std::clock() - c0) / CLOCKS_PER_SEC;
+            printf("  %-28s 4 idle consumers for %.3lfs burnt %.3lfs cpu\n", title, wall, cpu);
+        };
+        spin_t rb1(16);
+        idle_cpu(rb1, "ring_buffer<SPIN>");
+        park_t rb2(16);
+        idle_cpu(rb2, "ring_buffer<PARK>");
+    }
+
+    {
+        // wakeup latency of a parked consumer.
+        park_t rb(16);
+        std::vector<double> lat;
+        const int rounds = 500;
+        std::thread consumer([&] {
+            for (int i = 0; i < rounds; i++) {
+                auto v = rb.dequeue();
+                auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+                lat.push_back(double(now - std::int64_t(*v)) / 1000.0);
+            }
+        });
+        for (int i = 0; i < rounds; i++) {
+            std::this_thread::sleep_for(200us); // let the consumer park
+            rb.enqueue(std::uint64_t(std::chrono::steady_clock::now().time_since_epoch().count()));
+        }
+        consumer.join();
+        std::sort(lat.begin(), lat.end());
+        printf("  wakeup latency (us): p50 %.1lf, p99 %.1lf, max %.1lf\n",
+               lat[lat.size() / 2], lat[lat.size() * 99 / 100], lat.back());
+    }
+}
+
 int main() {
     // std::cout << "cache_line: " << hicc::cross::cache_line_size() << '\n';
     // std::cout << "hardware_constructive_interference_size: " << hicc::cross::hardware_constructive_interference_size << '\n';
@@ -204,4 +486,8 @@ int main() {
     HICC_TEST_FOR(test_tiny_pool);
 
     HICC_TEST_FOR(test_ringbuf);
+    HICC_TEST_FOR(test_ringbuf_mpmc_stress);
+    HICC_TEST_FOR(test_ringbuf_cardinality_bench);
+    HICC_TEST_FOR(test_ringbuf_bulk);
+    HICC_TEST_FOR(test_ringbuf_park);
 }
@@ -10,9 +10,22 @@
 #include "hicc/hz-x-class.hh"
 #include "hicc/hz-x-test.hh"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <random>
 #include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
 
 hicc::debug::X x_global_var;
 
@@ -277,10 +290,247 @@ void test_alarmer() {
     printf("end of %s\n", __FUNCTION_NAME__);
 }
 
+void test_ticker_hashed_wheel() {
+    using namespace std::literals::chrono_literals;
+    using clock = hicc::chrono::Clock;
+    using wheel_ticker = hicc::chrono::ticker<std::nullopt_t, clock, false, hicc::chrono::detail::every_job<clock, false>, hicc::chrono::detail::hashed_wheel<clock>>;
+
+    hicc::pool::conditional_wait_for_int count{8};
+    auto t = wheel_ticker::get();
+    t->every(10ms)
+            .on([&count] {
+                hicc::pool::cw_setter cws(count);
+                printf("  - wheel every [%02d]: %s\n", count.val(), hicc::chrono::format_time_point().c_str());
+            })
+            .build();
+    count.wait();
+    printf("end of %s\n", __FUNCTION_NAME__);
+}
+
+namespace {
+    using wheel_clock = hicc::chrono::Clock;
+    using wheel_jobs = std::vector<std::shared_ptr<hicc::chrono::timer_job>>;
+
+    wheel_jobs make_wheel_jobs(std::size_t n) {
+        wheel_jobs jobs;
+        jobs.reserve(n);
+        for (std::size_t i = 0; i < n; i++)
+            jobs.emplace_back(std::make_shared<hicc::chrono::detail::in_job<>>([] {}));
+        return jobs;
+    }
+
+    // inserts the jobs, cancels every other one, then expires the rest
+    // by stepping the time 1ms a time. hashed_wheel cancels by handles.
+    template<class Wheel>
+    void bench_wheel(const char *title, Wheel &w, wheel_jobs const &jobs, std::vector<wheel_clock::duration> const &offsets, wheel_clock::time_point base) {
+        using namespace std::chrono;
+        constexpr bool by_handle = std::is_same_v<Wheel, hicc::chrono::detail::hashed_wheel<wheel_clock>>;
+        std::vector<typename hicc::chrono::detail::hashed_wheel<wheel_clock>::handle> handles;
+        handles.reserve(jobs.size());
+        auto t0 = steady_clock::now();
+        for (std::size_t i = 0; i < jobs.size(); i++) {
+            auto j = jobs[i];
+            if constexpr (by_handle)
+                handles.push_back(w.schedule(base + offsets[i], std::move(j)));
+            else
+                w.add(base + offsets[i], std::move(j));
+        }
+        auto t1 = steady_clock::now();
+        for (std::size_t i = 0; i < jobs.size(); i += 2) {
+            if constexpr (by_handle)
+                w.cancel(handles[i]);
+            else
+                w.remove(base + offsets[i], jobs[i]);
+        }
+        auto t2 = steady_clock::now();
+        wheel_jobs out;
+        wheel_clock::time_point picked;
+        std::size_t fired = 0;
+        auto end = base + *std::max_element(offsets.begin(), offsets.end()) + seconds(2);
+        for (auto now = base; now <= end; now += milliseconds(1)) {
+            if (w.pop_expired(now, out, picked)) {
+                fired += out.size();
+                out.clear();
+            }
+        }
+        auto t3 = steady_clock::now();
+        if (fired != jobs.size() / 2 || !w.empty()) std::abort();
+        auto ns = [](auto d) { return double(duration_cast<nanoseconds>(d).count()); };
+        printf("  %-14s insert %7.1lfns, cancel %7.1lfns, expire %7.1lfns per job (%zu jobs)\n", title,
+               ns(t1 - t0) / double(jobs.size()), ns(t2 - t1) / double(jobs.size() / 2), ns(t3 - t2) / double(fired), jobs.size());
+    }
+} // namespace
+
+void test_timing_wheel() {
+    using namespace std::chrono;
+    using hashed_wheel = hicc::chrono::detail::hashed_wheel<wheel_clock>;
+    std::mt19937_64 rng(7);
+    auto base = wheel_clock::now();
+
+    {
+        // every job fires once, never early and at most a step late; the
+        // delays span all levels of a small wheel (4 slots of 2 bits)
+        hashed_wheel w(milliseconds(1), 4, 2, base);
+        const std::size_t n = 5000;
+        auto jobs = make_wheel_jobs(n);
+        std::unordered_map<hicc::chrono::timer_job *, wheel_clock::time_point> due;
+        std::uniform_int_distribution<long> dist(0, 400000); // us
+        for (std::size_t i = 0; i < n; i++) {
+            auto tp = base + microseconds(dist(rng));
+            due[jobs[i].get()] = tp;
+            if (i % 3 == 0) {
+                auto h = w.schedule(tp, std::shared_ptr<hicc::chrono::timer_job>(jobs[i]));
+                if (i % 2 == 0 && !w.cancel(h)) std::abort();
+                if (i % 2 == 0 && w.cancel(h)) std::abort(); // stale handle
+            } else {
+                w.add(tp, std::shared_ptr<hicc::chrono::timer_job>(jobs[i]));
+                if (i % 2 == 0 && !w.remove(tp, jobs[i])) std::abort();
+            }
+        }
+        std::size_t expected = w.size(), fired = 0;
+        wheel_jobs out;
+        wheel_clock::time_point picked;
+        auto step = milliseconds(3);
+        for (auto now = base; !w.empty(); now += step) {
+            if (w.pop_expired(now, out, picked)) {
+                for (auto &j : out) {
+                    auto tp = due[j.get()];
+                    if (tp > now || now - tp >= step + milliseconds(1)) std::abort();
+                }
+                fired += out.size();
+                out.clear();
+            }
+            if (now - base > seconds(10)) std::abort();
+        }
+        if (fired != expected) std::abort();
+        printf("  hashed_wheel: %zu of %zu jobs fired on time\n", fired, n);
+    }
+
+    {
+        // 200k per-connection idle timeouts within a minute
+        const std::size_t n = 200000;
+        auto jobs = make_wheel_jobs(n);
+        std::vector<wheel_clock::duration> offsets(n);
+        std::uniform_int_distribution<long> dist(0, 60000000); // us
+        for (auto &o : offsets) o = microseconds(dist(rng));
+
+        hicc::chrono::detail::ordered_wheel<wheel_clock> ow;
+        bench_wheel("ordered_wheel", ow, jobs, offsets, base);
+        hashed_wheel hw(milliseconds(1), 4, 8, base);
+        bench_wheel("hashed_wheel", hw, jobs, offsets, base);
+    }
+}
+
+namespace {
+    void report_jitter(const char *title, std::vector<long> &late) {
+        std::sort(late.begin(), late.end());
+        auto pct = [&late](double p) { return late[std::min(late.size() - 1, std::size_t(p * double(late.size())))]; };
+        printf("  %-44s lateness (us): min %6ld, p50 %6ld, p99 %6ld, p999 %6ld, max %6ld\n", title,
+               late.front(), pct(0.5), pct(0.99), pct(0.999), late.back());
+        if (late.front() < 0) std::abort(); // never early
+    }
+
+    // the due time of the i-th of the jitter jobs, spread over the milliseconds.
+    inline std::chrono::microseconds jitter_due(int i) { return std::chrono::microseconds(i * 1000 + (i * 337) % 1000); }
+
+    // schedules n one-shot jobs over n milliseconds, and reports how late
+    // they fired.
+    template<class Timer, class Clock>
+    void bench_jitter(const char *title, int n) {
+        using namespace std::chrono;
+        std::vector<long> late(std::size_t(n), 0);
+        hicc::pool::conditional_wait_for_int done{n};
+        auto t = Timer::get();
+        auto start = Clock::now() + milliseconds(300); // past the scheduling of them all
+        for (int i = 0; i < n; i++) {
+            auto due = start + jitter_due(i);
+            t->at(due)
+                    .on([&late, &done, i, due] {
+                        late[std::size_t(i)] = long(duration_cast<microseconds>(Clock::now() - due).count());
+                        hicc::pool::cw_setter cws(done);
+                    })
+                    .build();
+        }
+        done.wait();
+        report_jitter(title, late);
+    }
+} // namespace
+
+void test_timer_jitter() {
+    using steady = std::chrono::steady_clock;
+    using steady_wheel_timer = hicc::chrono::timer<std::nullopt_t, steady, false, hicc::chrono::detail::in_job<steady, false>, hicc::chrono::detail::hashed_wheel<steady>>;
+    {
+        // what the OS scheduler alone gives, for reference
+        std::vector<long> late;
+        auto start = steady::now() + std::chrono::milliseconds(10);
+        for (int i = 0; i < 2000; i++) {
+            auto due = start + jitter_due(i);
+            std::this_thread::sleep_until(due);
+            late.push_back(long(std::chrono::duration_cast<std::chrono::microseconds>(steady::now() - due).count()));
+        }
+        report_jitter("std::this_thread::sleep_until (reference)", late);
+    }
+    bench_jitter<hicc::chrono::timer<>, hicc::chrono::Clock>("timer<> (system_clock, ordered_wheel)", 2000);
+    bench_jitter<hicc::chrono::precise_timer, steady>("precise_timer (steady_clock, ordered_wheel)", 2000);
+    bench_jitter<steady_wheel_timer, steady>("timer (steady_clock, hashed_wheel 1ms)", 2000);
+}
+
+namespace {
+    // the resident set size in KB, or 0 if unknown.
+    std::size_t rss_kb() {
+#if defined(__linux__)
+        std::size_t pages_total{0}, pages_resident{0};
+        if (FILE *f = std::fopen("/proc/self/statm", "r")) {
+            if (std::fscanf(f, "%zu %zu", &pages_total, &pages_resident) != 2)
+                pages_resident = 0;
+            std::fclose(f);
+        }
+        return pages_resident * std::size_t(sysconf(_SC_PAGESIZE)) / 1024;
+#else
+        return 0;
+#endif
+    }
+} // namespace
+
+// fired jobs must be released: a busy ticker and a stream of one-shot
+// timers run for HICC_SOAK_SECONDS (3 by default), and the RSS must stay
+// flat after the warm-up.
+void test_timer_soak() {
+    using namespace std::literals::chrono_literals;
+    int seconds = 3;
+    if (const char *env = std::getenv("HICC_SOAK_SECONDS"))
+        seconds = std::max(1, std::atoi(env));
+
+    std::atomic<std::size_t> ticks{0}, shots{0};
+    auto tk = hicc::chrono::precise_ticker::get();
+    tk->every(1us).on([&ticks] { ++ticks; }).build();
+    auto tm = hicc::chrono::precise_timer::get();
+    auto shoot = [&tm, &shots](auto until) {
+        while (std::chrono::steady_clock::now() < until) {
+            for (int i = 0; i < 100; i++)
+                tm->after(1us).on([&shots] { ++shots; }).build();
+            std::this_thread::sleep_for(1ms);
+        }
+    };
+
+    shoot(std::chrono::steady_clock::now() + 500ms); // warm-up: the pools, the allocator caches
+    auto rss0 = rss_kb();
+    auto ticks0 = ticks.load(), shots0 = shots.load();
+    shoot(std::chrono::steady_clock::now() + std::chrono::seconds(seconds));
+    auto rss1 = rss_kb();
+    auto fired = (ticks - ticks0) + (shots - shots0);
+    printf("  %zu jobs fired in %ds, RSS %zuKB -> %zuKB\n", fired, seconds, rss0, rss1);
+    tk->clear();
+    tm->clear();
+    // the old _pasts held ~100 bytes for each fired job
+    if (rss1 > rss0 + 2048 && rss1 - rss0 > fired / 100) std::abort();
+}
+
 int main() {
     // test_thread();
 
     HICC_TEST_FOR(test_periodical_job);
+    HICC_TEST_FOR(test_timing_wheel);
 
 #if 1
     HICC_TEST_FOR(test_type_name);
@@ -290,6 +540,9 @@ int main() {
 
     HICC_TEST_FOR(test_ticker);
     HICC_TEST_FOR(test_ticker_interval);
+    HICC_TEST_FOR(test_ticker_hashed_wheel);
+    HICC_TEST_FOR(test_timer_jitter);
+    HICC_TEST_FOR(test_timer_soak);
 
     HICC_TEST_FOR(test_alarmer);
 